@@ -0,0 +1,117 @@
+#pragma once
+#ifndef __FL_NOMOS_BIN_KEY_HPP
+#define	__FL_NOMOS_BIN_KEY_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Fixed-width binary keys
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <functional>
+
+#include "util.hpp"
+#include "key_parser.hpp"
+
+namespace fl {
+	namespace nomos {
+
+		// 128 bit key (UUID, session ID) is kept inline; it is written as up to 32 hex digits, dashes are skipped
+		struct BinKey128
+		{
+			uint64_t high;
+			uint64_t low;
+
+			BinKey128()
+				: high(0), low(0)
+			{
+			}
+			bool operator==(const BinKey128 &key) const
+			{
+				return (low == key.low) && (high == key.high);
+			}
+			bool operator!=(const BinKey128 &key) const
+			{
+				return !(*this == key);
+			}
+			bool operator<(const BinKey128 &key) const
+			{
+				return (high < key.high) || ((high == key.high) && (low < key.low));
+			}
+			size_t hash() const
+			{
+				return low ^ high; // keys are random enough to be hashed as is
+			}
+			static BinKey128 fromString(const char *str, char **endptr = NULL)
+			{
+				BinKey128 key;
+				const char *c = str;
+				for (; *c; c++) {
+					if (*c == '-')
+						continue;
+					int8_t digit = hexDigit(*c);
+					if (digit < 0)
+						break;
+					key.high = (key.high << 4) | (key.low >> 60);
+					key.low = (key.low << 4) | digit;
+				}
+				if (endptr)
+					*endptr = const_cast<char*>(c);
+				return key;
+			}
+			void toString(std::string &str) const
+			{
+				char buf[sizeof(*this) * 2 + 1];
+				snprintf(buf, sizeof(buf), "%016llx%016llx", static_cast<unsigned long long>(high),
+					static_cast<unsigned long long>(low));
+				str = buf;
+			}
+		};
+		static_assert(sizeof(BinKey128) == 16, "BinKey128 should be stored without padding");
+
+		inline size_t hash_value(const BinKey128 &key)
+		{
+			return key.hash();
+		}
+	};
+
+	namespace utils {
+		template <>
+		inline nomos::BinKey128 convertStdStringTo<nomos::BinKey128>(const char *str, char **endptr, int base)
+		{
+			return nomos::BinKey128::fromString(str, endptr);
+		}
+
+		template <>
+		inline nomos::BinKey128 convertStdStringTo<nomos::BinKey128>(const std::string &str, char **endptr, int base)
+		{
+			return nomos::BinKey128::fromString(str.c_str(), endptr);
+		}
+
+		template <>
+		inline uint32_t getCheckSum32Tmpl<nomos::BinKey128>(const nomos::BinKey128 &key)
+		{
+			return key.hash();
+		}
+	};
+};
+
+namespace std {
+	template <>
+	struct hash<fl::nomos::BinKey128>
+	{
+		size_t operator()(const fl::nomos::BinKey128 &key) const
+		{
+			return key.hash();
+		}
+	};
+};
+
+#endif	// __FL_NOMOS_BIN_KEY_HPP
@@ -0,0 +1,189 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Item's data compression classes
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <cstdlib>
+
+#include "compression.hpp"
+#include "nomos_log.hpp"
+#include "item_memory.hpp"
+
+using namespace fl::nomos;
+
+uint32_t Compression::lzfCompress(const uint8_t *in, const uint32_t inLen, uint8_t *out, const uint32_t outLen)
+{
+	if (!inLen || !outLen)
+		return 0;
+	uint32_t hashTable[HASH_SIZE];
+	bzero(hashTable, sizeof(hashTable));
+
+	const uint8_t *ip = in;
+	const uint8_t *inEnd = in + inLen;
+	uint8_t *op = out;
+	uint8_t *outEnd = out + outLen;
+	uint8_t *literal = op++; // control byte of the current literal run
+	uint32_t literalLen = 0;
+	while (ip < inEnd) {
+		if ((ip + 2) < inEnd) {
+			uint32_t value = (ip[0] << 16) | (ip[1] << 8) | ip[2];
+			uint32_t hash = (value * 2654435761U) >> (32 - HASH_LOG);
+			const uint8_t *ref = in + hashTable[hash];
+			hashTable[hash] = ip - in;
+			uint32_t offset = ip - ref - 1;
+			if ((ref < ip) && (offset < MAX_OFFSET) && (ref[0] == ip[0]) && (ref[1] == ip[1]) && (ref[2] == ip[2])) {
+				uint32_t maxLen = inEnd - ip;
+				if (maxLen > MAX_REFERENCE)
+					maxLen = MAX_REFERENCE;
+				uint32_t len = 3;
+				while ((len < maxLen) && (ref[len] == ip[len]))
+					len++;
+
+				if (literalLen)
+					*literal = literalLen - 1;
+				else
+					op--; // drop unused control byte
+				if ((op + 4) > outEnd)
+					return 0;
+				len -= 2;
+				if (len < 7) {
+					*op++ = (len << 5) | (offset >> 8);
+				} else {
+					*op++ = (7 << 5) | (offset >> 8);
+					*op++ = len - 7;
+				}
+				*op++ = offset & 0xFF;
+				literal = op++;
+				literalLen = 0;
+				ip += len + 2;
+				continue;
+			}
+		}
+		if (op >= outEnd)
+			return 0;
+		*op++ = *ip++;
+		literalLen++;
+		if (literalLen == MAX_LITERAL) {
+			*literal = MAX_LITERAL - 1;
+			if (op >= outEnd)
+				return 0;
+			literal = op++;
+			literalLen = 0;
+		}
+	}
+	if (literalLen)
+		*literal = literalLen - 1;
+	else
+		op--;
+	return op - out;
+}
+
+uint32_t Compression::lzfDecompress(const uint8_t *in, const uint32_t inLen, uint8_t *out, const uint32_t outLen)
+{
+	const uint8_t *ip = in;
+	const uint8_t *inEnd = in + inLen;
+	uint8_t *op = out;
+	uint8_t *outEnd = out + outLen;
+	while (ip < inEnd) {
+		uint32_t ctrl = *ip++;
+		if (ctrl < MAX_LITERAL) {
+			ctrl++;
+			if (((op + ctrl) > outEnd) || ((ip + ctrl) > inEnd))
+				return 0;
+			memcpy(op, ip, ctrl);
+			op += ctrl;
+			ip += ctrl;
+		} else {
+			uint32_t len = ctrl >> 5;
+			if (len == 7) {
+				if (ip >= inEnd)
+					return 0;
+				len += *ip++;
+			}
+			len += 2;
+			if (ip >= inEnd)
+				return 0;
+			uint32_t back = ((ctrl & 0x1F) << 8) + 1 + *ip++;
+			if ((back > static_cast<uint32_t>(op - out)) || ((op + len) > outEnd))
+				return 0;
+			const uint8_t *ref = op - back;
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+	return op - out;
+}
+
+Item *Compression::pack(Item &item, const ItemHeader::TSize threshold)
+{
+	ItemHeader header = item.header();
+	const ItemHeader::TSize size = item.size();
+	if ((size >= threshold) && (size >= MIN_PACK_SIZE)) {
+		uint8_t *data = static_cast<uint8_t*>(ItemMemory::alloc(sizeof(PackedHeader) + size));
+		if (!data) {
+			log::Fatal::L("Can't allocate data for packed item\n");
+			throw std::bad_alloc();
+		}
+		uint32_t packedSize = lzfCompress(static_cast<uint8_t*>(item.data()), size, data + sizeof(PackedHeader),
+			size - sizeof(PackedHeader));
+		if (packedSize) {
+			PackedHeader &packedHeader = *reinterpret_cast<PackedHeader*>(data);
+			packedHeader.method = LZF;
+			packedHeader.size = size;
+			header.size = sizeof(PackedHeader) + packedSize;
+			Item *packedItem = new Item();
+			packedItem->attachData(ItemMemory::shrink(data, sizeof(PackedHeader) + size, header.size), header);
+			return packedItem;
+		}
+		ItemMemory::free(data);
+	}
+	uint8_t *data = static_cast<uint8_t*>(ItemMemory::alloc(sizeof(EMethod) + size));
+	if (!data) {
+		log::Fatal::L("Can't allocate data for packed item\n");
+		throw std::bad_alloc();
+	}
+	*data = NONE;
+	if (size)
+		memcpy(data + sizeof(EMethod), item.data(), size);
+	header.size = sizeof(EMethod) + size;
+	Item *packedItem = new Item();
+	packedItem->attachData(data, header);
+	return packedItem;
+}
+
+bool Compression::unpackedSize(const void *data, const ItemHeader::TSize size, ItemHeader::TSize &unpackedSize)
+{
+	if (size < sizeof(EMethod))
+		return false;
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+	switch (*p)
+	{
+		case NONE:
+			unpackedSize = size - sizeof(EMethod);
+			return true;
+		case LZF:
+			if (size < sizeof(PackedHeader))
+				return false;
+			unpackedSize = reinterpret_cast<const PackedHeader*>(p)->size;
+			return true;
+	};
+	return false;
+}
+
+bool Compression::unpack(const void *data, const ItemHeader::TSize size, void *to,
+	const ItemHeader::TSize unpackedSize)
+{
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+	if (*p == NONE) {
+		memcpy(to, p + sizeof(EMethod), unpackedSize);
+		return true;
+	}
+	return lzfDecompress(p + sizeof(PackedHeader), size - sizeof(PackedHeader), static_cast<uint8_t*>(to),
+		unpackedSize) == unpackedSize;
+}
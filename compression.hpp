@@ -0,0 +1,55 @@
+#pragma once
+#ifndef __FL_NOMOS_COMPRESSION_HPP
+#define	__FL_NOMOS_COMPRESSION_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Item's data compression classes
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include "item.hpp"
+
+namespace fl {
+	namespace nomos {
+
+		// Items of compressed levels are kept in a frame: one method byte followed by the raw data (NONE) or
+		// by the unpacked size and LZF stream (LZF)
+		class Compression
+		{
+		public:
+			enum EMethod : uint8_t
+			{
+				NONE = 0,
+				LZF,
+			};
+			struct PackedHeader
+			{
+				EMethod method;
+				ItemHeader::TSize size;
+			} __attribute__((packed));
+
+			static Item *pack(Item &item, const ItemHeader::TSize threshold);
+			static bool unpackedSize(const void *data, const ItemHeader::TSize size, ItemHeader::TSize &unpackedSize);
+			static bool unpack(const void *data, const ItemHeader::TSize size, void *to,
+				const ItemHeader::TSize unpackedSize);
+
+			static uint32_t lzfCompress(const uint8_t *in, const uint32_t inLen, uint8_t *out, const uint32_t outLen);
+			static uint32_t lzfDecompress(const uint8_t *in, const uint32_t inLen, uint8_t *out, const uint32_t outLen);
+		private:
+			static const uint32_t HASH_LOG = 12;
+			static const uint32_t HASH_SIZE = (1 << HASH_LOG);
+			static const uint32_t MAX_LITERAL = 32;
+			static const uint32_t MAX_OFFSET = 8192;
+			static const uint32_t MAX_REFERENCE = 264;
+			static const ItemHeader::TSize MIN_PACK_SIZE = 16;
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_COMPRESSION_HPP
@@ -22,8 +22,9 @@ using namespace boost::property_tree::ini_parser;
 Config::Config(int argc, char *argv[])
 	: _uid(0), _gid(0), _status(0), _logLevel(FL_LOG_LEVEL), _port(0), _cmdTimeout(0), _workerQueueLength(0), _workers(0),
 	_bufferSize(0), _maxFreeBuffers(0),
-	_defaultSublevelKeyType(KEY_INT32), _defaultItemKeyType(KEY_INT64),
-	_syncThreadsCount(1), _serverID(0), _replicationLogKeepTime(0), _replicationPort(0)
+	_defaultSublevelKeyType(KEY_INT32), _defaultItemKeyType(KEY_INT64), _defaultLevelFlags(0), 
+	_compressionThreshold(DEFAULT_COMPRESSION_THRESHOLD), _coldItemTime(0), _levelShards(1), _fsyncPeriod(DEFAULT_FSYNC_PERIOD), _checkpointPeriod(DEFAULT_CHECKPOINT_PERIOD), _numaPolicy(Numa::OFF), _hugePages(ItemMemory::OFF), 
+	_syncThreadsCount(1), _ioBackend(IoRing::BLOCKING), _serverID(0), _replicationLogKeepTime(0), _replicationPort(0)
 {
 	std::string configFileName(DEFAULT_CONFIG);
 	char ch;
@@ -50,12 +51,12 @@ Config::Config(int argc, char *argv[])
 		}
 		_parseUserGroupParams(pt);
 		_parseNetworkParams(pt);
+		_workers = pt.get<decltype(_workers)>("nomos-server.workers", DEFAULT_WORKERS_COUNT); // levelShards can depend on it
 		_parseIndexParams(pt);
 		_parseReplicationParams(pt);
 		_cmdTimeout =  pt.get<decltype(_cmdTimeout)>("nomos-server.cmdTimeout", DEFAULT_SOCKET_TIMEOUT);
 		_workerQueueLength = pt.get<decltype(_workerQueueLength)>("nomos-server.socketQueueLength", 
 			DEFAULT_SOCKET_QUEUE_LENGTH);
-		_workers = pt.get<decltype(_workers)>("nomos-server.workers", DEFAULT_WORKERS_COUNT);
 		
 		_bufferSize = pt.get<decltype(_bufferSize)>("nomos-server.bufferSize", DEFAULT_BUFFER_SIZE);
 		_maxFreeBuffers = pt.get<decltype(_maxFreeBuffers)>("nomos-server.maxFreeBuffers", DEFAULT_MAX_FREE_BUFFERS);
@@ -122,7 +123,69 @@ void Config::_parseIndexParams(boost::property_tree::ptree &pt)
 		_defaultSublevelKeyType = Index::stringToType(pt.get<std::string>("nomos-server.defaultSublevelKeyType", "INT32"));
 		_defaultItemKeyType = Index::stringToType(pt.get<std::string>("nomos-server.defaultItemKeyType", "INT64"));
 		
+		auto levelOptions = pt.get<std::string>("nomos-server.defaultLevelOptions", "");
+		const char *pbegin = levelOptions.c_str();
+		const char *pend = levelOptions.c_str() + levelOptions.size();
+		while (pbegin < pend) {
+			const char *p = strchr(pbegin, ',');
+			if (p == NULL)
+				p = pend;
+			if (p > pbegin)
+				_defaultLevelFlags |= Index::stringToFlag(std::string(pbegin, p - pbegin));
+			pbegin = p + 1;
+		}
+		_compressionThreshold = pt.get<decltype(_compressionThreshold)>("nomos-server.compressionThreshold", 
+			DEFAULT_COMPRESSION_THRESHOLD);
+		
+		auto coldItemTimeStr = pt.get<std::string>("nomos-server.coldItemTime", "0");
+		char *last;
+		_coldItemTime = strtoul(coldItemTimeStr.c_str(), &last, 10);
+		if (tolower(*last) == 'h')
+			_coldItemTime *= 3600;
+		else if (tolower(*last) == 'd')
+			_coldItemTime *= 3600 * 24;
+		if (pt.get<std::string>("nomos-server.promoteColdItems", "on") == "on")
+			_status |= ST_PROMOTE_COLD_ITEMS;
+		_levelShards = pt.get<decltype(_levelShards)>("nomos-server.levelShards", 1);
+		if (!_levelShards) // as many shards as workers, any of them locks any shard
+			_levelShards = _workers;
+		_fsyncPeriod = pt.get<decltype(_fsyncPeriod)>("nomos-server.fsyncPeriod", DEFAULT_FSYNC_PERIOD);
+		auto numaPolicy = pt.get<std::string>("nomos-server.numaPolicy", "off");
+		if (!Numa::stringToPolicy(numaPolicy, _numaPolicy)) {
+			printf("Unknown nomos-server.numaPolicy %s\n", numaPolicy.c_str());
+			throw std::exception();
+		}
+		auto hugePages = pt.get<std::string>("nomos-server.hugePages", "off");
+		if (!ItemMemory::stringToMode(hugePages, _hugePages)) {
+			printf("Unknown nomos-server.hugePages %s\n", hugePages.c_str());
+			throw std::exception();
+		}
+		
 		_syncThreadsCount = pt.get<decltype(_syncThreadsCount)>("nomos-server.syncThreadsCount", 1);
+		auto ioBackend = pt.get<std::string>("nomos-server.ioBackend", "blocking");
+		if (!IoRing::stringToBackend(ioBackend, _ioBackend)) {
+			printf("Unknown nomos-server.ioBackend %s\n", ioBackend.c_str());
+			throw std::exception();
+		}
+		auto storageMode = pt.get<std::string>("nomos-server.storageMode", "files");
+		if (storageMode == "unified")
+			_status |= ST_UNIFIED_LOG;
+		else if (storageMode != "files") {
+			printf("Unknown nomos-server.storageMode %s\n", storageMode.c_str());
+			throw std::exception();
+		}
+		auto packMode = pt.get<std::string>("nomos-server.packMode", "merge");
+		if (packMode == "checkpoint")
+			_status |= ST_CHECKPOINT_PACK;
+		else if (packMode != "merge") {
+			printf("Unknown nomos-server.packMode %s\n", packMode.c_str());
+			throw std::exception();
+		}
+		_checkpointPeriod = pt.get<decltype(_checkpointPeriod)>("nomos-server.checkpointPeriod", DEFAULT_CHECKPOINT_PERIOD);
+		if (!_checkpointPeriod) {
+			printf("nomos-server.checkpointPeriod can't be zero\n");
+			throw std::exception();
+		}
 	}
 	catch (Index::ConvertError &e)
 	{
@@ -136,8 +199,13 @@ void Config::_parseReplicationParams(boost::property_tree::ptree &pt)
 	auto replicationLogKeepTimeStr = pt.get<std::string>("nomos-server.replicationLogKeepTime", "0");
 	char *last;
 	u_int32_t replicationLogKeepTime = strtoul(replicationLogKeepTimeStr.c_str(), &last, 10);
-	if (!replicationLogKeepTime) // turn replication off
+	if (!replicationLogKeepTime) { // turn replication off
+		if (isUnifiedLog()) {
+			printf("nomos-server.storageMode=unified requires nomos-server.replicationLogKeepTime\n");
+			throw std::exception();
+		}
 		return;
+	}
 	if (tolower(*last) == 'h')
 		_replicationLogKeepTime = replicationLogKeepTime * 3600;
 	else 
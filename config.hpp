@@ -17,6 +17,9 @@
 #include <vector>
 #include "socket.hpp"
 #include "types.hpp"
+#include "numa.hpp"
+#include "item_memory.hpp"
+#include "io_ring.hpp"
 
 namespace fl {
 	namespace nomos {
@@ -31,17 +34,30 @@ namespace fl {
 		
 		const double MIN_SYNC_TOUCH_TIME_PERCENT = 0.1; // 10 percent
 		const int MIN_SYNC_PUT_UPDATE_TIME = 5 * 60; // 5 minutes
+		const uint32_t SUBLEVEL_TOMBSTONE_KEEP_TIME = 24 * 3600; // to drop late replicated items of removed sublevels
 		const int DEFAULT_SOCKET_TIMEOUT = 60;
 		const uint32_t DEFAULT_CMD_PORT = 7007;
 		const size_t DEFAULT_SOCKET_QUEUE_LENGTH = 10000;
 		const size_t EPOLL_WORKER_STACK_SIZE = 100000;
 		const size_t DEFAULT_WORKERS_COUNT = 2;
+		const size_t CACHE_LINE_SIZE = 64;
 		
 		const size_t DEFAULT_BUFFER_SIZE = 32000;
 		const size_t DEFAULT_MAX_FREE_BUFFERS = 500;
 		
 		const uint32_t MAX_REPLICATION_FILE_SIZE = 1000000000; // 1GB
 		
+		const uint32_t DEFAULT_COMPRESSION_THRESHOLD = 256;
+		const uint32_t DEFAULT_FSYNC_PERIOD = 1000; // milliseconds
+		const uint32_t DEFAULT_CHECKPOINT_PERIOD = 24; // hours
+		const size_t MAX_RANGE_LIMIT = 1000; // the maximum number of items in a range answer
+		
+		const uint32_t MAINTENANCE_SPREAD_TIME = 50 * 60; // levels are packed evenly during this time after every hour
+		const double MAINTENANCE_LOAD_FACTOR = 1.5; // maintenance waits while the load is higher than average
+		const double MAINTENANCE_LOAD_WEIGHT = 0.05; // weight of the last tick in the average load
+		const size_t MAINTENANCE_TICK_BYTES = 32 * 1024 * 1024; // of files packed by a tick, is scaled by the backlog
+		const size_t MAINTENANCE_TICK_ITEMS = 256 * 1024; // checked for the eviction by a tick
+		
 		class Config
 		{
 		public:
@@ -57,6 +73,9 @@ namespace fl {
 			typedef uint32_t TStatus;
 			static const TStatus ST_LOG_STDOUT = 0x1;
 			static const TStatus ST_AUTO_CREATE_TOP_LEVEL = 0x2;
+			static const TStatus ST_PROMOTE_COLD_ITEMS = 0x4;
+			static const TStatus ST_UNIFIED_LOG = 0x8;
+			static const TStatus ST_CHECKPOINT_PACK = 0x10;
 			const bool isLogStdout() const
 			{
 				return _status & ST_LOG_STDOUT;
@@ -102,10 +121,61 @@ namespace fl {
 			{
 				return _defaultItemKeyType;
 			}
+			TLevelFlags defaultLevelFlags() const
+			{
+				return _defaultLevelFlags;
+			}
+			uint32_t compressionThreshold() const
+			{
+				return _compressionThreshold;
+			}
+			uint32_t coldItemTime() const
+			{
+				return _coldItemTime;
+			}
+			size_t levelShards() const
+			{
+				return _levelShards;
+			}
+			uint32_t fsyncPeriod() const
+			{
+				return _fsyncPeriod;
+			}
+			Numa::EPolicy numaPolicy() const
+			{
+				return _numaPolicy;
+			}
+			ItemMemory::EHugePages hugePages() const
+			{
+				return _hugePages;
+			}
+			bool isPromoteColdItems() const
+			{
+				return _status & ST_PROMOTE_COLD_ITEMS;
+			}
+			// levels keep only checkpoints, all changes are written once to the replication log
+			bool isUnifiedLog() const
+			{
+				return _status & ST_UNIFIED_LOG;
+			}
+			// levels are packed by writing snapshots of their live items, old files are removed after them
+			bool isCheckpointPack() const
+			{
+				return _status & ST_CHECKPOINT_PACK;
+			}
+			// hours between full rewrites of levels' files, hourly checkpoints write only the changes in the meantime
+			uint32_t checkpointPeriod() const
+			{
+				return _checkpointPeriod;
+			}
 			uint32_t syncThreadsCount() const
 			{
 				return _syncThreadsCount;
 			}
+			IoRing::EBackend ioBackend() const
+			{
+				return _ioBackend;
+			}
 			TServerID serverID() const
 			{
 				return _serverID;
@@ -156,8 +226,17 @@ namespace fl {
 			
 			EKeyType _defaultSublevelKeyType;
 			EKeyType _defaultItemKeyType;
+			TLevelFlags _defaultLevelFlags;
+			uint32_t _compressionThreshold;
+			uint32_t _coldItemTime;
+			size_t _levelShards;
+			uint32_t _fsyncPeriod;
+			uint32_t _checkpointPeriod;
+			Numa::EPolicy _numaPolicy;
+			ItemMemory::EHugePages _hugePages;
 			
 			uint32_t _syncThreadsCount;
+			IoRing::EBackend _ioBackend;
 			TServerID _serverID;
 			std::string _replicationLogPath;
 			uint32_t _replicationLogKeepTime;
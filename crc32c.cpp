@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: CRC32C (Castagnoli) checksums of records
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+
+#include "crc32c.hpp"
+
+using namespace fl::nomos;
+
+uint32_t CRC32C::_table[256];
+bool CRC32C::_tableFilled = CRC32C::_fillTable();
+CRC32C::TExtendFunc CRC32C::_extend = CRC32C::_select();
+
+bool CRC32C::_fillTable()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? ((crc >> 1) ^ POLYNOMIAL) : (crc >> 1);
+		_table[i] = crc;
+	}
+	return true;
+}
+
+CRC32C::TExtendFunc CRC32C::_select()
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		return _extendSSE42;
+#endif
+	return _extendTable;
+}
+
+uint32_t CRC32C::_extendTable(uint32_t crc, const uint8_t *data, size_t size)
+{
+	while (size--)
+		crc = _table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t CRC32C::_extendSSE42(uint32_t crc, const uint8_t *data, size_t size)
+{
+	for (; size && (reinterpret_cast<uintptr_t>(data) & 7); size--)
+		crc = __builtin_ia32_crc32qi(crc, *data++);
+	uint64_t crc64 = crc;
+	for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		crc64 = __builtin_ia32_crc32di(crc64, value);
+		data += sizeof(value);
+	}
+	crc = crc64;
+	while (size--)
+		crc = __builtin_ia32_crc32qi(crc, *data++);
+	return crc;
+}
+#else
+uint32_t CRC32C::_extendSSE42(uint32_t crc, const uint8_t *data, size_t size)
+{
+	return _extendTable(crc, data, size);
+}
+#endif
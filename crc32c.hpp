@@ -0,0 +1,48 @@
+#pragma once
+#ifndef __FL_NOMOS_CRC32C_HPP
+#define	__FL_NOMOS_CRC32C_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: CRC32C (Castagnoli) checksums of records
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstddef>
+
+namespace fl {
+	namespace nomos {
+
+		// SSE4.2 crc32 instructions are used if the CPU has them, otherwise a table is used
+		class CRC32C
+		{
+		public:
+			static uint32_t calc(const void *data, const size_t size)
+			{
+				return extend(0, data, size);
+			}
+			// continues a checksum of the previous parts, data can be split in any way
+			static uint32_t extend(const uint32_t crc, const void *data, const size_t size)
+			{
+				return ~_extend(~crc, static_cast<const uint8_t*>(data), size);
+			}
+		private:
+			typedef uint32_t (*TExtendFunc)(uint32_t crc, const uint8_t *data, size_t size);
+			static TExtendFunc _extend;
+			static TExtendFunc _select();
+			static uint32_t _extendTable(uint32_t crc, const uint8_t *data, size_t size);
+			static uint32_t _extendSSE42(uint32_t crc, const uint8_t *data, size_t size);
+			static const uint32_t POLYNOMIAL = 0x82F63B78; // reversed
+			static uint32_t _table[256];
+			static bool _fillTable();
+			static bool _tableFilled;
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_CRC32C_HPP
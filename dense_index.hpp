@@ -0,0 +1,258 @@
+#pragma once
+#ifndef __FL_NOMOS_DENSE_INDEX_HPP
+#define	__FL_NOMOS_DENSE_INDEX_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Direct-addressed index for dense integer keys
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <bitset>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace fl {
+	namespace nomos {
+
+		// Keeps values in pages of PAGE_SIZE slots addressed by the key itself. Pages are found by a two-level radix 
+		// directory: tables of TABLE_SIZE pages are allocated on demand, as the pages are, and both are freed when 
+		// they become empty, so a few big keys cost a table and a page each. It has the subset of the unordered_map 
+		// interface used by the level index; iteration goes in keys order
+		template <typename TKey, typename TValue>
+		class DenseIndex
+		{
+		public:
+			static_assert(sizeof(TKey) <= sizeof(uint32_t), "The directory addresses 32 bits keys");
+			typedef std::pair<TKey, TValue> value_type;
+			static const uint32_t PAGE_BITS = 8;
+			static const uint32_t PAGE_SIZE = (1 << PAGE_BITS);
+			static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+			static const uint32_t TABLE_BITS = 12;
+			static const uint32_t TABLE_SIZE = (1 << TABLE_BITS);
+			static const uint32_t TABLE_MASK = TABLE_SIZE - 1;
+
+			class iterator
+			{
+			public:
+				iterator()
+					: _index(NULL), _pos(END_POS)
+				{
+				}
+				iterator(DenseIndex *index, const uint64_t pos)
+					: _index(index), _pos(pos)
+				{
+				}
+				value_type &operator*() const
+				{
+					return _index->_page(_pos)->items[_pos & PAGE_MASK];
+				}
+				value_type *operator->() const
+				{
+					return &(**this);
+				}
+				iterator &operator++()
+				{
+					_pos = _index->_next(_pos + 1);
+					return *this;
+				}
+				iterator operator++(int)
+				{
+					iterator prev(*this);
+					++(*this);
+					return prev;
+				}
+				bool operator==(const iterator &it) const
+				{
+					return _pos == it._pos;
+				}
+				bool operator!=(const iterator &it) const
+				{
+					return _pos != it._pos;
+				}
+			private:
+				friend class DenseIndex;
+				DenseIndex *_index;
+				uint64_t _pos;
+			};
+
+			DenseIndex()
+				: _size(0)
+			{
+			}
+			DenseIndex(const DenseIndex &index)
+				: _size(0)
+			{
+				*this = index;
+			}
+			DenseIndex(DenseIndex &&index)
+				: _tables(std::move(index._tables)), _size(index._size)
+			{
+				index._size = 0;
+			}
+			DenseIndex &operator=(const DenseIndex &index)
+			{
+				if (this == &index)
+					return *this;
+				_tables.clear();
+				_tables.resize(index._tables.size());
+				for (size_t i = 0; i < index._tables.size(); i++) {
+					const Table *table = index._tables[i].get();
+					if (!table)
+						continue;
+					_tables[i].reset(new Table());
+					for (uint32_t pageID = 0; pageID < TABLE_SIZE; pageID++) {
+						if (table->pages[pageID])
+							_tables[i]->pages[pageID].reset(new Page(*table->pages[pageID]));
+					}
+					_tables[i]->pagesCount = table->pagesCount;
+				}
+				_size = index._size;
+				return *this;
+			}
+			DenseIndex &operator=(DenseIndex &&index)
+			{
+				_tables = std::move(index._tables);
+				_size = index._size;
+				index._size = 0;
+				return *this;
+			}
+
+			iterator begin()
+			{
+				return iterator(this, _next(0));
+			}
+			iterator end()
+			{
+				return iterator(this, END_POS);
+			}
+			size_t size() const
+			{
+				return _size;
+			}
+			bool empty() const
+			{
+				return !_size;
+			}
+			iterator find(const TKey key)
+			{
+				const uint64_t pos = key;
+				const uint64_t tableID = pos >> (PAGE_BITS + TABLE_BITS);
+				if ((tableID >= _tables.size()) || !_tables[tableID])
+					return end();
+				const Page *page = _page(pos);
+				if (!page || !page->used[pos & PAGE_MASK])
+					return end();
+				return iterator(this, pos);
+			}
+			std::pair<iterator, bool> emplace(const TKey key, const TValue &value)
+			{
+				const uint64_t pos = key;
+				const uint64_t tableID = pos >> (PAGE_BITS + TABLE_BITS);
+				if (tableID >= _tables.size())
+					_tables.resize(tableID + 1);
+				if (!_tables[tableID])
+					_tables[tableID].reset(new Table());
+				Table &table = *_tables[tableID];
+				TPagePtr &pagePtr = table.pages[(pos >> PAGE_BITS) & TABLE_MASK];
+				if (!pagePtr) {
+					pagePtr.reset(new Page());
+					table.pagesCount++;
+				}
+				Page &page = *pagePtr;
+				const uint32_t slot = pos & PAGE_MASK;
+				if (page.used[slot])
+					return std::pair<iterator, bool>(iterator(this, pos), false);
+				page.used.set(slot);
+				page.items[slot].first = key;
+				page.items[slot].second = value;
+				_size++;
+				return std::pair<iterator, bool>(iterator(this, pos), true);
+			}
+			iterator erase(iterator it)
+			{
+				const uint64_t tableID = it._pos >> (PAGE_BITS + TABLE_BITS);
+				Table &table = *_tables[tableID];
+				TPagePtr &pagePtr = table.pages[(it._pos >> PAGE_BITS) & TABLE_MASK];
+				Page &page = *pagePtr;
+				const uint32_t slot = it._pos & PAGE_MASK;
+				page.items[slot].second = TValue();
+				page.used.reset(slot);
+				_size--;
+				if (page.used.none()) {
+					pagePtr.reset();
+					if (!--table.pagesCount) {
+						_tables[tableID].reset();
+						while (!_tables.empty() && !_tables.back())
+							_tables.pop_back();
+					}
+				}
+				return iterator(this, _next(it._pos + 1));
+			}
+			size_t erase(const TKey key)
+			{
+				iterator it = find(key);
+				if (it == end())
+					return 0;
+				erase(it);
+				return 1;
+			}
+		private:
+			static const uint64_t END_POS = UINT64_MAX;
+			struct Page
+			{
+				value_type items[PAGE_SIZE];
+				std::bitset<PAGE_SIZE> used;
+			};
+			typedef std::unique_ptr<Page> TPagePtr;
+			struct Table
+			{
+				Table()
+					: pagesCount(0)
+				{
+				}
+				TPagePtr pages[TABLE_SIZE];
+				uint32_t pagesCount;
+			};
+			typedef std::unique_ptr<Table> TTablePtr;
+			typedef std::vector<TTablePtr> TTableVector;
+			
+			// the table of the position has to exist
+			Page *_page(const uint64_t pos) const
+			{
+				return _tables[pos >> (PAGE_BITS + TABLE_BITS)]->pages[(pos >> PAGE_BITS) & TABLE_MASK].get();
+			}
+
+			uint64_t _next(uint64_t pos) const
+			{
+				const uint64_t startPageID = pos >> PAGE_BITS;
+				for (uint64_t pageID = startPageID; (pageID >> TABLE_BITS) < _tables.size(); pageID++) {
+					const Table *table = _tables[pageID >> TABLE_BITS].get();
+					if (!table) { // skip to the next table
+						pageID |= TABLE_MASK;
+						continue;
+					}
+					const Page *page = table->pages[pageID & TABLE_MASK].get();
+					if (page) {
+						for (uint32_t slot = (pageID == startPageID) ? (pos & PAGE_MASK) : 0; slot < PAGE_SIZE; slot++) {
+							if (page->used[slot])
+								return (pageID << PAGE_BITS) | slot;
+						}
+					}
+				}
+				return END_POS;
+			}
+
+			TTableVector _tables;
+			size_t _size;
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_DENSE_INDEX_HPP
@@ -8,6 +8,14 @@
 // Description: Index maintenance classes
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <map>
+#include <set>
+#include <limits>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "index.hpp"
 #include "dir.hpp"
 #include "nomos_log.hpp"
@@ -15,6 +23,12 @@
 #include "util.hpp"
 #include "index_sync_thread.hpp"
 #include "index_replication_thread.hpp"
+#include "compression.hpp"
+#include "dense_index.hpp"
+#include "bin_key.hpp"
+#include "key_parser.hpp"
+#include "item_memory.hpp"
+#include "crc32c.hpp"
 
 
 using namespace fl::nomos;
@@ -23,8 +37,119 @@ using fl::fs::File;
 using namespace fl::utils;
 
 TopLevelIndex::TopLevelIndex(const std::string &level, Index *index, const std::string &path, const MetaData &md)
-	: _level(level), _index(index), _path(path), _md(md)
+	: _level(level), _index(index), _path(path), _md(md), _dirty(0), 
+	_syncAffinity(getCheckSum32Tmpl<std::string>(level)), _needFsync(false), _lastFsyncTime(0), _syncNumber(0), 
+	_durableNumber(0), _failedNumber(0), _checkpointNumber(0), _baseTime(time(NULL)), _lastLocationFile(0)
+{
+}
+
+const bool TopLevelIndex::_isTrackingLocations() const
+{
+	return _index->coldTime() && !isMemoryOnly();
+}
+
+TopLevelIndex::TFileNumber TopLevelIndex::_addLocationFile(const TFilePtr &file)
+{
+	struct stat fileStat;
+	if (fstat(file->descr(), &fileStat)) {
+		log::Error::L("Can't stat data file of level %s\n", _level.c_str());
+		return 0;
+	}
+	AutoMutex autoSync(&_locationSync);
+	if (!++_lastLocationFile) // 0 is never used
+		_lastLocationFile++;
+	LocationFile &locationFile = _locationFiles[_lastLocationFile];
+	locationFile.file = file;
+	locationFile.inode = fileStat.st_ino;
+	return _lastLocationFile;
+}
+
+TopLevelIndex::TFileNumber TopLevelIndex::_addLocationFile(const char *path, TFilePtr &file)
+{
+	file.reset(new File());
+	if (!file->open(path, O_RDONLY)) {
+		log::Error::L("Can't open data file %s for reading\n", path);
+		file.reset();
+		return 0;
+	}
+	return _addLocationFile(file);
+}
+
+void TopLevelIndex::_forgetLocationFile(const char *path)
+{
+	struct stat fileStat;
+	if (stat(path, &fileStat))
+		return;
+	AutoMutex autoSync(&_locationSync);
+	for (auto locationFile = _locationFiles.begin(); locationFile != _locationFiles.end(); locationFile++) {
+		if (locationFile->second.inode == fileStat.st_ino) {
+			_locationFiles.erase(locationFile);
+			return;
+		}
+	}
+}
+
+void TopLevelIndex::_getLocationFiles(TLocationFileMap &files)
+{
+	AutoMutex autoSync(&_locationSync);
+	files = _locationFiles;
+}
+
+bool TopLevelIndex::waitDurable(const TSyncNumber syncNumber)
+{
+	std::unique_lock<std::mutex> lock(_durableSync);
+	while (_durableNumber < syncNumber)
+		_durableCond.wait(lock);
+	return syncNumber > _failedNumber;
+}
+
+bool TopLevelIndex::parkDurable(const TSyncNumber syncNumber, const DurableWait &wait, bool &written)
+{
+	std::lock_guard<std::mutex> lock(_durableSync);
+	if (_durableNumber >= syncNumber) {
+		written = syncNumber > _failedNumber;
+		return false;
+	}
+	const ParkedWait parkedWait = {syncNumber, wait};
+	_parkedWaits.push_back(parkedWait);
+	return true;
+}
+
+void TopLevelIndex::_setDurable(const TSyncNumber syncNumber, const bool written)
 {
+	TParkedWaitVector woken;
+	{
+		std::lock_guard<std::mutex> lock(_durableSync);
+		_durableNumber = syncNumber;
+		if (!written)
+			_failedNumber = syncNumber;
+		_durableCond.notify_all();
+		for (auto parkedWait = _parkedWaits.begin(); parkedWait != _parkedWaits.end(); ) {
+			if (parkedWait->syncNumber <= syncNumber) {
+				woken.push_back(*parkedWait);
+				parkedWait = _parkedWaits.erase(parkedWait);
+			} else
+				parkedWait++;
+		}
+	}
+	for (auto parkedWait = woken.begin(); parkedWait != woken.end(); parkedWait++) // a failed sync fails all of them
+		parkedWait->wait.waiter->durable(parkedWait->wait.waitID, written);
+}
+
+bool TopLevelIndex::_fsync(File &file)
+{
+	if (file.descr() && fdatasync(file.descr())) {
+		log::Error::L("Can't fdatasync %s (%d)\n", _path.c_str(), errno);
+		return false;
+	}
+	return true;
+}
+
+uint64_t TopLevelIndex::_monotonicTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
 }
 
 void TopLevelIndex::_formMetaFileName(const std::string &path, BString &metaFileName)
@@ -32,11 +157,83 @@ void TopLevelIndex::_formMetaFileName(const std::string &path, BString &metaFile
 	metaFileName.sprintfSet("%s/.meta", path.c_str());
 }
 
+size_t TopLevelIndex::_metaDataSize(const TVersion version)
+{
+	if (version < FLAGS_VERSION)
+		return sizeof(MetaData) - sizeof(TFlags);
+	else
+		return sizeof(MetaData);
+}
+
+bool TopLevelIndex::_readMetaData(File &fd, MetaData &md)
+{
+	bzero(&md, sizeof(md));
+	if (fd.read(&md.version, sizeof(md.version)) != sizeof(md.version))
+		return false;
+	ssize_t leftSize = _metaDataSize(md.version) - sizeof(md.version);
+	return (fd.read(reinterpret_cast<uint8_t*>(&md) + sizeof(md.version), leftSize) == leftSize);
+}
+
+void TopLevelIndex::_getMetaData(Buffer &buf, MetaData &md)
+{
+	bzero(&md, sizeof(md));
+	buf.get(md.version);
+	buf.get(reinterpret_cast<uint8_t*>(&md) + sizeof(md.version), _metaDataSize(md.version) - sizeof(md.version));
+}
+
+bool TopLevelIndex::_readBaseTime(File &fd, const TVersion version, ItemHeader::TTime &baseTime)
+{
+	baseTime = 0;
+	if (version < RECORDS_VERSION)
+		return true;
+	return fd.read(&baseTime, sizeof(baseTime)) == sizeof(baseTime);
+}
+
+ItemHeader::TTime TopLevelIndex::_getBaseTime(Buffer &buf, const TVersion version)
+{
+	ItemHeader::TTime baseTime = 0;
+	if (version >= RECORDS_VERSION)
+		buf.get(baseTime);
+	return baseTime;
+}
+
+// LEB128: 7 bits in every byte, the high bit is set if more bytes follow
+void TopLevelIndex::_addVarInt(Buffer &buf, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t size = 0;
+	while (value >= 0x80) {
+		bytes[size++] = static_cast<uint8_t>(value) | 0x80;
+		value >>= 7;
+	}
+	bytes[size++] = static_cast<uint8_t>(value);
+	buf.add(bytes, size);
+}
+
+uint64_t TopLevelIndex::_getVarInt(Buffer &buf)
+{
+	uint64_t value = 0;
+	for (uint32_t shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
+		buf.get(byte);
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	log::Error::L("Varint is too long\n");
+	throw std::exception();
+}
+
+void TopLevelIndex::_packItem(TItemSharedPtr &item)
+{
+	item.reset(Compression::pack(*item, _index->compressionThreshold()));
+}
+
 const std::string TopLevelIndex::DATA_FILE_NAME("data");
 
 
 bool TopLevelIndex::_createDataFile(const std::string &path, const u_int32_t curTime, const u_int32_t openNumber, 
-	const MetaData &md, File &file, BString &fileName, const char *prefix)
+	const MetaData &md, const ItemHeader::TTime baseTime, File &file, BString &fileName, const char *prefix)
 {
 	fileName.sprintfSet("%s/%s%s_%u_%u", path.c_str(), prefix ? prefix : "", DATA_FILE_NAME.c_str(), curTime, openNumber);
 	if (fileExists(fileName.c_str())) {
@@ -45,16 +242,53 @@ bool TopLevelIndex::_createDataFile(const std::string &path, const u_int32_t cur
 	}
 	if (!file.open(fileName.c_str(), O_CREAT | O_WRONLY))
 		return false;
-	if (file.write(&md, sizeof(md)) == sizeof(md))
+	if ((file.write(&md, sizeof(md)) == sizeof(md)) && (file.write(&baseTime, sizeof(baseTime)) == sizeof(baseTime)))
 		return true;
 	else
 		return false;
 }
 
 const std::string TopLevelIndex::HEADER_FILE_NAME("header");
+const std::string TopLevelIndex::CHECKPOINT_FILE_NAME(".checkpoint");
+
+bool TopLevelIndex::_readCheckpoint()
+{
+	BString fileName;
+	fileName.sprintfSet("%s/%s", _path.c_str(), CHECKPOINT_FILE_NAME.c_str());
+	_checkpointNumber = 0;
+	if (!fileExists(fileName.c_str())) // the level has not been checkpointed yet, all logs are replayed
+		return true;
+	File fd;
+	if (!fd.open(fileName.c_str(), O_RDONLY) || 
+		(fd.read(&_checkpointNumber, sizeof(_checkpointNumber)) != sizeof(_checkpointNumber))) {
+		log::Error::L("Cannot read checkpoint file %s\n", fileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+void TopLevelIndex::_saveCheckpoint(const TReplicationLogNumber checkpointNumber)
+{
+	BString fileName;
+	fileName.sprintfSet("%s/%s", _path.c_str(), CHECKPOINT_FILE_NAME.c_str());
+	BString tempFileName;
+	tempFileName.sprintfSet("%s_tmp", fileName.c_str());
+	File fd;
+	if (!fd.open(tempFileName.c_str(), O_CREAT | O_WRONLY | O_TRUNC) || 
+		(fd.write(&checkpointNumber, sizeof(checkpointNumber)) != sizeof(checkpointNumber)) || !_fsync(fd)) {
+		log::Fatal::L("Cannot write checkpoint file %s\n", tempFileName.c_str());
+		throw std::exception();
+	}
+	fd.close();
+	if (rename(tempFileName.c_str(), fileName.c_str())) {
+		log::Fatal::L("Can't rename checkpoint file from %s to %s\n", tempFileName.c_str(), fileName.c_str());
+		throw std::exception();
+	}
+	_checkpointNumber = checkpointNumber;
+}
 
 bool TopLevelIndex::_createHeaderFile(const std::string &path, const u_int32_t curTime, const u_int32_t openNumber, 
-	const MetaData &md, File &file)
+	const MetaData &md, const ItemHeader::TTime baseTime, File &file)
 {
 	BString fileName;
 	fileName.sprintfSet("%s/%s_%u_%u", path.c_str(), HEADER_FILE_NAME.c_str(), curTime, openNumber);
@@ -64,7 +298,7 @@ bool TopLevelIndex::_createHeaderFile(const std::string &path, const u_int32_t c
 	}
 	if (!file.open(fileName.c_str(), O_CREAT | O_WRONLY))
 		return false;
-	if (file.write(&md, sizeof(md)) == sizeof(md))
+	if ((file.write(&md, sizeof(md)) == sizeof(md)) && (file.write(&baseTime, sizeof(baseTime)) == sizeof(baseTime)))
 		return true;
 	else
 		return false;
@@ -93,6 +327,7 @@ bool TopLevelIndex::_unlink(const TPathVector &fileList)
 {
 	bool res = true;
 	for (auto file = fileList.begin(); file != fileList.end(); file++) {
+		_forgetLocationFile(file->c_str());
 		if (unlink(file->c_str()))
 			res = false;
 	}
@@ -123,84 +358,118 @@ bool TopLevelIndex::_loadFileList(const std::string &path, TPathVector &headersF
 	}
 }
 
-void TopLevelIndex::_syncToFile(const Buffer::TDataPtr data, const Buffer::TSize needToWrite, 
-	File &packedFile, TPathVector &createdFiles, const u_int32_t curTime)
+off_t TopLevelIndex::_syncToFile(const Buffer::TDataPtr data, const Buffer::TSize needToWrite, PackedFile &packedFile, 
+	const u_int32_t curTime)
 {
-	if (packedFile.descr())
+	File &file = packedFile.file;
+	if (file.descr())
 	{
-		if ((packedFile.fileSize() + static_cast<size_t>(needToWrite)) > MAX_FILE_SIZE)
-			packedFile.close();
+		if ((file.fileSize() + static_cast<size_t>(needToWrite)) > MAX_FILE_SIZE) {
+			if ((_isFsynced() || _index->isUnifiedLog() || _index->isCheckpointPack()) && !_fsync(file))
+				throw std::exception();
+			file.close();
+		}
 	}
-	if (!packedFile.descr())
+	if (!file.descr())
 	{
 		BString fileName;
-		if (!_createDataFile(_path, curTime, createdFiles.size(), _md, packedFile, fileName, "."))
+		if (!_createDataFile(_path, curTime, packedFile.createdFiles.size(), _md, _baseTime, file, fileName, "."))
 		{
 			log::Error::L("Can't open file to sync %s\n", fileName.c_str());
 			throw std::exception();
 		}
-		createdFiles.push_back(fileName.c_str());
-	}
-	if (packedFile.write(data, needToWrite) != (ssize_t)needToWrite)
+		packedFile.createdFiles.push_back(fileName.c_str());
+		packedFile.number = 0;
+		packedFile.readFile.reset();
+		if (_isTrackingLocations())
+			packedFile.number = _addLocationFile(fileName.c_str(), packedFile.readFile);
+	}
+	const off_t offset = file.seek(0, SEEK_CUR);
+	if (file.write(data, needToWrite) != (ssize_t)needToWrite)
 	{
 		log::Error::L("Can't write to file for sync %s\n", _path.c_str());
 		throw std::exception();
 	}
+	return offset;
 }
 
-void TopLevelIndex::_syncToFile(const Buffer::TSize startSavePos, const Buffer::TSize curPos, Buffer &buf, 
-	Buffer &writeBuffer, File &packedFile, TPathVector &createdFiles, const u_int32_t curTime)
-{
-	Buffer::TSize needToWrite = curPos - startSavePos;
-	if (needToWrite == 0)
-		return;
-	if (needToWrite > (MAX_BUF_SIZE / 2)) { // write directly to file
-		_syncToFile(buf.begin() + startSavePos, needToWrite, packedFile, createdFiles, curTime);
-	} else { // simply add data to buffer
-		writeBuffer.add(buf.begin() + startSavePos, needToWrite);
-	}	
-}
 
 
+template <typename TItemIndex>
+struct ItemIndexSlices
+{
+	static const u_int16_t COUNT = 10;
+};
+
+template <typename TKey, typename TValue>
+struct ItemIndexSlices<DenseIndex<TKey, TValue>>
+{
+	static const u_int16_t COUNT = 1; // keys address the index directly, splitting them would make it sparse
+};
 
-template <typename TSubLevelKey, typename TItemKey>
+template <typename TSubLevelKey, typename TItemKey, typename TItemIndex = unordered_map<TItemKey, ItemSlot>>
 class MemmoryTopLevelIndex : public TopLevelIndex
 {
 public:
 	typedef u_int16_t TSliceCount;
-	static const TSliceCount ITEM_DEFAULT_SLICES_COUNT = 10;
+	static const TSliceCount ITEM_DEFAULT_SLICES_COUNT = ItemIndexSlices<TItemIndex>::COUNT;
+	static const ItemHeader::TTime EXPIRY_BUCKET_TIME = 8;
+	static const size_t EXPIRY_BATCH_SIZE = 1000;
 	MemmoryTopLevelIndex(const std::string &level, Index *index, const std::string &path, const MetaData &md)
-		: TopLevelIndex(level, index, path, md), _slicesCount(ITEM_DEFAULT_SLICES_COUNT)
+		: TopLevelIndex(level, index, path, md), _shardsCount(index->shardsCount()), _shards(new Shard[_shardsCount]), 
+		_slicesCount(ITEM_DEFAULT_SLICES_COUNT)
 	{
-
+		_dataFileNumber = 0;
+		_flushFailed = false;
+		_isEvicting = false;
+		_lastFullPackTime = _baseTime;
+		bzero(&_dataSpace, sizeof(_dataSpace));
+		bzero(&_headerSpace, sizeof(_headerSpace));
 	}
 
-	virtual ~MemmoryTopLevelIndex() {}
+	virtual ~MemmoryTopLevelIndex()
+	{
+		_closeFile(_dataFile, _dataSpace); // releases the preallocated space
+		_closeFile(_headerFile, _headerSpace);
+		if (_packState) { // the maintenance has not finished the pack
+			_packState->packed.file.close();
+			_unlink(_packState->packed.createdFiles);
+		}
+	}
 
-	virtual bool removeSubLevel(const std::string &subLevelKeyStr)
+	virtual bool removeSubLevel(const std::string &subLevelKeyStr, const ItemHeader::TTime curTime)
 	{
 		HeaderPacket headerPacket(_index->serverID());
-		headerPacket.cmd = EIndexCMDType::REMOVE;
-		headerPacket.subLevelKey = convertStdStringTo<TSubLevelKey>(subLevelKeyStr.c_str(), NULL, 16);
+		headerPacket.cmd = EIndexCMDType::REMOVE_SUBLEVEL;
+		headerPacket.subLevelKey = KeyParser<TSubLevelKey>::parse(subLevelKeyStr);
+		headerPacket.itemKey = TItemKey();
+		bzero(&headerPacket.itemHeader, sizeof(headerPacket.itemHeader));
+		headerPacket.itemHeader.liveTo = REMOVED_LIVE_TO;
 		
-		AutoMutex autoSync(&_sync);
-		auto subLevel = _subLevelItem.find(headerPacket.subLevelKey);
-		if (subLevel == _subLevelItem.end())
+		Shard &shard = _shard(headerPacket.subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(headerPacket.subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
 			return false;
-		THeaderPacketVector deletedItems;
-		for (auto slice = subLevel->second.begin(); slice != subLevel->second.end(); slice++) {
-			for (auto item = slice->begin(); item != slice->end(); item++) {
-				item->second->setDeleted();
-				headerPacket.itemKey = item->first;
-				headerPacket.itemHeader = item->second->header();
-				deletedItems.push_back(headerPacket);
-			}
+		// the tombstone tag has to be greater than tags of all items of the sublevel and less than tags of new ones
+		headerPacket.itemHeader.setTag(curTime);
+		if (headerPacket.itemHeader.timeTag.tag <= shard.maxTag)
+			headerPacket.itemHeader.timeTag.tag = shard.maxTag + (1 << ItemHeader::TAG_THREAD_BITS);
+		ItemHeader::observeTag(headerPacket.itemHeader.timeTag);
+		shard.subLevelTombstones[headerPacket.subLevelKey] = headerPacket.itemHeader.timeTag.tag;
+		
+		shard.removedSubLevels.push_back(std::move(subLevel->second)); // is freed by clearOld out of the lock
+		shard.subLevelItem.erase(subLevel);
+		auto ordered = shard.orderedItems.find(headerPacket.subLevelKey);
+		if (ordered != shard.orderedItems.end()) {
+			shard.removedOrderedKeys.push_back(std::move(ordered->second));
+			shard.orderedItems.erase(ordered);
 		}
-		_subLevelItem.erase(subLevel);
-		if (!deletedItems.empty()) {
-			autoSync.unLock();
+		autoSync.unLock();
+		
+		if (_needPackets()) {
 			_packetSync.lock();
-			_headerPackets.insert(_headerPackets.end(), deletedItems.begin(), deletedItems.end());
+			_headerPackets.push_back(headerPacket);
 			_packetSync.unLock();
 		}
 		return true;
@@ -210,12 +479,13 @@ public:
 	{
 		HeaderPacket headerPacket(_index->serverID());
 		headerPacket.cmd = EIndexCMDType::REMOVE;
-		headerPacket.subLevelKey = convertStdStringTo<TSubLevelKey>(subLevelKeyStr.c_str(), NULL, 16);
-		headerPacket.itemKey = convertStdStringTo<TItemKey>(key.c_str(), NULL, 16);
+		headerPacket.subLevelKey = KeyParser<TSubLevelKey>::parse(subLevelKeyStr);
+		headerPacket.itemKey = KeyParser<TItemKey>::parse(key);
 		
-		AutoMutex autoSync(&_sync);
-		auto subLevel = _subLevelItem.find(headerPacket.subLevelKey);
-		if (subLevel == _subLevelItem.end())
+		Shard &shard = _shard(headerPacket.subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(headerPacket.subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
 			return false;
 		
 		auto sliceID = _findSlice(headerPacket.itemKey);
@@ -223,42 +493,55 @@ public:
 		if (item == subLevel->second[sliceID].end())
 			return false;
 		else {
-			item->second->setDeleted();
-			headerPacket.itemHeader = item->second->header();
+			item->second.setDeleted();
+			headerPacket.itemHeader = item->second.header();
 			subLevel->second[sliceID].erase(item);	
+			_removeOrdered(shard, headerPacket.subLevelKey, headerPacket.itemKey);
 			
 			autoSync.unLock();
-			_packetSync.lock();
-			_headerPackets.push_back(headerPacket);
-			_packetSync.unLock();
+			if (_needPackets()) {
+				_packetSync.lock();
+				_headerPackets.push_back(headerPacket);
+				_packetSync.unLock();
+			}
 			return true;
 		}
 	}
 	
 	virtual TItemSharedPtr find(const std::string &subLevelKeyStr, const std::string &key, 
-		const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime, TTopLevelIndexPtr &selfPointer) 
+		const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime, TTopLevelIndexPtr &selfPointer, 
+		DurableWait *durableWait) 
 	{
-		HeaderPacket headerPacket(_index->serverID());
-		headerPacket.cmd = EIndexCMDType::TOUCH;
-		headerPacket.subLevelKey = convertStdStringTo<TSubLevelKey>(subLevelKeyStr.c_str(), NULL, 16);
-		headerPacket.itemKey = convertStdStringTo<TItemKey>(key.c_str(), NULL, 16);
+		typename KeyParser<TSubLevelKey>::TResult subLevelKey = KeyParser<TSubLevelKey>::parse(subLevelKeyStr);
+		typename KeyParser<TItemKey>::TResult itemKey = KeyParser<TItemKey>::parse(key);
 		
-		AutoMutex autoSync(&_sync);
-		auto subLevel = _subLevelItem.find(headerPacket.subLevelKey);
-		if (subLevel == _subLevelItem.end())
+		Shard &shard = _shard(subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
 			return TItemSharedPtr();
-		auto sliceID = _findSlice(headerPacket.itemKey);
-		auto item = subLevel->second[sliceID].find(headerPacket.itemKey);
+		auto sliceID = _findSlice(itemKey);
+		auto item = subLevel->second[sliceID].find(itemKey);
 		if (item == subLevel->second[sliceID].end())
 			return TItemSharedPtr();
-		else if (item->second->isValid(curTime))
+		else if (item->second.isValid(curTime))
 		{
 			if (lifeTime) 
 			{
-				_touch(headerPacket, item->second, lifeTime, curTime);
-				_index->addToSync(selfPointer);
+				HeaderPacket headerPacket(_index->serverID());
+				headerPacket.cmd = EIndexCMDType::TOUCH;
+				headerPacket.subLevelKey = subLevelKey;
+				headerPacket.itemKey = itemKey;
+				_touch(shard, headerPacket, item->second, lifeTime, curTime);
 			}
-			return item->second;
+			item->second.setAccessTime(curTime);
+			TItemSharedPtr foundItem = item->second.item();
+			autoSync.unLock();
+			if (lifeTime) // DURABLE levels wait for the sync out of the shard's lock
+				_index->addToSync(selfPointer, durableWait);
+			if (foundItem->isCold())
+				return _loadCold(subLevelKey, itemKey, foundItem);
+			return foundItem;
 		}
 		else {
 			subLevel->second[sliceID].erase(item);
@@ -271,20 +554,21 @@ public:
 	{
 		HeaderPacket headerPacket(_index->serverID());
 		headerPacket.cmd = EIndexCMDType::TOUCH;
-		headerPacket.subLevelKey = convertStdStringTo<TSubLevelKey>(subLevelKeyStr.c_str(), NULL, 16);
-		headerPacket.itemKey = convertStdStringTo<TItemKey>(key.c_str(), NULL, 16);
+		headerPacket.subLevelKey = KeyParser<TSubLevelKey>::parse(subLevelKeyStr);
+		headerPacket.itemKey = KeyParser<TItemKey>::parse(key);
 		
 		
-		AutoMutex autoSync(&_sync);
-		auto subLevel = _subLevelItem.find(headerPacket.subLevelKey);
-		if (subLevel == _subLevelItem.end())
+		Shard &shard = _shard(headerPacket.subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(headerPacket.subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
 			return false;
 		auto sliceID = _findSlice(headerPacket.itemKey);
 		auto item = subLevel->second[sliceID].find(headerPacket.itemKey);
 		if (item == subLevel->second[sliceID].end())
 			return false;
-		else if (item->second->isValid(curTime)) {
-			_touch(headerPacket, item->second, setTime, curTime);
+		else if (item->second.isValid(curTime)) {
+			_touch(shard, headerPacket, item->second, setTime, curTime);
 			return true;
 		}	else {
 			subLevel->second[sliceID].erase(item);
@@ -294,31 +578,40 @@ public:
 	
 	virtual void put(const std::string &subLevel, const std::string &key, TItemSharedPtr &item, bool checkBeforeReplace)
 	{
+		if (isPacked())
+			_packItem(item);
 		DataPacket dataPacket(_index->serverID());
-		dataPacket.subLevelKey = convertStdStringTo<TSubLevelKey>(subLevel, NULL, 16);
-		dataPacket.itemKey = convertStdStringTo<TItemKey>(key, NULL, 16);
+		dataPacket.subLevelKey = KeyParser<TSubLevelKey>::parse(subLevel);
+		dataPacket.itemKey = KeyParser<TItemKey>::parse(key);
 		dataPacket.item = item;
 		
-		TItemSharedPtr oldItem;
-		AutoMutex autoSync(&_sync);
-		bool changed = _put(dataPacket.subLevelKey, dataPacket.itemKey, item, oldItem, checkBeforeReplace);
+		ItemSlot oldItem;
+		Shard &shard = _shard(dataPacket.subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		if (_isRemovedSubLevel(shard, dataPacket.subLevelKey, item->header().timeTag)) { // was created before the removing
+			ItemHeader itemHeader = item->header();
+			itemHeader.setTag(itemHeader.timeTag._time);
+			item->setHeader(itemHeader);
+		}
+		bool changed = _put(shard, dataPacket.subLevelKey, dataPacket.itemKey, item, oldItem, checkBeforeReplace, true);
 		if (changed) {
 			autoSync.unLock();
+			if (!_needPackets())
+				return;
 			_packetSync.lock();
 			_dataPackets.push_back(dataPacket);
-			if (oldItem.get() != NULL) {// mark old item as removed 
+			if (!oldItem.empty()) {// mark old item as removed 
 				HeaderPacket headerPacket(_index->serverID());
 				headerPacket.cmd = EIndexCMDType::REMOVE;
 				headerPacket.subLevelKey = dataPacket.subLevelKey;
 				headerPacket.itemKey = dataPacket.itemKey;
-				headerPacket.itemHeader = oldItem->header();
+				headerPacket.itemHeader = oldItem.header();
 				_headerPackets.push_back(headerPacket);
 			}
 			_packetSync.unLock();
 		} else {
-			auto timeChange = abs(item->header().liveTo - oldItem->header().liveTo);
-			if (timeChange > MIN_SYNC_PUT_UPDATE_TIME) {
-				oldItem->setHeader(item->header());
+			auto timeChange = abs(item->header().liveTo - oldItem.header().liveTo);
+			if (timeChange > MIN_SYNC_PUT_UPDATE_TIME) { // the header of the same data has been updated by _put
 				autoSync.unLock();
 				
 				HeaderPacket headerPacket(_index->serverID());
@@ -327,17 +620,25 @@ public:
 				headerPacket.itemKey = dataPacket.itemKey;
 				headerPacket.itemHeader = item->header();
 				
-				_packetSync.lock();
-				_headerPackets.push_back(headerPacket);
-				_packetSync.unLock();
+				if (_needPackets()) {
+					_packetSync.lock();
+					_headerPackets.push_back(headerPacket);
+					_packetSync.unLock();
+				}
 			}
 		}
 	}
 	
+	virtual TSyncNumber nextSyncNumber()
+	{
+		AutoMutex autoSync(&_packetSync);
+		return _syncNumber + 1;
+	}
+	
 	virtual bool sync(Buffer &buf, const ItemHeader::TTime curTime, bool force)
 	{
 		AutoMutex autoSync;
-		if (force) {
+		if (force || isDurable()) { // packing and evicting hold the lock shortly, writers of DURABLE levels wait
 			autoSync.lock(&_diskLock);
 		} else {
 			if (!autoSync.tryLock(&_diskLock)) // some process already working with this level
@@ -350,18 +651,57 @@ public:
 		_packetSync.lock();
 		std::swap(dataPackets, _dataPackets);
 		std::swap(headerPackets, _headerPackets);
+		const TSyncNumber syncNumber = ++_syncNumber; // waiters of the swapped packets have taken this number
 		_packetSync.unLock();
 
-		_syncPacketsToDisk(dataPackets, headerPackets, buf, curTime);
+		if (isDurable()) { // files can be flushed by the rotation before the end of the sync
+			_flushFailed = false;
+			try
+			{
+				_syncPacketsToDisk(dataPackets, headerPackets, buf, curTime);
+				_flush(true);
+			}
+			catch (...)
+			{
+				_setDurable(syncNumber, false);
+				throw;
+			}
+			_setDurable(syncNumber, !_flushFailed);
+		} else {
+			_syncPacketsToDisk(dataPackets, headerPackets, buf, curTime);
+			if (_md.flags & FL_FSYNC)
+				_flush(false);
+		}
 		if (force)
 			_closeFiles();
 		return true;
 	}
+	
+	virtual bool flush()
+	{
+		AutoMutex autoSync;
+		if (!autoSync.tryLock(&_diskLock))
+			return false;
+		return _flush(false);
+	}
 	typedef unordered_multimap<TItemKey, HeaderCMDData> THeaderCMDDataHash;
-	typedef unordered_map<TSubLevelKey, THeaderCMDDataHash> THeaderCMDIndexHash;
+	struct SubLevelHeaderCMD
+	{
+		SubLevelHeaderCMD()
+			: removedTag(0)
+		{
+		}
+		u_int64_t removedTag; // tag of the sublevel removing, 0 - if it has not been removed
+		THeaderCMDDataHash items;
+	};
+	typedef unordered_map<TSubLevelKey, SubLevelHeaderCMD> THeaderCMDIndexHash;
 	
 	virtual bool load(Buffer &buf, const ItemHeader::TTime curTime)
 	{
+		if (isMemoryOnly()) // starts empty, only .meta is kept to create the level again
+			return true;
+		if (_index->isUnifiedLog() && !_readCheckpoint())
+			return false;
 		try
 		{
 			THeaderCMDIndexHash removeTouchIndex;
@@ -377,6 +717,16 @@ public:
 						return false;
 				}
 			}
+			for (auto subLevel = removeTouchIndex.begin(); subLevel != removeTouchIndex.end(); subLevel++) {
+				if (subLevel->second.removedTag) {
+					ItemHeader::UTag tag;
+					tag.tag = subLevel->second.removedTag;
+					Shard &shard = _shard(subLevel->first);
+					AutoMutex autoSync(&shard.sync);
+					_removeSubLevel(shard, autoSync, subLevel->first, tag);
+					ItemHeader::observeTag(tag);
+				}
+			}
 			dir.rewind();
 			while (dir.next()) {
 				if (dir.name()[0] == '.') // skip not data files
@@ -402,137 +752,634 @@ public:
 	
 	virtual bool pack(Buffer &buf, const ItemHeader::TTime curTime)
 	{
-		AutoMutex autoSync(&_diskLock);
-		_closeFiles();
-		
-		TPathVector headersFileList;
-		TPathVector dataFileList;
-		if (!_loadFileList(_path, headersFileList, dataFileList))
-			return false;
-		_diskLock.unLock();
-
-		THeaderCMDIndexHash removeTouchIndex;
-		for (auto headerFile = headersFileList.begin(); headerFile != headersFileList.end(); headerFile++) {
-			if (!_loadHeaderData(headerFile->c_str(), buf, curTime, removeTouchIndex))
+		AutoMutex autoSync(&_packSync); // a pack started by the maintenance is finished first
+		size_t budget = std::numeric_limits<size_t>::max();
+		bool result = true;
+		_packStep(buf, curTime, budget, result);
+		return result;
+	}
+	
+	virtual void evictCold(Buffer &buf, const ItemHeader::TTime curTime)
+	{
+		EvictCursor cursor;
+		size_t budget = std::numeric_limits<size_t>::max();
+		_evictColdStep(cursor, curTime, budget);
+	}
+	
+	virtual bool maintain(Buffer &buf, const ItemHeader::TTime curTime, MaintenanceBudget &budget)
+	{
+		if (!_isEvicting) {
+			AutoMutex autoSync(&_packSync);
+			bool result = true;
+			if (!_packStep(buf, curTime, budget.bytes, result))
 				return false;
+			if (!result)
+				log::Error::L("Cannot pack level %s\n", _level.c_str());
+			_isEvicting = true;
 		}
+		if (!_evictColdStep(_evictCursor, curTime, budget.items))
+			return false;
+		_isEvicting = false;
+		return true;
+	}
+	
+	virtual bool findRange(const std::string &subLevelKeyStr, const std::string &fromKeyStr, const std::string &toKeyStr, 
+		const size_t limit, const ItemHeader::TTime curTime, TItemRangeVector &items)
+	{
+		if (!isOrdered())
+			return false;
+		typename KeyParser<TSubLevelKey>::TResult subLevelKey = KeyParser<TSubLevelKey>::parse(subLevelKeyStr);
+		TItemKey toKey = TItemKey();
+		if (!toKeyStr.empty())
+			toKey = KeyParser<TItemKey>::parse(toKeyStr);
 		
-		bool result = true;
-		TPathVector createdDataFiles;
-		TPathVector packedFileList;
-		Buffer writeBuffer(MAX_BUF_SIZE * 1.1);
-		File packedFile;
-		for (auto dataFile = dataFileList.begin(); dataFile != dataFileList.end(); dataFile++) {
-			try
-			{
-				if (!_packDataFile(dataFile->c_str(), buf, writeBuffer, curTime, packedFile, removeTouchIndex,  
-					createdDataFiles, packedFileList)) {
-					result = false;
-					break;
-				}
-			}
-			catch (...)
-			{
-				log::Error::L("Caught exception while packing level %s\n", _path.c_str());
-				result = false;
+		Shard &shard = _shard(subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto ordered = shard.orderedItems.find(subLevelKey);
+		auto subLevel = shard.subLevelItem.find(subLevelKey);
+		if ((ordered == shard.orderedItems.end()) || (subLevel == shard.subLevelItem.end()))
+			return true;
+		auto key = ordered->second.begin();
+		if (!fromKeyStr.empty())
+			key = ordered->second.lower_bound(KeyParser<TItemKey>::parse(fromKeyStr));
+		std::string keyStr;
+		while ((key != ordered->second.end()) && (items.size() < limit)) {
+			if (!toKeyStr.empty() && (toKey < *key))
 				break;
+			auto sliceID = _findSlice(*key);
+			auto item = subLevel->second[sliceID].find(*key);
+			if (item == subLevel->second[sliceID].end()) { // has been removed from the hash index only
+				key = ordered->second.erase(key);
+				continue;
 			}
-		}
-		packedFile.close();
-		if (result) {
-			try
-			{
-				_renameTempToWork(createdDataFiles, curTime);
+			if (item->second.isValid(curTime)) {
+				item->second.setAccessTime(curTime);
+				_keyToString(*key, keyStr);
+				items.push_back(TItemRangeVector::value_type(keyStr, item->second.item()));
 			}
-			catch (...)
-			{
-				_unlink(createdDataFiles);
-				return false;
+			key++;
+		}
+		autoSync.unLock();
+		
+		for (auto item = items.begin(); item != items.end(); item++) {
+			if (item->second->isCold()) {
+				item->second.reset(item->second->load());
+				if (!item->second.get())
+					return false;
 			}
-			_unlink(headersFileList);
-			_unlink(packedFileList);
-			return true;
-		}	else {
-			_unlink(createdDataFiles);
-			return false;
 		}
-
+		return true;
 	}
 	
 	virtual void clearOld(const ItemHeader::TTime curTime)
 	{
-		for (u_int32_t slice = 0; slice < _slicesCount; slice++)
-		{
-			AutoMutex autoSync(&_sync);
-			for (auto subLevel = _subLevelItem.begin(); subLevel != _subLevelItem.end(); subLevel++) {
-				for (auto item = subLevel->second[slice].begin(); item != subLevel->second[slice].end(); ) {
-					if (item->second->isValid(curTime))
-						item++;
-					else
-					{
-						item = subLevel->second[slice].erase(item);
-					}
-				};
-			};
-		}
+		for (size_t i = 0; i < _shardsCount; i++)
+			_clearOld(_shards[i], curTime);
 	}
 	
 	virtual bool addFromAnotherServer(const TServerID serverID, Buffer &data, const Buffer::TSize endPacketPos, 
-		const ItemHeader::TTime curTime, Buffer &buffer)
+		const TVersion version, const ItemHeader::TTime curTime, Buffer &buffer)
+	{
+		TDataPacketVector dataPackets;
+		THeaderPacketVector headerPackets;
+		if (!_addPackets(serverID, data, endPacketPos, version, curTime, dataPackets, headerPackets))
+			return false;
+		AutoMutex autoDiskLock(&_diskLock);
+		_syncPacketsToDisk(dataPackets, headerPackets, buffer, curTime);
+		return true;
+	};
+	
+	virtual bool replayLog(Buffer &data, const Buffer::TSize endPacketPos, const TVersion version, 
+		const ItemHeader::TTime curTime)
 	{
-		ItemHeader itemHeader;
-		TSubLevelKey subLevelKey;
-		TItemKey itemKey;
-		
 		TDataPacketVector dataPackets;
 		THeaderPacketVector headerPackets;
+		const bool result = _addPackets(0, data, endPacketPos, version, curTime, dataPackets, headerPackets);
+		AutoMutex autoSync(&_diskLock); // already in the log, but not in the level's files yet
+		_addChanges(dataPackets, headerPackets);
+		return result;
+	}
+	
+private:
+	struct Shard;
+	Shard &_shard(const TSubLevelKey &subLevelKey)
+	{
+		if (_shardsCount == 1)
+			return _shards[0];
+		return _shards[getCheckSum32Tmpl<TSubLevelKey>(subLevelKey) % _shardsCount];
+	}
+	
+	TSliceCount _findSlice(const TItemKey &itemKey)
+	{
+		if (_slicesCount == 1)
+			return 0;
+		return getCheckSum32Tmpl<TItemKey>(itemKey) % _slicesCount;
+	}
+	
+	// a local item has to win over the current one, even if its tag was made before the current one's
+	static void _setTagAfter(Item &item, const ItemHeader::UTag &tag)
+	{
+		ItemHeader itemHeader = item.header();
+		itemHeader.timeTag.tag = tag.tag + (1 << ItemHeader::TAG_THREAD_BITS);
+		ItemHeader::observeTag(itemHeader.timeTag);
+		item.setHeader(itemHeader);
+	}
+	
+	// oldItem gets a copy of the replaced item, the same data only gets the new header if its liveTo has changed enough
+	bool _put(Shard &shard, const TSubLevelKey &subLevelKey, const TItemKey &itemKey, TItemSharedPtr &item, 
+		ItemSlot &oldItem, const bool checkBeforeReplace, const bool isLocal)
+	{
+		static TItemIndexVector startIndexSlices(_slicesCount);
+		auto res = shard.subLevelItem.emplace(subLevelKey, startIndexSlices);
+		auto sliceID = _findSlice(itemKey);
+		auto itemRes = res.first->second[sliceID].emplace(itemKey, item);
 		
-		AutoMutex autoSync(&_sync);
-		while (data.readPos() < endPacketPos) {
-			EIndexCMDType::EIndexCMDType cmd;
-			_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, data);
-			if (!itemHeader.liveTo || (itemHeader.liveTo > curTime) || (cmd == EIndexCMDType::REMOVE)) {
-				auto subLevel = _subLevelItem.find(subLevelKey);
-				if (subLevel != _subLevelItem.end()) {
-					auto sliceID = _findSlice(itemKey);
-					auto item = subLevel->second[sliceID].find(itemKey);
-					if (item != subLevel->second[sliceID].end()) {
-						if (cmd == EIndexCMDType::REMOVE) {
-							if (itemHeader.timeTag.tag == item->second->header().timeTag.tag) {
-									item->second->setDeleted();
+		if (!itemRes.second) {
+			oldItem = itemRes.first->second;
+			if (isLocal && (oldItem.header().timeTag.tag >= item->header().timeTag.tag))
+				_setTagAfter(*item, oldItem.header().timeTag);
+			if (checkBeforeReplace && itemRes.first->second.equal(item.get()))	{
+				const ItemHeader::TTime oldLiveTo = oldItem.header().liveTo;
+				if (abs(item->header().liveTo - oldLiveTo) > MIN_SYNC_PUT_UPDATE_TIME) {
+					itemRes.first->second.setHeader(item->header());
+					_addExpiry(shard, subLevelKey, itemKey, item->header().liveTo, oldLiveTo);
+				}
+				return false;
+			}
+			itemRes.first->second = item;
+		}
+		_addExpiry(shard, subLevelKey, itemKey, item->header().liveTo, oldItem.empty() ? 0 : oldItem.header().liveTo);
+		_updateMaxTag(shard, item->header().timeTag);
+		_addOrdered(shard, subLevelKey, itemKey);
+		return true;
+	}
+	
+	typedef unordered_map<TSubLevelKey, u_int64_t> TSubLevelTombstones;
+	
+	bool _isRemovedSubLevel(Shard &shard, const TSubLevelKey &subLevelKey, const ItemHeader::UTag &tag)
+	{
+		if (shard.subLevelTombstones.empty())
+			return false;
+		auto tombstone = shard.subLevelTombstones.find(subLevelKey);
+		return (tombstone != shard.subLevelTombstones.end()) && (tag.tag < tombstone->second);
+	}
+	
+	typedef std::set<TItemKey> TOrderedKeys;
+	typedef unordered_map<TSubLevelKey, TOrderedKeys> TOrderedSubLevelIndex;
+	typedef std::vector<TOrderedKeys> TOrderedKeysList;
+	
+	void _addOrdered(Shard &shard, const TSubLevelKey &subLevelKey, const TItemKey &itemKey)
+	{
+		if (isOrdered())
+			shard.orderedItems[subLevelKey].insert(itemKey);
+	}
+	
+	void _removeOrdered(Shard &shard, const TSubLevelKey &subLevelKey, const TItemKey &itemKey)
+	{
+		if (!isOrdered())
+			return;
+		auto ordered = shard.orderedItems.find(subLevelKey);
+		if (ordered != shard.orderedItems.end())
+			ordered->second.erase(itemKey);
+	}
+	
+	static void _keyToString(const uint32_t key, std::string &keyStr)
+	{
+		char buf[sizeof(key) * 2 + 1];
+		snprintf(buf, sizeof(buf), "%x", key);
+		keyStr = buf;
+	}
+	
+	static void _keyToString(const uint64_t key, std::string &keyStr)
+	{
+		char buf[sizeof(key) * 2 + 1];
+		snprintf(buf, sizeof(buf), "%llx", static_cast<unsigned long long>(key));
+		keyStr = buf;
+	}
+	
+	static void _keyToString(const std::string &key, std::string &keyStr)
+	{
+		keyStr = key;
+	}
+	
+	static void _keyToString(const BinKey128 &key, std::string &keyStr)
+	{
+		key.toString(keyStr);
+	}
+	
+	void _updateMaxTag(Shard &shard, const ItemHeader::UTag &tag)
+	{
+		if (tag.tag > shard.maxTag)
+			shard.maxTag = tag.tag;
+	}
+	
+	// removes the sublevel by a replicated or loaded tombstone; the sublevel is moved out of the index at once and freed 
+	// by clearOld as on the local removing, when the shard has items made after the tombstone they are picked out of 
+	// the sublevel out of the lock and put back, till then they are not seen
+	void _removeSubLevel(Shard &shard, AutoMutex &autoSync, const TSubLevelKey &subLevelKey, const ItemHeader::UTag &tag)
+	{
+		auto tombstone = shard.subLevelTombstones.emplace(subLevelKey, tag.tag);
+		if (!tombstone.second) {
+			if (tombstone.first->second >= tag.tag)
+				return;
+			tombstone.first->second = tag.tag;
+		}
+		auto subLevel = shard.subLevelItem.find(subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
+			return;
+		TItemIndexVector removed(std::move(subLevel->second));
+		shard.subLevelItem.erase(subLevel);
+		auto ordered = shard.orderedItems.find(subLevelKey);
+		if (ordered != shard.orderedItems.end()) {
+			shard.removedOrderedKeys.push_back(std::move(ordered->second));
+			shard.orderedItems.erase(ordered);
+		}
+		if (shard.maxTag < tag.tag) { // all items of the sublevel are older
+			shard.removedSubLevels.push_back(std::move(removed));
+			return;
+		}
+		
+		autoSync.unLock();
+		typedef std::pair<TItemKey, ItemSlot> TKeyItem;
+		std::vector<TKeyItem> newerItems;
+		for (auto slice = removed.begin(); slice != removed.end(); slice++) {
+			for (auto item = slice->begin(); item != slice->end(); item++) {
+				if (item->second.header().timeTag.tag >= tag.tag)
+					newerItems.push_back(TKeyItem(item->first, item->second));
+			}
+		}
+		removed.clear();
+		autoSync.lock(&shard.sync);
+		static TItemIndexVector startIndexSlices(_slicesCount);
+		for (auto newerItem = newerItems.begin(); newerItem != newerItems.end(); newerItem++) {
+			const ItemHeader::UTag &itemTag = newerItem->second.header().timeTag;
+			if (_isRemovedSubLevel(shard, subLevelKey, itemTag)) // has been removed again meanwhile
+				continue;
+			auto res = shard.subLevelItem.emplace(subLevelKey, startIndexSlices);
+			auto sliceID = _findSlice(newerItem->first);
+			auto itemRes = res.first->second[sliceID].emplace(newerItem->first, newerItem->second);
+			if (!itemRes.second) {
+				if (itemRes.first->second.header().timeTag.tag >= itemTag.tag) // has been changed meanwhile
+					continue;
+				itemRes.first->second = newerItem->second;
+			}
+			_addOrdered(shard, subLevelKey, newerItem->first);
+		}
+	}
+	
+	bool _isSameData(const ItemSlot &item, const ItemHeader &itemHeader, Buffer &data)
+	{
+		return item.equal(data.begin() + data.readPos(), itemHeader.size);
+	}
+	
+	ItemSlot *_loadPlace(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, const ItemHeader &itemHeader)
+	{
+		static TItemIndexVector startIndexSlices(_slicesCount);
+		static ItemSlot empty;
+		Shard &shard = _shard(subLevelKey);
+		auto res = shard.subLevelItem.emplace(subLevelKey, startIndexSlices);
+		auto sliceID = _findSlice(itemKey);
+		auto itemRes = res.first->second[sliceID].emplace(itemKey, empty);
+		ItemHeader::TTime oldLiveTo = 0;
+		if (!itemRes.second) {
+			if (itemRes.first->second.header().timeTag.tag >= itemHeader.timeTag.tag) // skip old data
+				return NULL;
+			oldLiveTo = itemRes.first->second.header().liveTo;
+		}
+		ItemHeader::observeTag(itemHeader.timeTag);
+		_addExpiry(shard, subLevelKey, itemKey, itemHeader.liveTo, oldLiveTo);
+		_updateMaxTag(shard, itemHeader.timeTag);
+		_addOrdered(shard, subLevelKey, itemKey);
+		return &itemRes.first->second;
+	}
+	
+	struct ExpiryEntry
+	{
+		TSubLevelKey subLevelKey;
+		TItemKey itemKey;
+		ItemHeader::TTime liveTo;
+	};
+	typedef std::vector<ExpiryEntry> TExpiryEntryVector;
+	typedef std::map<ItemHeader::TTime, TExpiryEntryVector> TExpiryBuckets;
+	
+	static bool _isSameExpiryBucket(const ItemHeader::TTime liveTo, const ItemHeader::TTime otherLiveTo)
+	{
+		return (liveTo / EXPIRY_BUCKET_TIME) == (otherLiveTo / EXPIRY_BUCKET_TIME);
+	}
+	
+	// an item has an entry in the bucket of its liveTo, a new one is added only when liveTo moves to another bucket;
+	// entries left in the old buckets are dropped when they are checked
+	void _addExpiry(Shard &shard, const TSubLevelKey &subLevelKey, const TItemKey &itemKey, const ItemHeader::TTime liveTo,
+		const ItemHeader::TTime oldLiveTo)
+	{
+		if (!liveTo || (oldLiveTo && _isSameExpiryBucket(liveTo, oldLiveTo)))
+			return;
+		shard.expiryBuckets[liveTo / EXPIRY_BUCKET_TIME].push_back(ExpiryEntry({subLevelKey, itemKey, liveTo}));
+	}
+	
+	// returns liveTo of the item if it has been prolonged within the entry's bucket, the entry is kept for it then
+	ItemHeader::TTime _expire(Shard &shard, const ExpiryEntry &entry, const ItemHeader::TTime curTime)
+	{
+		auto subLevel = shard.subLevelItem.find(entry.subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
+			return 0;
+		auto sliceID = _findSlice(entry.itemKey);
+		auto item = subLevel->second[sliceID].find(entry.itemKey);
+		if (item == subLevel->second[sliceID].end())
+			return 0;
+		if (!item->second.isValid(curTime)) { // can be touched or replaced
+			subLevel->second[sliceID].erase(item);
+			_removeOrdered(shard, entry.subLevelKey, entry.itemKey);
+			return 0;
+		}
+		const ItemHeader::TTime liveTo = item->second.header().liveTo;
+		if (liveTo && _isSameExpiryBucket(liveTo, entry.liveTo))
+			return liveTo;
+		return 0;
+	}
+	
+	void _clearOld(Shard &shard, const ItemHeader::TTime curTime)
+	{
+		shard.sync.lock();
+		TItemIndexVectorList removedSubLevels;
+		std::swap(removedSubLevels, shard.removedSubLevels);
+		TOrderedKeysList removedOrderedKeys;
+		std::swap(removedOrderedKeys, shard.removedOrderedKeys);
+		for (auto tombstone = shard.subLevelTombstones.begin(); tombstone != shard.subLevelTombstones.end(); ) {
+			ItemHeader::UTag tag;
+			tag.tag = tombstone->second;
+			if ((tag._time + SUBLEVEL_TOMBSTONE_KEEP_TIME) < curTime)
+				tombstone = shard.subLevelTombstones.erase(tombstone);
+			else
+				tombstone++;
+		}
+		shard.sync.unLock();
+		removedSubLevels.clear();
+		removedOrderedKeys.clear();
+		
+		const ItemHeader::TTime lastBucket = curTime / EXPIRY_BUCKET_TIME;
+		TExpiryEntryVector delayed;
+		while (true) {
+			AutoMutex autoSync(&shard.sync); // released after every batch to not block readers for long
+			auto bucket = shard.expiryBuckets.begin();
+			if ((bucket == shard.expiryBuckets.end()) || (bucket->first > lastBucket))
+				break;
+			for (size_t count = 0; (count < EXPIRY_BATCH_SIZE) && !bucket->second.empty(); count++) {
+				ExpiryEntry &entry = bucket->second.back();
+				if (entry.liveTo > curTime) // can be only in the last bucket
+					delayed.push_back(entry);
+				else {
+					entry.liveTo = _expire(shard, entry, curTime);
+					if (entry.liveTo)
+						delayed.push_back(entry);
+				}
+				bucket->second.pop_back();
+			}
+			if (bucket->second.empty()) {
+				if (delayed.empty()) {
+					shard.expiryBuckets.erase(bucket);
+				} else {
+					bucket->second.swap(delayed);
+					break;
+				}
+			}
+		}
+	}
+	
+	void _put(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, const ItemHeader &itemHeader, const char *data)
+	{
+		auto place = _loadPlace(subLevelKey, itemKey, itemHeader);
+		if (place)
+			place->set(data, itemHeader);
+	}
+
+	void _put(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, const ItemHeader &itemHeader, 
+		const TFilePtr &file, const off_t offset, const Item::TLocation location)
+	{
+		auto place = _loadPlace(subLevelKey, itemKey, itemHeader);
+		if (place) {
+			Item *item = Item::createCold(itemHeader, file, offset);
+			item->setLocation(location);
+			place->reset(item);
+		}
+	}
+	
+	TItemSharedPtr _loadCold(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, TItemSharedPtr coldItem)
+	{
+		TItemSharedPtr hotItem(coldItem->load());
+		if (!hotItem.get() || !_index->isPromoteCold())
+			return hotItem;
+		
+		Shard &shard = _shard(subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
+			return hotItem;
+		auto sliceID = _findSlice(itemKey);
+		auto item = subLevel->second[sliceID].find(itemKey);
+		if ((item != subLevel->second[sliceID].end()) && (item->second == coldItem)) { // has not been changed meanwhile
+			hotItem->setHeader(coldItem->header());
+			item->second = hotItem;
+		}
+		return hotItem;
+	}
+	
+	// the maintenance evicts by steps, every step resumes from the slice where the previous one has stopped
+	struct EvictCursor
+	{
+		EvictCursor()
+			: shard(0), isInShard(false), slice(0), evicted(0)
+		{
+		}
+		size_t shard;
+		bool isInShard; // the step has stopped inside the shard at subLevelKey and slice
+		TSubLevelKey subLevelKey;
+		size_t slice;
+		size_t evicted;
+	};
+	EvictCursor _evictCursor; // is used only by the maintenance
+	bool _isEvicting; // the maintenance has finished the pack of the level
+	
+	// checks items while the budget lasts, returns true when all shards have been checked
+	bool _evictColdStep(EvictCursor &cursor, const ItemHeader::TTime curTime, size_t &budget)
+	{
+		if (!_index->coldTime() || isMemoryOnly()) // cold items are read from data files
+			return true;
+		TLocationFileMap files;
+		_getLocationFiles(files);
+		ItemHeader::TTime minAccessTime = curTime - _index->coldTime();
+		for (; cursor.shard < _shardsCount; cursor.shard++) {
+			if (!_evictCold(_shards[cursor.shard], files, minAccessTime, cursor, budget))
+				return false;
+		}
+		if (cursor.evicted)
+			log::Info::L("%zu items of %s have been moved to the cold tier\n", cursor.evicted, _path.c_str());
+		cursor = EvictCursor();
+		return true;
+	}
+	
+	// items which have not been read since minAccessTime and whose data is in a tracked file become cold ones, 
+	// returns false if the budget has been used up before the end of the shard
+	bool _evictCold(Shard &shard, const TLocationFileMap &files, const ItemHeader::TTime minAccessTime, 
+		EvictCursor &cursor, size_t &budget)
+	{
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.begin();
+		size_t sliceID = 0;
+		if (cursor.isInShard) {
+			cursor.isInShard = false;
+			subLevel = shard.subLevelItem.find(cursor.subLevelKey);
+			if (subLevel == shard.subLevelItem.end()) // has been removed, the rest of the shard waits for the next hour
+				return true;
+			sliceID = cursor.slice;
+		}
+		for (; subLevel != shard.subLevelItem.end(); subLevel++, sliceID = 0) {
+			for (; sliceID < subLevel->second.size(); sliceID++) {
+				if (!budget) {
+					cursor.isInShard = true;
+					cursor.subLevelKey = subLevel->first;
+					cursor.slice = sliceID;
+					return false;
+				}
+				auto slice = subLevel->second.begin() + sliceID;
+				budget -= std::min(budget, static_cast<size_t>(slice->size()));
+				for (auto item = slice->begin(); item != slice->end(); item++) {
+					Item *curItem = item->second.get();
+					if (!curItem || curItem->isCold() || (curItem->accessTime() >= minAccessTime)) // inline items stay
+						continue;
+					const Item::TLocation location = curItem->location();
+					if (!location) // has not been written yet
+						continue;
+					auto file = files.find(_locationFileNumber(location));
+					if (file == files.end()) // the file has been packed and its items have not been bound to the new one
+						continue;
+					Item *coldItem = Item::createCold(curItem->header(), file->second.file, _locationOffset(location));
+					coldItem->setLocation(location);
+					item->second.reset(coldItem);
+					cursor.evicted++;
+				}
+			}
+		}
+		return true;
+	}
+
+	struct DataPacket
+	{
+		DataPacket(const TServerID serverID)
+			: serverID(serverID)
+		{
+		}
+		TServerID serverID;
+		TSubLevelKey subLevelKey;
+		TItemKey itemKey;
+		TItemSharedPtr item;
+	};
+	
+	Mutex _packetSync;
+	typedef std::vector<DataPacket> TDataPacketVector;
+	TDataPacketVector _dataPackets;
+	
+	struct HeaderPacket
+	{
+		HeaderPacket(const TServerID serverID)
+			: serverID(serverID)
+		{
+		}
+
+		TServerID serverID;
+		EIndexCMDType::EIndexCMDType cmd;
+		TSubLevelKey subLevelKey;
+		TItemKey itemKey;
+		ItemHeader itemHeader;
+		TItemSharedPtr item;
+	};
+	
+	typedef std::vector<HeaderPacket> THeaderPacketVector;
+	THeaderPacketVector _headerPackets;
+	
+	// applies entries of a replication packet, the changes which win are returned as packets to sync
+	bool _addPackets(const TServerID serverID, Buffer &data, const Buffer::TSize endPacketPos, const TVersion version,
+		const ItemHeader::TTime curTime, TDataPacketVector &dataPackets, THeaderPacketVector &headerPackets)
+	{
+		ItemHeader itemHeader;
+		TSubLevelKey subLevelKey;
+		TItemKey itemKey;
+		const Buffer::TSize checkSumSize = _checkSumSize(version);
+		const ItemHeader::TTime baseTime = _getBaseTime(data, version); // follows the level's name
+		
+		for (; data.readPos() < endPacketPos; data.skip(checkSumSize)) { // every path leaves the record's data read
+			EIndexCMDType::EIndexCMDType cmd;
+			const Buffer::TSize recordStart = data.readPos();
+			_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, data, version, baseTime);
+			if (checkSumSize && !_isValidRecord(data, recordStart, itemHeader.size)) {
+				log::Error::L("Bad checksum of a record from server %u to %s\n", serverID, _path.c_str());
+				return false;
+			}
+			ItemHeader::observeTag(itemHeader.timeTag); // later local changes have to win
+			Shard &shard = _shard(subLevelKey);
+			AutoMutex autoSync(&shard.sync);
+			if (cmd == EIndexCMDType::REMOVE_SUBLEVEL) {
+				_removeSubLevel(shard, autoSync, subLevelKey, itemHeader.timeTag);
+				HeaderPacket hp(serverID);
+				hp.cmd = EIndexCMDType::REMOVE_SUBLEVEL;
+				hp.subLevelKey = subLevelKey;
+				hp.itemKey = itemKey;
+				hp.itemHeader = itemHeader;
+				headerPackets.push_back(hp);
+				continue;
+			}
+			if (_isRemovedSubLevel(shard, subLevelKey, itemHeader.timeTag)) {
+				data.skip(itemHeader.size);
+				continue;
+			}
+			if (!itemHeader.liveTo || (itemHeader.liveTo > curTime) || (cmd == EIndexCMDType::REMOVE)) {
+				auto subLevel = shard.subLevelItem.find(subLevelKey);
+				if (subLevel != shard.subLevelItem.end()) {
+					auto sliceID = _findSlice(itemKey);
+					auto item = subLevel->second[sliceID].find(itemKey);
+					if (item != subLevel->second[sliceID].end()) {
+						if (cmd == EIndexCMDType::REMOVE) {
+							if (itemHeader.timeTag.tag == item->second.header().timeTag.tag) {
+									item->second.setDeleted();
 									HeaderPacket hp(serverID);
 									hp.cmd = EIndexCMDType::REMOVE;
 									hp.subLevelKey = subLevelKey;
 									hp.itemKey = itemKey;
-									hp.itemHeader = item->second->header();
+									hp.itemHeader = item->second.header();
 									subLevel->second[sliceID].erase(item);	
 									headerPackets.push_back(hp);
 							}
-						}	else 	if (itemHeader.timeTag.tag > item->second->header().timeTag.tag) {
-							if (cmd == EIndexCMDType::TOUCH) {
-								item->second->setHeader(itemHeader);
+						}	else 	if (itemHeader.timeTag.tag > item->second.header().timeTag.tag) {
+							if ((cmd == EIndexCMDType::TOUCH) || _isSameData(item->second, itemHeader, data)) {
+								const ItemHeader::TTime oldLiveTo = item->second.header().liveTo;
+								item->second.setHeader(itemHeader);
+								_addExpiry(shard, subLevelKey, itemKey, itemHeader.liveTo, oldLiveTo);
+								_updateMaxTag(shard, itemHeader.timeTag);
 								HeaderPacket hp(serverID);
 								hp.cmd = EIndexCMDType::TOUCH;
 								hp.subLevelKey = subLevelKey;
 								hp.itemKey = itemKey;
 								hp.itemHeader = itemHeader;
-								hp.item = item->second;
+								hp.item = item->second.item();
 								headerPackets.push_back(hp);
 							} else if (cmd == EIndexCMDType::PUT) {
 								HeaderPacket hp(serverID);
 								hp.cmd = EIndexCMDType::REMOVE;
 								hp.subLevelKey = subLevelKey;
 								hp.itemKey = itemKey;
-								hp.itemHeader = item->second->header();
+								hp.itemHeader = item->second.header();
 								headerPackets.push_back(hp);
 
-								item->second.reset(new Item((char*)data.mapBuffer(itemHeader.size), itemHeader));
+								TItemSharedPtr newItem = std::make_shared<Item>((char*)data.mapBuffer(itemHeader.size), itemHeader);
+								item->second = newItem;
+								_addExpiry(shard, subLevelKey, itemKey, itemHeader.liveTo, hp.itemHeader.liveTo);
+								_updateMaxTag(shard, itemHeader.timeTag);
 								// remove old item
 								
 								DataPacket dataPacket(serverID);
 								dataPacket.subLevelKey = subLevelKey;
 								dataPacket.itemKey = itemKey;
-								dataPacket.item = item->second;
+								dataPacket.item = newItem;
 								dataPackets.push_back(dataPacket);
 								continue;
 							}
@@ -550,13 +1397,14 @@ public:
 				switch (cmd)
 				{
 					case EIndexCMDType::REMOVE:
+					case EIndexCMDType::REMOVE_SUBLEVEL:
 					break;	
 					case EIndexCMDType::TOUCH:
 					case EIndexCMDType::PUT: 
 					{
-						TItemSharedPtr oldItem;
-						TItemSharedPtr item(new Item((char*)data.mapBuffer(itemHeader.size), itemHeader));
-						_put(subLevelKey, itemKey, item, oldItem, false);
+						ItemSlot oldItem;
+						TItemSharedPtr item = std::make_shared<Item>((char*)data.mapBuffer(itemHeader.size), itemHeader);
+						_put(shard, subLevelKey, itemKey, item, oldItem, false, false);
 						DataPacket dataPacket(serverID);
 						dataPacket.subLevelKey = subLevelKey;
 						dataPacket.itemKey = itemKey;
@@ -573,122 +1421,295 @@ public:
 			}
 			data.skip(itemHeader.size);
 		}
-		autoSync.unLock();
-		AutoMutex autoDiskLock(&_diskLock);
-		_syncPacketsToDisk(dataPackets, headerPackets, buffer, curTime);
 		return true;
+	}
+	
+	void _syncPacketsToDisk(TDataPacketVector &dataPackets, THeaderPacketVector &headerPackets, Buffer &buf, 
+		const ItemHeader::TTime curTime)
+	{
+		if (!dataPackets.empty() || !headerPackets.empty()) {
+			if (_isWritingFiles() && !_openFiles(curTime)) {
+				log::Fatal::L("Can't open files for %s synchronization\n", _path.c_str());
+				throw std::exception();
+			}
+			try
+			{
+				_syncDataPackets(dataPackets, buf, curTime);
+				_syncHeaderPackets(headerPackets, buf, curTime);
+			}
+			catch (...)
+			{
+				if (IoRing::threadRing()) // the queued writes point to the items of the packets
+					IoRing::threadRing()->cancel();
+				_writtenItems.clear();
+				throw;
+			}
+			if (_isFsynced())
+				_needFsync = true;
+			if (isDurable() && IoRing::threadRing()) // fdatasync is submitted right after the writes complete
+				_flush(true);
+			else
+				_submitWrites(false);
+			for (auto written = _writtenItems.begin(); written != _writtenItems.end(); written++)
+				written->item->setLocation(written->location);
+			_writtenItems.clear();
+			_rotateFiles();
+			_addChanges(dataPackets, headerPackets);
+		}
+	}
+	
+	// the buffer keeps entries' headers and small items, bigger items are written straight from their data which 
+	// is pinned by the packets
+	static const ItemHeader::TSize MIN_ZERO_COPY_SIZE = 256;
+	static const size_t MAX_WRITE_PARTS = 512; // IOV_MAX is 1024
+	struct WritePart
+	{
+		const void *data; // NULL - the part of the buffer from pos
+		Buffer::TSize pos;
+		size_t size;
 	};
+	typedef std::vector<WritePart> TWritePartVector;
 	
-private:
-	TSliceCount _findSlice(const TItemKey &itemKey)
+	// segments grow by aligned chunks of space allocated ahead of the writes, so appends neither fragment the files
+	// nor change their extents; the space is kept out of the file size and is released on close and on load
+	static const off_t PREALLOCATE_SIZE = 8 * 1024 * 1024;
+	static const off_t WRITE_ALIGN = 4096;
+	static const size_t MIN_ALIGNED_WRITE_SIZE = 16 * WRITE_ALIGN; // the resent tail is less than 1/16 of the write
+	struct FileSpace
 	{
-		return getCheckSum32Tmpl<TItemKey>(itemKey) % _slicesCount;
+		off_t end; // of the written data including the writes queued to the ring
+		off_t allocated;
+		char tail[WRITE_ALIGN]; // the written part of the last block
+	};
+	FileSpace _dataSpace;
+	FileSpace _headerSpace;
+	
+	void _writeFile(File &file, FileSpace &space, const Buffer::TDataPtr data, const ssize_t size)
+	{
+		const WritePart part = {NULL, 0, static_cast<size_t>(size)};
+		const struct iovec iov = {data, static_cast<size_t>(size)};
+		_writeFile(file, space, TWritePartVector(1, part), &iov, size);
 	}
 	
-	bool _put(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, TItemSharedPtr &item, 
-		TItemSharedPtr &oldItem, const bool checkBeforeReplace)
+	// small syncs are appended where the file ends; full chunks start at a block boundary, the written part of 
+	// the last block is sent again from the tail, so the file system gets whole blocks for them. The writes which 
+	// are in flight together overlap only by the same bytes; the ring copies the tail and the parts of the buffer, 
+	// items' data is pinned by the packets till the submit
+	void _writeFile(File &file, FileSpace &space, const TWritePartVector &parts, const struct iovec *iov, 
+		const size_t size)
 	{
-		static TItemIndexVector startIndexSlices(_slicesCount);
-		auto res = _subLevelItem.emplace(subLevelKey, startIndexSlices);
-		auto sliceID = _findSlice(itemKey);
-		auto itemRes = res.first->second[sliceID].emplace(itemKey, item);
-		
-		if (!itemRes.second) {
-			oldItem = itemRes.first->second;
-			if (checkBeforeReplace && itemRes.first->second->equal(item.get()))	{
-				return false;
-			}
-			itemRes.first->second = item;
+		const size_t tailSize = space.end % WRITE_ALIGN;
+		const bool isAligned = (size >= MIN_ALIGNED_WRITE_SIZE);
+		const off_t offset = isAligned ? (space.end - tailSize) : space.end;
+		_preallocate(file, space, size);
+		IoRing *ioRing = IoRing::threadRing();
+		TIoVector writeIov;
+		writeIov.reserve(parts.size() + 1);
+		if (tailSize) { // the unwritten tail still starts the new one if the write doesn't fill its block
+			struct iovec tail = {(ioRing && isAligned) ? ioRing->copy(space.tail, tailSize) : space.tail, tailSize};
+			writeIov.push_back(tail);
 		}
-		return true;
+		for (size_t i = 0; i < parts.size(); i++) {
+			writeIov.push_back(iov[i]);
+			if (ioRing && !parts[i].data)
+				writeIov.back().iov_base = ioRing->copy(iov[i].iov_base, iov[i].iov_len);
+		}
+		const size_t skipped = (tailSize && !isAligned) ? 1 : 0;
+		const size_t writeSize = isAligned ? (tailSize + size) : size;
+		if (ioRing ? ioRing->writeRef(file.descr(), offset, &writeIov[skipped], writeIov.size() - skipped) : 
+			(pwritev(file.descr(), &writeIov[skipped], writeIov.size() - skipped, offset) == (ssize_t)writeSize)) {
+			_keepTail(space, writeIov);
+			return;
+		}
+		log::Fatal::L("Can't sync %s\n", _path.c_str());
+		throw std::exception();
 	}
 	
-	void _put(const TSubLevelKey &subLevelKey, const TItemKey &itemKey, const ItemHeader &itemHeader, const char *data)
+	static void _keepTail(FileSpace &space, const TIoVector &iov)
 	{
-		static TItemIndexVector startIndexSlices(_slicesCount);
-		static TItemSharedPtr empty;
-		auto res = _subLevelItem.emplace(subLevelKey, startIndexSlices);
-		auto sliceID = _findSlice(itemKey);
-		auto itemRes = res.first->second[sliceID].emplace(itemKey, empty);
-		if (!itemRes.second) {
-			if (itemRes.first->second->header().timeTag.tag >= itemHeader.timeTag.tag) // skip old data
-				return;
+		char tail[WRITE_ALIGN]; // the old tail can be the first vector
+		const size_t tailSize = space.end % WRITE_ALIGN;
+		size_t left = tailSize;
+		for (auto vec = iov.rbegin(); left && (vec != iov.rend()); vec++) {
+			const size_t size = std::min(left, vec->iov_len);
+			left -= size;
+			memcpy(tail + left, static_cast<const char*>(vec->iov_base) + vec->iov_len - size, size);
 		}
-		itemRes.first->second.reset(new Item(data, itemHeader));
+		memcpy(space.tail, tail, tailSize);
 	}
-
-	struct DataPacket
+	
+	// the files start with the meta data, it is the first tail
+	void _startSpace(FileSpace &space)
 	{
-		DataPacket(const TServerID serverID)
-			: serverID(serverID)
-		{
+		memcpy(space.tail, &_md, sizeof(_md));
+		memcpy(space.tail + sizeof(_md), &_baseTime, sizeof(_baseTime));
+		space.end = sizeof(_md) + sizeof(_baseTime);
+	}
+	
+	// a crash leaves the space preallocated after the written data, the truncation to the same size releases it
+	void _releasePreallocated(const char *path, File &fd, const off_t size)
+	{
+		struct stat st;
+		if (fstat(fd.descr(), &st) || ((st.st_blocks * 512) <= (size + st.st_blksize)))
+			return;
+		if (truncate(path, size))
+			log::Warning::L("Can't release the preallocated space of %s (%d)\n", path, errno);
+	}
+	
+	// returns false if the writes or the linked fdatasync have failed, failed writes without fdatasync throw
+	bool _submitWrites(const bool fsync)
+	{
+		IoRing *ioRing = IoRing::threadRing();
+		if (!ioRing)
+			return true;
+		if (fsync) {
+			if (_dataFile.descr())
+				ioRing->fsync(_dataFile.descr());
+			if (_headerFile.descr())
+				ioRing->fsync(_headerFile.descr());
 		}
-		TServerID serverID;
-		TSubLevelKey subLevelKey;
-		TItemKey itemKey;
-		TItemSharedPtr item;
-	};
+		if (ioRing->submit())
+			return true;
+		if (!fsync) {
+			log::Fatal::L("Can't sync %s\n", _path.c_str());
+			throw std::exception();
+		}
+		log::Error::L("Can't sync %s\n", _path.c_str());
+		return false;
+	}
 	
-	Mutex _packetSync;
-	typedef std::vector<DataPacket> TDataPacketVector;
-	TDataPacketVector _dataPackets;
+	void _rotateFiles()
+	{
+		if (!_isWritingFiles())
+			return;
+		if (_dataSpace.end > static_cast<off_t>(MAX_FILE_SIZE)) {
+			_flush(true);
+			_closeFile(_dataFile, _dataSpace);
+		}
+		if (_headerSpace.end > static_cast<off_t>(MAX_FILE_SIZE)) {
+			_flush(true);
+			_closeFile(_headerFile, _headerSpace);
+		}
+	}
 	
-	struct HeaderPacket
+	void _preallocate(File &file, FileSpace &space, const size_t size)
 	{
-		HeaderPacket(const TServerID serverID)
-			: serverID(serverID)
-		{
+		space.end += size;
+		if (space.end <= space.allocated)
+			return;
+		const off_t allocateTo = ((space.end / PREALLOCATE_SIZE) + 1) * PREALLOCATE_SIZE;
+		if (fallocate(file.descr(), FALLOC_FL_KEEP_SIZE, space.allocated, allocateTo - space.allocated)) {
+			if ((errno != EOPNOTSUPP) && (errno != ENOSYS))
+				log::Warning::L("Can't preallocate %s (%d)\n", _path.c_str(), errno);
+			space.allocated = std::numeric_limits<off_t>::max(); // the segment grows by appends
+			return;
 		}
-
-		TServerID serverID;
-		EIndexCMDType::EIndexCMDType cmd;
-		TSubLevelKey subLevelKey;
-		TItemKey itemKey;
-		ItemHeader itemHeader;
-		TItemSharedPtr item;
-	};
+		space.allocated = allocateTo;
+	}
 	
-	typedef std::vector<HeaderPacket> THeaderPacketVector;
-	THeaderPacketVector _headerPackets;
+	void _closeFile(File &file, FileSpace &space)
+	{
+		if (!file.descr())
+			return;
+		if (space.allocated > 0) { // the truncation to the written size drops the blocks after the end
+			if (ftruncate(file.descr(), space.end))
+				log::Warning::L("Can't trim %s (%d)\n", _path.c_str(), errno);
+		}
+		file.close();
+		bzero(&space, sizeof(space));
+	}
 	
-	void _syncPacketsToDisk(TDataPacketVector &dataPackets, THeaderPacketVector &headerPackets, Buffer &buf, 
-		const ItemHeader::TTime curTime)
+	// returns false while fdatasync is postponed till the period end or if it has failed
+	bool _flush(const bool force)
 	{
-		if (!dataPackets.empty() || !headerPackets.empty()) {
-			if (!_openFiles(curTime)) {
-				log::Fatal::L("Can't open files for %s synchronization\n", _path.c_str());
-				throw std::exception();
-			}
-			_syncDataPackets(dataPackets, buf, curTime);
-			_syncHeaderPackets(headerPackets, buf, curTime);
+		if (!_needFsync)
+			return true;
+		uint64_t curTime = _monotonicTime();
+		if (!force && ((curTime - _lastFsyncTime) < _index->fsyncPeriod()))
+			return false;
+		bool result = true;
+		if (_index->isUnifiedLog()) {
+			result = _index->syncReplicationLog();
+		} else if (IoRing::threadRing()) {
+			result = _submitWrites(true);
+		} else {
+			result = _fsync(_dataFile);
+			result = _fsync(_headerFile) && result;
 		}
+		if (!result) // the pages of a failed fdatasync are not retried, DURABLE writers get the error
+			_flushFailed = true;
+		_needFsync = false;
+		_lastFsyncTime = curTime;
+		return result;
 	}
 
 	
-	void _touch(HeaderPacket &headerPacket, TItemSharedPtr &item, const ItemHeader::TTime setTime, 
+	void _touch(Shard &shard, HeaderPacket &headerPacket, ItemSlot &item, const ItemHeader::TTime setTime, 
 		const ItemHeader::TTime curTime)
 	{
 		ItemHeader::TTime liveTo = setTime;
 		if (liveTo)
 			liveTo += curTime;
 		
-		const ItemHeader &itemHeader = item->header();
+		const ItemHeader &itemHeader = item.header();
 		if (abs(liveTo - itemHeader.liveTo) > (setTime * MIN_SYNC_TOUCH_TIME_PERCENT))
 		{
-			item->setLiveTo(liveTo, curTime);
+			const ItemHeader::TTime oldLiveTo = itemHeader.liveTo;
+			item.setLiveTo(liveTo, curTime);
+			_addExpiry(shard, headerPacket.subLevelKey, headerPacket.itemKey, liveTo, oldLiveTo);
 			headerPacket.itemHeader = itemHeader;
 			if (_index->isReplicating())
-				headerPacket.item = item;
-			_packetSync.lock();
-			_headerPackets.push_back(headerPacket);
-			_packetSync.unLock();
+				headerPacket.item = item.item();
+			if (_needPackets()) {
+				_packetSync.lock();
+				_headerPackets.push_back(headerPacket);
+				_packetSync.unLock();
+			}
 		}
 	}
 	
+	// memory-only levels need packets only to feed the replication log
+	const bool _needPackets() const
+	{
+		return !isMemoryOnly() || _index->isReplicating();
+	}
+	
+	// in the unified log mode the replication log is the only place where changes are written
+	const bool _isWritingFiles() const
+	{
+		return !isMemoryOnly() && !_index->isUnifiedLog();
+	}
 	
 	Mutex _diskLock;
+	bool _flushFailed; // a fdatasync has failed since the start of the sync, is guarded by _diskLock
+	// the unified log mode: keys and headers synced to the replication log since the last checkpoint, they are 
+	// guarded by _diskLock
+	TOrderedSubLevelIndex _changedKeys;
+	THeaderPacketVector _changedHeaders;
+	ItemHeader::TTime _lastFullPackTime; // of the merge in the unified log mode or of the checkpoint snapshot
+	
+	void _addChanges(const TDataPacketVector &dataPackets, const THeaderPacketVector &headerPackets)
+	{
+		if (!_index->isUnifiedLog() || isMemoryOnly())
+			return;
+		for (auto packet = dataPackets.begin(); packet != dataPackets.end(); packet++)
+			_changedKeys[packet->subLevelKey].insert(packet->itemKey);
+		for (auto packet = headerPackets.begin(); packet != headerPackets.end(); packet++) {
+			_changedHeaders.push_back(*packet);
+			_changedHeaders.back().item.reset(); // only the header is written to the checkpoint
+		}
+	}
 	File _dataFile;
+	TFileNumber _dataFileNumber; // 0 - locations of the written items are not tracked
 	File _headerFile;
+	// items written by the current sync, they get their locations when the writes have been submitted
+	struct WrittenItem
+	{
+		TItemSharedPtr item;
+		Item::TLocation location;
+	};
+	typedef std::vector<WrittenItem> TWrittenItemVector;
+	TWrittenItemVector _writtenItems;
 	bool _openFiles(const u_int32_t curTime)
 	{
 		if (!_dataFile.descr()) // not open
@@ -696,28 +1717,37 @@ private:
 			static u_int32_t openNumber = 0;
 			openNumber++;
 			BString fileName;
-			if (!_createDataFile(_path, curTime, openNumber, _md, _dataFile, fileName))
+			if (!_createDataFile(_path, curTime, openNumber, _md, _baseTime, _dataFile, fileName))
 				return false;
+			_startSpace(_dataSpace);
+			_dataFileNumber = 0;
+			if (_isTrackingLocations()) {
+				TFilePtr readFile;
+				_dataFileNumber = _addLocationFile(fileName.c_str(), readFile);
+			}
 		}
 		if (!_headerFile.descr())
 		{
 			static u_int32_t openNumber = 0;
 			openNumber++;
-			if (!_createHeaderFile(_path, curTime, openNumber, _md, _headerFile))
+			if (!_createHeaderFile(_path, curTime, openNumber, _md, _baseTime, _headerFile))
 				return false;
+			_startSpace(_headerSpace);
 		}
 		return true;
 	}
 	void _closeFiles()
 	{
-		_dataFile.close();
-		_headerFile.close();
+		_flush(true);
+		_closeFile(_dataFile, _dataSpace);
+		_closeFile(_headerFile, _headerSpace);
 	}
 
 	void _addReplicationPacketHeader(Buffer &buf)
 	{
 		buf.addSpace(sizeof(ReplicationPacketHeader));
 		buf.add(_level);
+		buf.add(_baseTime);
 	}
 	
 	void _saveReplicationPacket(Buffer &buf, const TServerID curServerID)
@@ -729,22 +1759,32 @@ private:
 		_index->addToReplicationLog(buf);
 	}
 	
+	// the packet header is at the buffer start, iov[0] points to it
+	void _saveReplicationPacket(Buffer &buf, TIoVector &iov, const size_t packetSize, const TServerID curServerID)
+	{
+		ReplicationPacketHeader &rph = (*(ReplicationPacketHeader*)buf.mapBuffer(sizeof(ReplicationPacketHeader)));
+		rph.md = _md;
+		rph.packetSize = packetSize - sizeof(ReplicationPacketHeader);
+		rph.serverID = curServerID;
+		_index->addToReplicationLog(&iov[0], iov.size(), packetSize);
+	}
+	
 	
 	void _syncHeaderPackets(THeaderPacketVector &headerPackets, Buffer &buf, const ItemHeader::TTime curTime)
 	{
 		buf.clear();
-		for (auto packet = headerPackets.begin(); packet != headerPackets.end(); ) {
-			_addEntryHeader(packet->cmd, packet->itemHeader, packet->subLevelKey, packet->itemKey, buf);
+		if (_isWritingFiles()) {
+			for (auto packet = headerPackets.begin(); packet != headerPackets.end(); ) {
+				const Buffer::TSize recordStart = buf.writtenSize();
+				_addEntryHeader(packet->cmd, packet->itemHeader, packet->subLevelKey, packet->itemKey, buf);
+				_addCheckSum(buf, recordStart);
 			
-			packet++;
-			if ((buf.writtenSize() > MAX_BUF_SIZE) || (packet == headerPackets.end())) {
-				if (!buf.empty()) {
-					ssize_t needWrite = buf.writtenSize();
-					if (_headerFile.write(buf.begin(), needWrite) != needWrite) { // skip 
-						log::Fatal::L("Can't sync %s\n", _path.c_str());
-						throw std::exception();
-					};
-					buf.clear();
+				packet++;
+				if ((buf.writtenSize() > MAX_BUF_SIZE) || (packet == headerPackets.end())) {
+					if (!buf.empty()) {
+						_writeFile(_headerFile, _headerSpace, buf.begin(), buf.writtenSize());
+						buf.clear();
+					}
 				}
 			}
 		}
@@ -760,9 +1800,15 @@ private:
 				if (packet->cmd == EIndexCMDType::REMOVE)
 					packet->itemHeader.size = 0;
 				
+				const Buffer::TSize recordStart = buf.writtenSize();
 				_addEntryHeader(packet->cmd, packet->itemHeader, packet->subLevelKey, packet->itemKey, buf);
-				if (packet->itemHeader.size > 0) // full data need
-					buf.add(packet->item->data(), packet->itemHeader.size);
+				if (packet->itemHeader.size > 0) { // full data need
+					if (!packet->item->read(buf.reserveBuffer(packet->itemHeader.size))) {
+						log::Fatal::L("Can't read item data to replicate %s\n", _path.c_str());
+						throw std::exception();
+					}
+				}
+				_addCheckSum(buf, recordStart);
 				
 				packet++;
 				if ((buf.writtenSize() > MAX_BUF_SIZE) || (packet == headerPackets.end()) ||
@@ -775,8 +1821,6 @@ private:
 				}
 			}
 		}
-		if (_headerFile.seek(0, SEEK_CUR) > static_cast<off_t>(MAX_FILE_SIZE))
-			_headerFile.close();
 	}
 	
 	bool _loadHeaderData(const char *path, Buffer &buf, const ItemHeader::TTime curTime, 
@@ -793,28 +1837,42 @@ private:
 			log::Error::L("Can't read data file %s\n", path);
 			return false;
 		}
+		_releasePreallocated(path, fd, fileSize);
 		
+		Buffer::TSize recordStart = 0;
 		try
 		{
 			MetaData md;
-			buf.get(&md, sizeof(md));
+			_getMetaData(buf, md);
 			if ((md.itemKeyType != _md.itemKeyType) || (md.subLevelKeyType != _md.subLevelKeyType)) {
 				log::Error::L("Sublevel/KeyType mismatch %s (%u/%u | %u/%u)\n", path, md.subLevelKeyType, _md.subLevelKeyType,
 					md.subLevelKeyType, _md.subLevelKeyType);
 				return false;
 
 			}
+			const ItemHeader::TTime baseTime = _getBaseTime(buf, md.version);
 			EIndexCMDType::EIndexCMDType cmd;
 			ItemHeader itemHeader;
 			TSubLevelKey subLevelKey;
 			TItemKey itemKey;
 			HeaderCMDData headerCMDData;
-			static THeaderCMDDataHash emptySubLevelIndex;
-			while (!buf.isEnded()) {
-				_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, buf);
-				if ((cmd != EIndexCMDType::TOUCH) && (cmd != EIndexCMDType::REMOVE)) {
-					log::Error::L("Bad cmd type %u in header\n", cmd);
-					return false;
+			static SubLevelHeaderCMD emptySubLevelIndex;
+			const Buffer::TSize checkSumSize = _checkSumSize(md.version);
+			for (; !buf.isEnded(); buf.skip(checkSumSize)) {
+				recordStart = buf.readPos();
+				_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, buf, md.version, baseTime);
+				if (checkSumSize && !_isValidRecord(buf, recordStart, 0)) // headers are written without data
+					return _cutTornTail(path, recordStart, fileSize);
+				if ((cmd != EIndexCMDType::TOUCH) && (cmd != EIndexCMDType::REMOVE) && 
+					(cmd != EIndexCMDType::REMOVE_SUBLEVEL)) { // the record has its fixed size without data
+					log::Error::L("Bad cmd type %u at %u of %s, the record is skipped\n", cmd, recordStart, path);
+					continue;
+				}
+				if (cmd == EIndexCMDType::REMOVE_SUBLEVEL) {
+					auto subLevelRes = removeTouchIndex.emplace(subLevelKey, emptySubLevelIndex);
+					if (itemHeader.timeTag.tag > subLevelRes.first->second.removedTag)
+						subLevelRes.first->second.removedTag = itemHeader.timeTag.tag;
+					continue;
 				}
 				if (cmd == EIndexCMDType::REMOVE)
 					headerCMDData.liveTo = REMOVED_LIVE_TO;
@@ -822,7 +1880,7 @@ private:
 					headerCMDData.liveTo = itemHeader.liveTo;
 				headerCMDData.tag = itemHeader.timeTag;
 				auto subLevelRes = removeTouchIndex.emplace(subLevelKey, emptySubLevelIndex);
-				auto itemRes = subLevelRes.first->second.equal_range(itemKey);
+				auto itemRes = subLevelRes.first->second.items.equal_range(itemKey);
 				
 				bool needAdd = true;
 				if (cmd == EIndexCMDType::REMOVE)	{
@@ -854,49 +1912,154 @@ private:
 					}
 				}
 				if (needAdd)
-					subLevelRes.first->second.emplace(itemKey, headerCMDData);
+					subLevelRes.first->second.items.emplace(itemKey, headerCMDData);
 			}
 
 		}
 		catch (Buffer::Error &er)
 		{
-			log::Fatal::L("Catch error in data file %s\n", path);
-			return false;
+			if (!recordStart) { // the meta data is broken
+				log::Fatal::L("Catch error in data file %s\n", path);
+				return false;
+			}
+			return _cutTornTail(path, recordStart, fileSize);
 		}
 		return true;
 	}
 
-	// two mirror functions
+	// two mirror functions, entries are always written in the current format with the base time of this instance
 	void _addEntryHeader(EIndexCMDType::EIndexCMDType cmd, const ItemHeader &itemHeader, const TSubLevelKey &subLevelKey, 
 		const TItemKey &itemKey, Buffer &buf)
 	{
 		buf.add(cmd);
-		buf.add(&itemHeader, sizeof(itemHeader));
-		buf.add(subLevelKey);
-		buf.add(itemKey);
+		_addVarInt(buf, itemHeader.size);
+		_addVarInt(buf, _zigZag(static_cast<int64_t>(itemHeader.timeTag._time) - _baseTime));
+		_addVarInt(buf, itemHeader.timeTag._opNumber);
+		if (itemHeader.liveTo) // 0 - forever
+			_addVarInt(buf, _zigZag(static_cast<int64_t>(itemHeader.liveTo) - itemHeader.timeTag._time) + 1);
+		else
+			_addVarInt(buf, 0);
+		_addKey(buf, subLevelKey);
+		_addKey(buf, itemKey);
 	}
 	
 	void _getEntryHeader(EIndexCMDType::EIndexCMDType &cmd, ItemHeader &itemHeader, TSubLevelKey &subLevelKey, 
-		TItemKey &itemKey, Buffer &buf)
+		TItemKey &itemKey, Buffer &buf, const TVersion version, const ItemHeader::TTime baseTime)
 	{
 		buf.get(cmd);
-		buf.get(&itemHeader, sizeof(itemHeader));
-		buf.get(subLevelKey);
-		buf.get(itemKey);
+		if (version < RECORDS_VERSION) {
+			buf.get(&itemHeader, sizeof(itemHeader));
+			buf.get(subLevelKey);
+			buf.get(itemKey);
+			return;
+		}
+		itemHeader.size = _getVarInt(buf);
+		itemHeader.timeTag._time = baseTime + _unZigZag(_getVarInt(buf));
+		itemHeader.timeTag._opNumber = _getVarInt(buf);
+		const uint64_t liveTo = _getVarInt(buf);
+		itemHeader.liveTo = liveTo ? (itemHeader.timeTag._time + _unZigZag(liveTo - 1)) : 0;
+		_getKey(buf, subLevelKey);
+		_getKey(buf, itemKey);
+	}
+	
+	// times can be before the base, so their deltas are signed
+	static uint64_t _zigZag(const int64_t value)
+	{
+		return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+	}
+	static int64_t _unZigZag(const uint64_t value)
+	{
+		return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+	}
+	
+	// integer keys are varints, strings are prefixed with their varint length
+	static void _addKey(Buffer &buf, const uint32_t key)
+	{
+		_addVarInt(buf, key);
+	}
+	static void _addKey(Buffer &buf, const uint64_t key)
+	{
+		_addVarInt(buf, key);
+	}
+	static void _addKey(Buffer &buf, const BinKey128 &key)
+	{
+		buf.add(key);
+	}
+	static void _addKey(Buffer &buf, const std::string &key)
+	{
+		_addVarInt(buf, key.size());
+		buf.add(key.data(), key.size());
+	}
+	static void _getKey(Buffer &buf, uint32_t &key)
+	{
+		key = _getVarInt(buf);
+	}
+	static void _getKey(Buffer &buf, uint64_t &key)
+	{
+		key = _getVarInt(buf);
+	}
+	static void _getKey(Buffer &buf, BinKey128 &key)
+	{
+		buf.get(key);
+	}
+	static void _getKey(Buffer &buf, std::string &key)
+	{
+		const Buffer::TSize size = _getVarInt(buf);
+		key.assign(static_cast<const char*>(buf.mapBuffer(size)), size);
+	}
+	
+	// records of RECORDS_VERSION files and packets end with CRC32C of the entry header and the item data. The sizes 
+	// of a bad record can't be trusted to find the next one, so a file is read up to its first bad record: a crash 
+	// tears only the last writes, and with several writes in flight the records after a lost one were not confirmed
+	typedef uint32_t TCheckSum;
+	static const Buffer::TSize _checkSumSize(const TVersion version)
+	{
+		return (version >= RECORDS_VERSION) ? sizeof(TCheckSum) : 0;
+	}
+	
+	static void _addCheckSum(Buffer &buf, const Buffer::TSize recordStart)
+	{
+		TCheckSum checkSum = CRC32C::calc(buf.begin() + recordStart, buf.writtenSize() - recordStart);
+		buf.add(checkSum);
+	}
+	
+	// the entry header has been read, the record goes on with dataSize bytes and its checksum
+	static bool _isValidRecord(Buffer &buf, const Buffer::TSize recordStart, const ItemHeader::TSize dataSize)
+	{
+		const Buffer::TSize recordEnd = buf.readPos() + dataSize;
+		if ((recordEnd < buf.readPos()) || ((recordEnd + sizeof(TCheckSum)) > buf.writtenSize()))
+			return false;
+		TCheckSum checkSum;
+		memcpy(&checkSum, buf.begin() + recordEnd, sizeof(checkSum));
+		return checkSum == CRC32C::calc(buf.begin() + recordStart, recordEnd - recordStart);
+	}
+	
+	// a file is cut after its last valid record, so the next load does not stop on the same tail and the level is 
+	// loaded even if the file can't be truncated
+	bool _cutTornTail(const char *path, const off_t validSize, const off_t fileSize)
+	{
+		log::Warning::L("File %s is torn at %lld, the rest of it (%lld bytes) is truncated\n", path, 
+			(long long)validSize, (long long)(fileSize - validSize));
+		if (truncate(path, validSize))
+			log::Error::L("Can't truncate %s (%d)\n", path, errno);
+		return true;
 	}
 
-	bool _loadDataEntryHeader(Buffer &buf, ItemHeader &itemHeader, TSubLevelKey &subLevelKey, TItemKey &itemKey, 
-		THeaderCMDIndexHash &removeTouchIndex)
+	// returns true if the header is changed by the loaded header commands, records of other types throw
+	bool _applyHeaderCMDs(const EIndexCMDType::EIndexCMDType cmd, ItemHeader &itemHeader, 
+		const TSubLevelKey &subLevelKey, const TItemKey &itemKey, THeaderCMDIndexHash &removeTouchIndex)
 	{
-		EIndexCMDType::EIndexCMDType cmd;
-		_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, buf);
 		if (cmd != EIndexCMDType::PUT) {
 			log::Error::L("Bad cmd type %u in data\n", cmd);
 			throw std::exception();
 		}
 		auto f = removeTouchIndex.find(subLevelKey);
 		if (f != removeTouchIndex.end()) {
-			auto itemRes = f->second.equal_range(itemKey);
+			if (itemHeader.timeTag.tag < f->second.removedTag) { // the sublevel has been removed later
+				itemHeader.liveTo = REMOVED_LIVE_TO;
+				return true;
+			}
+			auto itemRes = f->second.items.equal_range(itemKey);
 			for (auto it = itemRes.first; it != itemRes.second; ++it)
 			{			
 				if (it->second.tag.tag >= itemHeader.timeTag.tag) {
@@ -909,10 +2072,24 @@ private:
 		return false;  // not changed
 	}
 	
+	static void _addBufferPart(TWritePartVector &parts, Buffer::TSize &partStart, const Buffer::TSize end)
+	{
+		if (end > partStart) {
+			WritePart part = {NULL, partStart, end - partStart};
+			parts.push_back(part);
+		}
+		partStart = end;
+	}
+	
 	void _syncDataPackets(TDataPacketVector &workPackets, Buffer &buf, const ItemHeader::TTime curTime)
 	{
 		Buffer::TSize replicationHeaderEnd = 0;
 		TServerID curServerID = 0;
+		TWritePartVector parts;
+		Buffer::TSize partStart = 0;
+		size_t itemsSize = 0; // of the parts which point to items' data
+		TIoVector iov;
+		size_t batchStart = _writtenItems.size();
 		buf.clear();
 		for (auto dataPacket = workPackets.begin(); dataPacket != workPackets.end(); ) {
 			if (dataPacket->item->isValid(curTime)) {
@@ -920,85 +2097,546 @@ private:
 					if (buf.empty())	{
 						_addReplicationPacketHeader(buf);
 						replicationHeaderEnd = buf.writtenSize();
+						partStart = replicationHeaderEnd;
 						curServerID = dataPacket->serverID;
 					}
 				}
 				const ItemHeader &itemHeader = dataPacket->item->header();
+				const Buffer::TSize recordStart = buf.writtenSize();
 				_addEntryHeader(EIndexCMDType::PUT, itemHeader, dataPacket->subLevelKey, dataPacket->itemKey, buf);
-				buf.add(dataPacket->item->data(), itemHeader.size);
+				if (_dataFileNumber) { // the position in the written batch till it is written
+					WrittenItem written = {dataPacket->item, buf.writtenSize() - replicationHeaderEnd + itemsSize};
+					_writtenItems.push_back(written);
+				}
+				if (itemHeader.size < MIN_ZERO_COPY_SIZE) {
+					buf.add(dataPacket->item->data(), itemHeader.size);
+					_addCheckSum(buf, recordStart);
+				} else {
+					TCheckSum checkSum = CRC32C::extend(CRC32C::calc(buf.begin() + recordStart, 
+						buf.writtenSize() - recordStart), dataPacket->item->data(), itemHeader.size);
+					_addBufferPart(parts, partStart, buf.writtenSize());
+					WritePart part = {dataPacket->item->data(), 0, itemHeader.size};
+					parts.push_back(part);
+					itemsSize += itemHeader.size;
+					buf.add(checkSum); // starts the next part of the buffer
+				}
 			}
 			dataPacket++;
-			if ((buf.writtenSize() > MAX_BUF_SIZE) || (dataPacket == workPackets.end()) ||
-				(curServerID && (curServerID != dataPacket->serverID))
+			if (((buf.writtenSize() + itemsSize) > MAX_BUF_SIZE) || (parts.size() >= MAX_WRITE_PARTS) || 
+				(dataPacket == workPackets.end()) || (curServerID && (curServerID != dataPacket->serverID))
 			) {
 				if (!buf.empty()) {
-					ssize_t needWrite = buf.writtenSize() - replicationHeaderEnd;
-					if (_dataFile.write(buf.begin() + replicationHeaderEnd,  needWrite) != needWrite) { // skip 
-						log::Fatal::L("Can't sync %s\n", _path.c_str());
-						throw std::exception();
-					};
+					_addBufferPart(parts, partStart, buf.writtenSize());
+					iov.clear();
+					if (replicationHeaderEnd > 0) {
+						struct iovec header = {buf.begin(), replicationHeaderEnd};
+						iov.push_back(header);
+					}
+					size_t writeSize = 0;
+					for (auto part = parts.begin(); part != parts.end(); part++) {
+						struct iovec vec = {part->data ? const_cast<void*>(part->data) : buf.begin() + part->pos, part->size};
+						iov.push_back(vec);
+						writeSize += part->size;
+					}
+					if (_isWritingFiles()) {
+						const off_t batchOffset = _dataSpace.end;
+						_writeFile(_dataFile, _dataSpace, parts, &iov[replicationHeaderEnd > 0 ? 1 : 0], writeSize);
+						for (auto written = _writtenItems.begin() + batchStart; written != _writtenItems.end(); written++)
+							written->location = _location(_dataFileNumber, batchOffset + written->location);
+						batchStart = _writtenItems.size();
+					}
 					if (replicationHeaderEnd > 0)
-						_saveReplicationPacket(buf, curServerID);
+						_saveReplicationPacket(buf, iov, replicationHeaderEnd + writeSize, curServerID);
 					buf.clear();
+					parts.clear();
+					partStart = 0;
+					itemsSize = 0;
 				}
 			}
 		}
-		if (_dataFile.seek(0, SEEK_CUR) > static_cast<off_t>(MAX_FILE_SIZE))
-			_dataFile.close();
 	}
 	
 	bool _loadData(const char *path, Buffer &buf, const ItemHeader::TTime curTime, THeaderCMDIndexHash &removeTouchIndex)
 	{
-		File fd;
-		if (!fd.open(path, O_RDONLY))	{
+		TFilePtr fd(new File());
+		if (!fd->open(path, O_RDONLY))	{
 			log::Error::L("Can't open level data file %s\n", path);
 			return false;
 		}
 		buf.clear();
-		ssize_t fileSize = fd.fileSize();
-		if (fd.read(buf.reserveBuffer(fileSize), fileSize) != fileSize)	{
+		ssize_t fileSize = fd->fileSize();
+		if (fd->read(buf.reserveBuffer(fileSize), fileSize) != fileSize)	{
 			log::Error::L("Can't read data file %s\n", path);
 			return false;
 		}
+		_releasePreallocated(path, *fd, fileSize);
+		const TFileNumber fileNumber = _isTrackingLocations() ? _addLocationFile(fd) : 0;
 		
+		Buffer::TSize recordStart = 0;
 		try
 		{
 			MetaData md;
-			buf.get(&md, sizeof(md));
+			_getMetaData(buf, md);
 			if (md != _md) {
 				log::Error::L("Sublevel/KeyType mismatch %s (%u/%u | %u/%u)\n", path, md.subLevelKeyType, _md.subLevelKeyType,
 					md.subLevelKeyType, _md.subLevelKeyType);
 				return false;
 			}
+			const ItemHeader::TTime baseTime = _getBaseTime(buf, md.version);
 			ItemHeader itemHeader;
 			TSubLevelKey subLevelKey;
 			TItemKey itemKey;
-			while (!buf.isEnded()) {
-				_loadDataEntryHeader(buf, itemHeader, subLevelKey, itemKey, removeTouchIndex);
+			EIndexCMDType::EIndexCMDType cmd;
+			const Buffer::TSize checkSumSize = _checkSumSize(md.version);
+			for (; !buf.isEnded(); buf.skip(checkSumSize)) {
+				recordStart = buf.readPos();
+				_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, buf, md.version, baseTime);
+				if (checkSumSize) { // the size of a valid record is known even if its type is not
+					if (!_isValidRecord(buf, recordStart, itemHeader.size))
+						return _cutTornTail(path, recordStart, fileSize);
+					if (cmd != EIndexCMDType::PUT) {
+						log::Error::L("Bad cmd type %u at %u of %s, the record is skipped\n", cmd, recordStart, path);
+						buf.skip(itemHeader.size);
+						continue;
+					}
+				}
+				_applyHeaderCMDs(cmd, itemHeader, subLevelKey, itemKey, removeTouchIndex);
 				if (!itemHeader.liveTo || (itemHeader.liveTo > curTime))
 				{
-					_put(subLevelKey, itemKey, itemHeader, (char*)buf.mapBuffer(itemHeader.size));
+					// keep only headers in memory, data will be read on demand, small items are kept in their slots
+					if (_index->coldTime() && (itemHeader.size > Item::INLINE_DATA_SIZE)) {
+						_put(subLevelKey, itemKey, itemHeader, fd, buf.readPos(), _location(fileNumber, buf.readPos()));
+						buf.skip(itemHeader.size);
+					}
+					else
+						_put(subLevelKey, itemKey, itemHeader, (char*)buf.mapBuffer(itemHeader.size));
+				}
+				else
+					buf.skip(itemHeader.size);
+			}
+
+		}
+		catch (Buffer::Error &er) // a record runs past the end of the file
+		{
+			if (!recordStart) {
+				log::Fatal::L("Catch error in data file %s\n", path);
+				return false;
+			}
+			return _cutTornTail(path, recordStart, fileSize);
+		}
+		catch (std::exception &er)
+		{
+			log::Fatal::L("Catch std::exception in data file %s at %u\n", path, recordStart);
+			return false;
+		}
+		return true;
+	}
+
+	// records of packing and checkpoints go to the temporary files in the order they are added, items whose records 
+	// are tracked are bound to their new locations as soon as the records have been written
+	struct PackedRecord
+	{
+		TSubLevelKey subLevelKey;
+		TItemKey itemKey;
+		u_int64_t tag;
+		off_t dataPos; // in the output stream
+	};
+	typedef std::vector<PackedRecord> TPackedRecordVector;
+	struct PackedOutput : public PackedFile
+	{
+		PackedOutput(const u_int32_t curTime, const bool trackLocations)
+			: writeBuffer(MAX_BUF_SIZE * 1.1), streamPos(0), curTime(curTime), trackLocations(trackLocations)
+		{
+		}
+		Buffer writeBuffer;
+		off_t streamPos; // of the write buffer start
+		TPackedRecordVector records; // have not been written yet
+		const u_int32_t curTime;
+		const bool trackLocations;
+	};
+	
+	// the maintenance packs a level by steps, the files listed at the start of the pack are merged file by file 
+	// while the budget of bytes lasts and the state is kept till the next step
+	struct PackState
+	{
+		PackState(const u_int32_t startTime, const bool trackLocations)
+			: nextDataFile(0), packed(startTime, trackLocations)
+		{
+		}
+		TPathVector headersFileList;
+		TPathVector dataFileList;
+		size_t nextDataFile;
+		THeaderCMDIndexHash removeTouchIndex;
+		TPathVector packedFileList;
+		PackedOutput packed; // is named by the start time, so the files written meanwhile are loaded after it
+	};
+	Mutex _packSync;
+	std::unique_ptr<PackState> _packState; // is guarded by _packSync
+	
+	static void _spendBudget(size_t &budget, const char *path)
+	{
+		struct stat st;
+		const size_t size = stat(path, &st) ? 0 : st.st_size;
+		budget -= std::min(budget, size);
+	}
+	
+	// returns true when the pack has finished, result is false then if it has failed
+	bool _packStep(Buffer &buf, const ItemHeader::TTime curTime, size_t &budget, bool &result)
+	{
+		result = true;
+		if (!_packState && !_startPack(buf, curTime, budget, result))
+			return true;
+		PackState &state = *_packState;
+		for (; state.nextDataFile < state.dataFileList.size(); state.nextDataFile++) {
+			if (!budget)
+				return false;
+			const char *path = state.dataFileList[state.nextDataFile].c_str();
+			_spendBudget(budget, path);
+			try
+			{
+				if (!_packDataFile(path, buf, state.packed, state.removeTouchIndex, state.packedFileList)) {
+					result = false;
+					break;
+				}
+			}
+			catch (...)
+			{
+				log::Error::L("Caught exception while packing level %s\n", _path.c_str());
+				result = false;
+				break;
+			}
+		}
+		result = _finishPack(state, result);
+		_packState.reset();
+		return true;
+	}
+	
+	// returns false if there are no files to merge or on an error
+	bool _startPack(Buffer &buf, const ItemHeader::TTime curTime, size_t &budget, bool &result)
+	{
+		if (isMemoryOnly())
+			return false;
+		const bool isFullPackTime = 
+			(curTime >= (_lastFullPackTime + static_cast<ItemHeader::TTime>(_index->checkpointPeriod()) * 3600));
+		if (_index->isUnifiedLog()) { // changes are checkpointed every hour, the files are merged once a period
+			if (!_checkpointChanges(buf, curTime)) {
+				result = false;
+				return false;
+			}
+			if (!isFullPackTime)
+				return false;
+			_lastFullPackTime = curTime;
+		} else if (_index->isCheckpointPack()) { // files written since the last snapshot are loaded after it
+			if (!isFullPackTime)
+				return false;
+			result = _checkpoint(curTime);
+			if (result)
+				_lastFullPackTime = curTime;
+			return false;
+		}
+		std::unique_ptr<PackState> state(new PackState(curTime, _isTrackingLocations()));
+		AutoMutex autoSync(&_diskLock);
+		_closeFiles();
+		if (!_loadFileList(_path, state->headersFileList, state->dataFileList)) {
+			result = false;
+			return false;
+		}
+		_diskLock.unLock();
+
+		for (auto headerFile = state->headersFileList.begin(); headerFile != state->headersFileList.end(); 
+			headerFile++) {
+			_spendBudget(budget, headerFile->c_str());
+			if (!_loadHeaderData(headerFile->c_str(), buf, curTime, state->removeTouchIndex)) {
+				result = false;
+				return false;
+			}
+		}
+		_packState = std::move(state);
+		return true;
+	}
+	
+	bool _finishPack(PackState &state, bool result)
+	{
+		PackedOutput &packed = state.packed;
+		if (_isFsynced() && !_fsync(packed.file)) // packed files replace already synced ones
+			result = false;
+		packed.file.close();
+		if (result) {
+			try
+			{
+				_renameTempToWork(packed.createdFiles, packed.curTime);
+			}
+			catch (...)
+			{
+				_unlink(packed.createdFiles);
+				return false;
+			}
+			_unlink(state.headersFileList);
+			_unlink(state.packedFileList);
+			return true;
+		}	else {
+			_unlink(packed.createdFiles);
+			return false;
+		}
+	}
+	
+	static off_t _packedPos(PackedOutput &packed)
+	{
+		return packed.streamPos + packed.writeBuffer.writtenSize();
+	}
+	
+	static void _trackPackedRecord(PackedOutput &packed, const TSubLevelKey &subLevelKey, const TItemKey &itemKey, 
+		const ItemHeader &itemHeader, const off_t dataPos)
+	{
+		if (packed.trackLocations) {
+			PackedRecord record = {subLevelKey, itemKey, itemHeader.timeTag.tag, dataPos};
+			packed.records.push_back(record);
+		}
+	}
+	
+	// adds the entry header of a record, the data is added by the caller and the record is closed by _endPackedRecord
+	Buffer::TSize _startPackedRecord(PackedOutput &packed, const TSubLevelKey &subLevelKey, const TItemKey &itemKey, 
+		const ItemHeader &itemHeader)
+	{
+		const Buffer::TSize recordStart = packed.writeBuffer.writtenSize();
+		_addEntryHeader(EIndexCMDType::PUT, itemHeader, subLevelKey, itemKey, packed.writeBuffer);
+		_trackPackedRecord(packed, subLevelKey, itemKey, itemHeader, _packedPos(packed));
+		return recordStart;
+	}
+	
+	void _endPackedRecord(PackedOutput &packed, const Buffer::TSize recordStart)
+	{
+		_addCheckSum(packed.writeBuffer, recordStart);
+		if (packed.writeBuffer.writtenSize() > MAX_BUF_SIZE)
+			_flushPacked(packed);
+	}
+	
+	// copies unchanged records of a packed file, their locations are tracked while they are read
+	void _addPackedRange(PackedOutput &packed, Buffer &buf, const Buffer::TSize startPos, const Buffer::TSize endPos)
+	{
+		const Buffer::TSize size = endPos - startPos;
+		if (size == 0)
+			return;
+		if (size > (MAX_BUF_SIZE / 2)) { // write directly to file
+			_flushPacked(packed);
+			_writePacked(packed, buf.begin() + startPos, size);
+		} else {
+			packed.writeBuffer.add(buf.begin() + startPos, size);
+			if (packed.writeBuffer.writtenSize() > MAX_BUF_SIZE)
+				_flushPacked(packed);
+		}
+	}
+	
+	void _flushPacked(PackedOutput &packed)
+	{
+		if (packed.writeBuffer.empty())
+			return;
+		_writePacked(packed, packed.writeBuffer.begin(), packed.writeBuffer.writtenSize());
+		packed.writeBuffer.clear();
+	}
+	
+	void _writePacked(PackedOutput &packed, const Buffer::TDataPtr data, const Buffer::TSize size)
+	{
+		const off_t offset = _syncToFile(data, size, packed, packed.curTime);
+		const off_t streamEnd = packed.streamPos + size;
+		size_t bound = 0;
+		for (; (bound < packed.records.size()) && (packed.records[bound].dataPos < streamEnd); bound++) {
+			if (packed.number)
+				_bindPackedRecord(packed, packed.records[bound], offset + packed.records[bound].dataPos - packed.streamPos);
+		}
+		packed.records.erase(packed.records.begin(), packed.records.begin() + bound);
+		packed.streamPos = streamEnd;
+	}
+	
+	// the item is moved to the new location if it has not been changed since the record was read
+	void _bindPackedRecord(PackedOutput &packed, const PackedRecord &record, const off_t offset)
+	{
+		Shard &shard = _shard(record.subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(record.subLevelKey);
+		if (subLevel == shard.subLevelItem.end())
+			return;
+		auto sliceID = _findSlice(record.itemKey);
+		auto item = subLevel->second[sliceID].find(record.itemKey);
+		if ((item == subLevel->second[sliceID].end()) || (item->second.header().timeTag.tag != record.tag))
+			return;
+		Item *curItem = item->second.get();
+		if (!curItem) // inline items are not moved to the cold tier
+			return;
+		const Item::TLocation location = _location(packed.number, offset);
+		if (curItem->isCold()) { // releases the file which is replaced
+			Item *coldItem = Item::createCold(curItem->header(), packed.readFile, offset);
+			coldItem->setAccessTime(curItem->accessTime());
+			coldItem->setLocation(location);
+			item->second.reset(coldItem);
+		} else
+			curItem->setLocation(location);
+	}
+
+	// live items are written to new data files instead of packing the old ones, changes made after the checkpoint 
+	// has started are loaded from the files opened after it
+	bool _checkpoint(const ItemHeader::TTime curTime)
+	{
+		AutoMutex autoSync(&_diskLock);
+		_closeFiles(); // the next syncs go to new files which are kept
+		TPathVector headersFileList;
+		TPathVector dataFileList;
+		if (!_loadFileList(_path, headersFileList, dataFileList))
+			return false;
+		_diskLock.unLock();
+		
+		PackedOutput packed(curTime, _isTrackingLocations());
+		try
+		{
+			for (size_t i = 0; i < _shardsCount; i++)
+				_checkpointShard(_shards[i], packed);
+			_flushPacked(packed);
+			if (!_fsync(packed.file))
+				throw std::exception();
+			packed.file.close();
+			_renameTempToWork(packed.createdFiles, curTime);
+		}
+		catch (...)
+		{
+			log::Error::L("Caught exception while making checkpoint of level %s\n", _path.c_str());
+			packed.file.close();
+			_unlink(packed.createdFiles);
+			return false;
+		}
+		_unlink(headersFileList);
+		_unlink(dataFileList);
+		return true;
+	}
+	
+	void _checkpointShard(Shard &shard, PackedOutput &packed)
+	{
+		TDataPacketVector items;
+		AutoMutex autoSync(&shard.sync);
+		for (auto subLevel = shard.subLevelItem.begin(); subLevel != shard.subLevelItem.end(); subLevel++) {
+			for (auto slice = subLevel->second.begin(); slice != subLevel->second.end(); slice++) {
+				for (auto item = slice->begin(); item != slice->end(); item++) {
+					if (!item->second.isValid(packed.curTime))
+						continue;
+					DataPacket dataPacket(0);
+					dataPacket.subLevelKey = subLevel->first;
+					dataPacket.itemKey = item->first;
+					dataPacket.item = item->second.item();
+					items.push_back(dataPacket);
 				}
-				else
-					buf.skip(itemHeader.size);
 			}
-
 		}
-		catch (Buffer::Error &er)
+		autoSync.unLock();
+		_writePackedItems(items, packed);
+	}
+	
+	void _writePackedItems(TDataPacketVector &items, PackedOutput &packed)
+	{
+		for (auto packet = items.begin(); packet != items.end(); packet++) {
+			ItemHeader itemHeader = packet->item->header();
+			const Buffer::TSize recordStart = _startPackedRecord(packed, packet->subLevelKey, packet->itemKey, itemHeader);
+			if (!packet->item->read(packed.writeBuffer.reserveBuffer(itemHeader.size))) {
+				log::Error::L("Can't read item data to checkpoint %s\n", _path.c_str());
+				throw std::exception();
+			}
+			_endPackedRecord(packed, recordStart);
+		}
+	}
+	
+	// the unified log mode: current versions of the items changed since the last checkpoint are written to a new data 
+	// file and the synced removes and touches to a header file, older replication logs are not replayed after it
+	bool _checkpointChanges(Buffer &buf, const ItemHeader::TTime curTime)
+	{
+		AutoMutex autoSync(&_diskLock);
+		const TReplicationLogNumber checkpointNumber = _index->replicationLogNumber();
+		TOrderedSubLevelIndex changedKeys;
+		std::swap(changedKeys, _changedKeys);
+		THeaderPacketVector changedHeaders;
+		std::swap(changedHeaders, _changedHeaders);
+		autoSync.unLock();
+		if (changedKeys.empty() && changedHeaders.empty() && (checkpointNumber == _checkpointNumber))
+			return true;
+		
+		PackedOutput packed(curTime, _isTrackingLocations());
+		try
 		{
-			log::Fatal::L("Catch error in data file %s\n", path);
-			return false;
+			for (auto subLevel = changedKeys.begin(); subLevel != changedKeys.end(); subLevel++)
+				_checkpointKeys(subLevel->first, subLevel->second, packed);
+			_flushPacked(packed);
+			if (!_fsync(packed.file))
+				throw std::exception();
+			packed.file.close();
+			_writeCheckpointHeaders(changedHeaders, buf, curTime);
+			_renameTempToWork(packed.createdFiles, curTime);
+			_saveCheckpoint(checkpointNumber);
 		}
-		catch (std::exception &er)
+		catch (...)
 		{
-			log::Fatal::L("Catch std::exception in data file %s\n", path);
+			log::Error::L("Caught exception while making checkpoint of level %s\n", _path.c_str());
+			packed.file.close();
+			_unlink(packed.createdFiles);
+			autoSync.lock(&_diskLock); // the changes go to the next checkpoint
+			for (auto subLevel = changedKeys.begin(); subLevel != changedKeys.end(); subLevel++)
+				_changedKeys[subLevel->first].insert(subLevel->second.begin(), subLevel->second.end());
+			_changedHeaders.insert(_changedHeaders.begin(), changedHeaders.begin(), changedHeaders.end());
 			return false;
 		}
 		return true;
 	}
+	
+	void _checkpointKeys(const TSubLevelKey &subLevelKey, const TOrderedKeys &keys, PackedOutput &packed)
+	{
+		TDataPacketVector items;
+		Shard &shard = _shard(subLevelKey);
+		AutoMutex autoSync(&shard.sync);
+		auto subLevel = shard.subLevelItem.find(subLevelKey);
+		if (subLevel == shard.subLevelItem.end()) // has been removed, the tombstone is in the headers
+			return;
+		for (auto key = keys.begin(); key != keys.end(); key++) {
+			auto &slice = subLevel->second[_findSlice(*key)];
+			auto item = slice.find(*key);
+			if ((item == slice.end()) || !item->second.isValid(packed.curTime))
+				continue;
+			DataPacket dataPacket(0);
+			dataPacket.subLevelKey = subLevelKey;
+			dataPacket.itemKey = *key;
+			dataPacket.item = item->second.item();
+			items.push_back(dataPacket);
+		}
+		autoSync.unLock();
+		_writePackedItems(items, packed);
+	}
+	
+	void _writeCheckpointHeaders(THeaderPacketVector &headerPackets, Buffer &buf, const ItemHeader::TTime curTime)
+	{
+		if (headerPackets.empty())
+			return;
+		static u_int32_t openNumber = 0;
+		File file;
+		if (!_createHeaderFile(_path, curTime, __sync_add_and_fetch(&openNumber, 1), _md, _baseTime, file)) {
+			log::Error::L("Can't create header file to checkpoint %s\n", _path.c_str());
+			throw std::exception();
+		}
+		buf.clear();
+		for (auto packet = headerPackets.begin(); packet != headerPackets.end(); ) {
+			const Buffer::TSize recordStart = buf.writtenSize();
+			_addEntryHeader(packet->cmd, packet->itemHeader, packet->subLevelKey, packet->itemKey, buf);
+			_addCheckSum(buf, recordStart);
+			
+			packet++;
+			if ((buf.writtenSize() > MAX_BUF_SIZE) || (packet == headerPackets.end())) {
+				if (file.write(buf.begin(), buf.writtenSize()) != (ssize_t)buf.writtenSize()) {
+					log::Error::L("Can't write header file to checkpoint %s\n", _path.c_str());
+					throw std::exception();
+				}
+				buf.clear();
+			}
+		}
+		if (!_fsync(file))
+			throw std::exception();
+	}
 
-	bool _packDataFile(const char *path, Buffer &buf, Buffer &writeBuffer, const ItemHeader::TTime curTime,
-		File &packedFile, THeaderCMDIndexHash &removeTouchIndex, TPathVector &createdFiles, TPathVector &packedFileList)
+	bool _packDataFile(const char *path, Buffer &buf, PackedOutput &packed, THeaderCMDIndexHash &removeTouchIndex, 
+		TPathVector &packedFileList)
 	{
 		File fd;
 		if (!fd.open(path, O_RDONLY))	{
@@ -1006,7 +2644,8 @@ private:
 			return false;
 		}
 		MetaData md;
-		if (fd.read(&md, sizeof(md)) != sizeof(md))
+		ItemHeader::TTime baseTime;
+		if (!_readMetaData(fd, md) || !_readBaseTime(fd, md.version, baseTime))
 			return false;
 		if (_md != md) {
 			log::Error::L("Sublevel/KeyType mismatch %s (%u/%u | %u/%u)\n", path, md.subLevelKeyType, _md.subLevelKeyType,
@@ -1014,8 +2653,7 @@ private:
 		}
 			
 		buf.clear();
-		writeBuffer.clear();
-		ssize_t fileSize = fd.fileSize() - sizeof(md);
+		ssize_t fileSize = fd.fileSize() - fd.seek(0, SEEK_CUR);
 		buf.add<u_int8_t>(1); // add fake byte to move buf start to 1 from zero
 		if (fd.read(buf.reserveBuffer(fileSize), fileSize) != fileSize)	{
 			log::Error::L("Can't read data file %s\n", path);
@@ -1023,29 +2661,55 @@ private:
 		}
 		buf.skip(sizeof(u_int8_t));
 
+		const size_t trackedRecords = packed.records.size();
 		try
 		{
 			ItemHeader itemHeader;
 			TSubLevelKey subLevelKey;
 			TItemKey itemKey;
 			Buffer::TSize startSavePos = 0;
+			off_t startSaveStreamPos = 0; // where the unchanged range goes in the output
 			Buffer::TSize curPos = 0;
-			while (!buf.isEnded()) {
+			const Buffer::TSize checkSumSize = _checkSumSize(md.version);
+			// records of other versions and base times are rewritten in the format of the packed file
+			const bool needRewrite = (md.version < CURRENT_VERSION) || (baseTime != _baseTime);
+			EIndexCMDType::EIndexCMDType cmd;
+			for (; !buf.isEnded(); buf.skip(checkSumSize)) {
 				curPos = buf.readPos();
-				bool changed = _loadDataEntryHeader(buf, itemHeader, subLevelKey, itemKey, removeTouchIndex);
-				if (!itemHeader.liveTo || (itemHeader.liveTo > curTime)) {
+				_getEntryHeader(cmd, itemHeader, subLevelKey, itemKey, buf, md.version, baseTime);
+				if (checkSumSize) {
+					if (!_isValidRecord(buf, curPos, itemHeader.size)) { // the file is cut by the next load
+						log::Error::L("Data file %s has a bad record, the level is not packed\n", path);
+						return false;
+					}
+					if (cmd != EIndexCMDType::PUT) {
+						if (startSavePos) {
+							_addPackedRange(packed, buf, startSavePos, curPos);
+							startSavePos = 0;
+						}
+						buf.skip(itemHeader.size);
+						continue;
+					}
+				}
+				bool changed = _applyHeaderCMDs(cmd, itemHeader, subLevelKey, itemKey, removeTouchIndex) || needRewrite;
+				if (!itemHeader.liveTo || (itemHeader.liveTo > packed.curTime)) {
 					if (changed) { // need to rewrite
-						_addEntryHeader(EIndexCMDType::PUT, itemHeader, subLevelKey, itemKey, writeBuffer);
-						writeBuffer.add(buf.mapBuffer(itemHeader.size), itemHeader.size);
 						if (startSavePos)
 						{
-							_syncToFile(startSavePos, curPos, buf, writeBuffer, packedFile, createdFiles, curTime);
+							_addPackedRange(packed, buf, startSavePos, curPos);
 							startSavePos = 0;
 						}
+						const Buffer::TSize recordStart = _startPackedRecord(packed, subLevelKey, itemKey, itemHeader);
+						packed.writeBuffer.add(buf.mapBuffer(itemHeader.size), itemHeader.size);
+						_endPackedRecord(packed, recordStart);
 					} else 
 					{
-						if (!startSavePos)
+						if (!startSavePos) {
 							startSavePos = curPos;
+							startSaveStreamPos = _packedPos(packed);
+						}
+						_trackPackedRecord(packed, subLevelKey, itemKey, itemHeader, 
+							startSaveStreamPos + (buf.readPos() - startSavePos));
 						buf.skip(itemHeader.size);
 					}
 				}
@@ -1053,24 +2717,19 @@ private:
 				{
 					if (startSavePos)
 					{
-						_syncToFile(startSavePos, curPos, buf, writeBuffer, packedFile, createdFiles, curTime);
+						_addPackedRange(packed, buf, startSavePos, curPos);
 						startSavePos = 0;
 					}
 					buf.skip(itemHeader.size);
 				}
-				if (writeBuffer.writtenSize() > MAX_BUF_SIZE)
-				{
-					_syncToFile(writeBuffer.begin(), writeBuffer.writtenSize(), packedFile, createdFiles, curTime);
-					writeBuffer.clear();
-				}
 			}
-			if (startSavePos == 1) // the whole file is not changed
+			if (startSavePos == 1) { // the whole file is not changed, its items keep their locations
+				packed.records.resize(trackedRecords);
 				return true;
+			}
 			else if (startSavePos)
-				_syncToFile(startSavePos, buf.readPos(), buf, writeBuffer, packedFile, createdFiles, curTime);
-			
-			if (!writeBuffer.empty())
-				_syncToFile(writeBuffer.begin(), writeBuffer.writtenSize(), packedFile, createdFiles, curTime);
+				_addPackedRange(packed, buf, startSavePos, buf.readPos());
+			_flushPacked(packed);
 			
 			packedFileList.push_back(path);
 			return true;
@@ -1083,18 +2742,35 @@ private:
 		return false;
 	}
 	
-	typedef unordered_map<TItemKey, TItemSharedPtr> TItemIndex;
 	typedef std::vector<TItemIndex> TItemIndexVector;
+	typedef std::vector<TItemIndexVector> TItemIndexVectorList;
 	typedef unordered_map<TSubLevelKey, TItemIndexVector> TSubLevelIndex;
-	TSubLevelIndex _subLevelItem;
-	Mutex _sync;
+	// sublevels are spread over shards by their keys, every shard has its own lock
+	struct Shard
+	{
+		Shard()
+			: maxTag(0)
+		{
+		}
+		Mutex sync;
+		TSubLevelIndex subLevelItem;
+		TItemIndexVectorList removedSubLevels; // are freed by clearOld out of the lock
+		TSubLevelTombstones subLevelTombstones; // tags of removed sublevels
+		u_int64_t maxTag; // the greatest tag of items
+		TOrderedSubLevelIndex orderedItems; // can keep keys of removed items, they are dropped on range queries
+		TOrderedKeysList removedOrderedKeys;
+		TExpiryBuckets expiryBuckets; // liveTo / EXPIRY_BUCKET_TIME => items to check
+		char padding[CACHE_LINE_SIZE]; // keeps locks of neighbour shards in different cache lines
+	};
+	size_t _shardsCount;
+	std::unique_ptr<Shard[]> _shards;
 	TSliceCount _slicesCount;
 };
 
 template <EKeyType type>
 struct TKeyType  {	};
 
-static_assert(KEY_MAX_TYPE == KEY_INT64, "New key type should be added below");
+static_assert(KEY_MAX_TYPE == KEY_BIN128, "New key type should be added below");
 
 template <>
 struct TKeyType<KEY_STRING>  
@@ -1111,8 +2787,13 @@ struct TKeyType<KEY_INT64>
 {	
 	typedef u_int64_t type;
 };
+template <>
+struct TKeyType<KEY_BIN128>  
+{	
+	typedef BinKey128 type;
+};
 
-template <template<typename TSubLevelKey, typename TItemKey> class TIndexClass, typename TSubLevelKey>
+template <template<typename TSubLevelKey, typename TItemKey, typename...> class TIndexClass, typename TSubLevelKey>
 TopLevelIndex *createTopLevelIndex(const EKeyType itemKeyType, const std::string &level, Index *index, 
 	const std::string &path, const TopLevelIndex::MetaData &md
 )
@@ -1125,10 +2806,12 @@ TopLevelIndex *createTopLevelIndex(const EKeyType itemKeyType, const std::string
 		return new TIndexClass<TSubLevelKey, TKeyType<KEY_INT32>::type>(level, index, path, md);
 	case KEY_INT64:
 		return new TIndexClass<TSubLevelKey, TKeyType<KEY_INT64>::type>(level, index, path, md);
+	case KEY_BIN128:
+		return new TIndexClass<TSubLevelKey, TKeyType<KEY_BIN128>::type>(level, index, path, md);
 	};
 	return  NULL;
 }
-template <template<typename TSubLevelKey, typename TItemKey> class TIndexClass>
+template <template<typename TSubLevelKey, typename TItemKey, typename...> class TIndexClass>
 TopLevelIndex *createTopLevelIndex(
 	const EKeyType subLevelType, 
 	const EKeyType itemKeyType, 
@@ -1146,10 +2829,56 @@ TopLevelIndex *createTopLevelIndex(
 			return createTopLevelIndex<TIndexClass, TKeyType<KEY_INT32>::type>(itemKeyType, level, index, path, md);
 		case KEY_INT64:
 			return createTopLevelIndex<TIndexClass, TKeyType<KEY_INT64>::type>(itemKeyType, level, index, path, md);
+		case KEY_BIN128:
+			return createTopLevelIndex<TIndexClass, TKeyType<KEY_BIN128>::type>(itemKeyType, level, index, path, md);
+	};
+	return  NULL;
+}
+
+template <typename TSubLevelKey>
+using DenseTopLevelIndex = MemmoryTopLevelIndex<TSubLevelKey, TKeyType<KEY_INT32>::type, 
+	DenseIndex<TKeyType<KEY_INT32>::type, ItemSlot>>;
+
+static TopLevelIndex *createDenseTopLevelIndex(
+	const EKeyType subLevelType, 
+	const std::string &level,
+	Index *index,
+	const std::string &path, 
+	const TopLevelIndex::MetaData &md
+)
+{
+	switch (subLevelType)
+	{
+		case KEY_STRING:
+			return new DenseTopLevelIndex<TKeyType<KEY_STRING>::type>(level, index, path, md);
+		case KEY_INT32:
+			return new DenseTopLevelIndex<TKeyType<KEY_INT32>::type>(level, index, path, md);
+		case KEY_INT64:
+			return new DenseTopLevelIndex<TKeyType<KEY_INT64>::type>(level, index, path, md);
+		case KEY_BIN128:
+			return new DenseTopLevelIndex<TKeyType<KEY_BIN128>::type>(level, index, path, md);
 	};
 	return  NULL;
 }
 
+static TopLevelIndex *createMemmoryTopLevelIndex(
+	const EKeyType subLevelType, 
+	const EKeyType itemKeyType, 
+	const std::string &level,
+	Index *index,
+	const std::string &path, 
+	const TopLevelIndex::MetaData &md
+)
+{
+	if (md.flags & TopLevelIndex::FL_DENSE) {
+		if (itemKeyType == KEY_INT32)
+			return createDenseTopLevelIndex(subLevelType, level, index, path, md);
+		log::Error::L("Level %s: DENSE option requires INT32 item keys\n", level.c_str());
+		return NULL;
+	}
+	return createTopLevelIndex<MemmoryTopLevelIndex>(subLevelType, itemKeyType, level, index, path, md);
+}
+
 TopLevelIndex *TopLevelIndex::createFromDirectory(const std::string &level, Index *index, const std::string &path)
 {
 	BString metFileName;
@@ -1160,11 +2889,12 @@ TopLevelIndex *TopLevelIndex::createFromDirectory(const std::string &level, Inde
 		return NULL;
 	}
 	MetaData md;
-	if (fd.read(&md, sizeof(md)) != sizeof(md))	{
+	if (!_readMetaData(fd, md))	{
 		log::Error::L("Cannot read from metadata file %s\n", metFileName.c_str());
 		return NULL;
 	}
-	return createTopLevelIndex<MemmoryTopLevelIndex>(static_cast<EKeyType>(md.subLevelKeyType), \
+	md.version = CURRENT_VERSION; // new files are always written in the current format
+	return createMemmoryTopLevelIndex(static_cast<EKeyType>(md.subLevelKeyType), \
 		static_cast<EKeyType>(md.itemKeyType), level, index, path, md);
 }
 
@@ -1173,9 +2903,18 @@ TopLevelIndex *TopLevelIndex::create(
 	Index *index,
 	const std::string &path, 
 	const EKeyType subLevelKeyType, 
-	const EKeyType itemKeyType
+	const EKeyType itemKeyType,
+	const TFlags flags
 )
 {
+	if ((flags & FL_DENSE) && (itemKeyType != KEY_INT32)) {
+		log::Error::L("Level %s: DENSE option requires INT32 item keys\n", level.c_str());
+		return NULL;
+	}
+	if ((flags & FL_MEMORY) && (flags & (FL_FSYNC | FL_DURABLE))) {
+		log::Error::L("Level %s: MEMORY option can't be used with FSYNC or DURABLE\n", level.c_str());
+		return NULL;
+	}
 	if (!Directory::makeDirRecursive(path.c_str()))
 		return NULL;
 	MetaData md;
@@ -1183,6 +2922,7 @@ TopLevelIndex *TopLevelIndex::create(
 	md.version = CURRENT_VERSION;
 	md.subLevelKeyType = subLevelKeyType;
 	md.itemKeyType = itemKeyType;
+	md.flags = flags;
 
 	BString metFileName;
 	_formMetaFileName(path, metFileName);
@@ -1196,13 +2936,23 @@ TopLevelIndex *TopLevelIndex::create(
 		return NULL;
 	}
 	
-	return createTopLevelIndex<MemmoryTopLevelIndex>(subLevelKeyType, itemKeyType, level, index, path, md);
+	return createMemmoryTopLevelIndex(subLevelKeyType, itemKeyType, level, index, path, md);
 }
 
-Index::Index(const std::string &path)
+struct Index::OperationCounter
+{
+	uint64_t operations;
+	char padding[CACHE_LINE_SIZE - sizeof(uint64_t)]; // keeps counters of different threads in different cache lines
+};
+
+Index::Index(const std::string &path, const size_t shardsCount)
 	: _serverID(0), _path(path), _replicationLogKeepTime(0), _status(0),
-	_subLevelKeyType(KEY_INT32), _itemKeyType(KEY_INT64), _timeThread(NULL), _replicationAcceptThread(NULL)
+	_subLevelKeyType(KEY_INT32), _itemKeyType(KEY_INT64), _flags(0), _compressionThreshold(DEFAULT_COMPRESSION_THRESHOLD), 
+	_coldTime(0), _promoteCold(true), _shardsCount(shardsCount ? shardsCount : 1), _fsyncPeriod(DEFAULT_FSYNC_PERIOD), 
+	_checkpointPeriod(DEFAULT_CHECKPOINT_PERIOD), _maintenanceEnd(0), _operations(new OperationCounter[OPERATION_COUNTERS]), _lastOperations(0), _lastMaintenanceTime(0),
+	_averageLoad(0), _timeThread(NULL), _replicationAcceptThread(NULL)
 {
+	bzero(_operations.get(), sizeof(OperationCounter) * OPERATION_COUNTERS);
 	Directory::makeDirRecursive(path.c_str());
 	try
 	{
@@ -1263,7 +3013,8 @@ Index::~Index()
 	_stopThreads();
 }
 
-void Index::setAutoCreate(const bool ison, const EKeyType defaultSublevelType, const EKeyType defaultItemKeyType)
+void Index::setAutoCreate(const bool ison, const EKeyType defaultSublevelType, const EKeyType defaultItemKeyType, 
+	const TopLevelIndex::TFlags defaultFlags)
 {
 	if (ison)
 		_status |= ST_AUTO_CREATE;
@@ -1271,6 +3022,23 @@ void Index::setAutoCreate(const bool ison, const EKeyType defaultSublevelType, c
 		_status &= (~ST_AUTO_CREATE);
 	_subLevelKeyType = defaultSublevelType;
 	_itemKeyType = defaultItemKeyType;
+	_flags = defaultFlags;
+}
+
+void Index::setUnifiedLog(const bool ison)
+{
+	if (ison)
+		_status |= ST_UNIFIED_LOG;
+	else
+		_status &= (~ST_UNIFIED_LOG);
+}
+
+void Index::setCheckpointPack(const bool ison)
+{
+	if (ison)
+		_status |= ST_CHECKPOINT_PACK;
+	else
+		_status &= (~ST_CHECKPOINT_PACK);
 }
 
 bool Index::_checkLevelName(const std::string &name)
@@ -1318,6 +3086,19 @@ bool Index::sync(const ItemHeader::TTime curTime)
 	return true;
 }
 
+void Index::evictCold(const ItemHeader::TTime curTime)
+{
+	if (!_coldTime)
+		return;
+	AutoMutex autoSync(&_sync);
+	auto indexCopy = _index;
+	_sync.unLock();
+	
+	Buffer buf;
+	for (auto topLevel = indexCopy.begin(); topLevel != indexCopy.end(); topLevel++)
+		topLevel->second->evictCold(buf, curTime);
+}
+
 void Index::clearOld(const ItemHeader::TTime curTime)
 {
 	AutoMutex autoSync(&_sync);
@@ -1328,15 +3109,15 @@ void Index::clearOld(const ItemHeader::TTime curTime)
 }
 
 bool Index::put(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-	TItemSharedPtr &item, bool checkBeforeReplace)
+	TItemSharedPtr &item, bool checkBeforeReplace, DurableWait *durableWait)
 {
 	AutoMutex autoSync(&_sync);
 	auto f = _index.find(level);
 	if (f == _index.end()) {
 		if (_status & ST_AUTO_CREATE)	{
 			autoSync.unLock();
-			if (create(level, _subLevelKeyType, _itemKeyType)) {
-				return put(level, subLevel, itemKey, item, checkBeforeReplace);
+			if (create(level, _subLevelKeyType, _itemKeyType, _flags)) {
+				return put(level, subLevel, itemKey, item, checkBeforeReplace, durableWait);
 			} else {
 				log::Error::L("Cannot create a new top level %s/%s\n", level.c_str(), subLevel.c_str());
 				return false;
@@ -1348,12 +3129,14 @@ bool Index::put(const std::string &level, const std::string &subLevel, const std
 	}
 	auto topLevel = f->second;
 	autoSync.unLock();
+	_countOperation();
 	topLevel->put(subLevel, itemKey, item, checkBeforeReplace);
-	addToSync(topLevel);
+	addToSync(topLevel, durableWait);
 	return true;
 }
 
-bool Index::removeSubLevel(const std::string &level, const std::string &subLevel)
+bool Index::removeSubLevel(const std::string &level, const std::string &subLevel, const ItemHeader::TTime curTime, 
+	DurableWait *durableWait)
 {
 	AutoMutex autoSync(&_sync);
 	auto f = _index.find(level);
@@ -1361,16 +3144,17 @@ bool Index::removeSubLevel(const std::string &level, const std::string &subLevel
 		return false;
 	auto topLevel = f->second;
 	autoSync.unLock();
-	if (topLevel->removeSubLevel(subLevel))
+	if (topLevel->removeSubLevel(subLevel, curTime))
 	{
-		addToSync(topLevel);
+		addToSync(topLevel, durableWait);
 		return true;
 	}
 	else
 		return false;	
 }
 
-bool Index::remove(const std::string &level, const std::string &subLevel, const std::string &itemKey)
+bool Index::remove(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
+	DurableWait *durableWait)
 {
 	AutoMutex autoSync(&_sync);
 	auto f = _index.find(level);
@@ -1378,17 +3162,34 @@ bool Index::remove(const std::string &level, const std::string &subLevel, const
 		return false;
 	auto topLevel = f->second;
 	autoSync.unLock();
+	_countOperation();
 	if (topLevel->remove(subLevel, itemKey))
 	{
-		addToSync(topLevel);
+		addToSync(topLevel, durableWait);
 		return true;
 	}
 	else
 		return false;
 }
 
+bool Index::findRange(const std::string &level, const std::string &subLevel, const std::string &fromKey, 
+	const std::string &toKey, const size_t limit, const ItemHeader::TTime curTime, TopLevelIndex::TItemRangeVector &items, 
+	bool *isPacked)
+{
+	AutoMutex autoSync(&_sync);
+	auto f = _index.find(level);
+	if (f == _index.end())
+		return false;
+	auto topLevel = f->second;
+	autoSync.unLock();
+	_countOperation();
+	if (isPacked)
+		*isPacked = topLevel->isPacked();
+	return topLevel->findRange(subLevel, fromKey, toKey, limit, curTime, items);
+}
+
 TItemSharedPtr Index::find(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-	const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime)
+	const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime, bool *isPacked, DurableWait *durableWait)
 {
 	AutoMutex autoSync(&_sync);
 	auto f = _index.find(level);
@@ -1396,11 +3197,14 @@ TItemSharedPtr Index::find(const std::string &level, const std::string &subLevel
 		return TItemSharedPtr();
 	auto topLevel = f->second;
 	autoSync.unLock();
-	return topLevel->find(subLevel, itemKey, curTime, lifeTime, topLevel);
+	_countOperation();
+	if (isPacked)
+		*isPacked = topLevel->isPacked();
+	return topLevel->find(subLevel, itemKey, curTime, lifeTime, topLevel, durableWait);
 }
 
 bool Index::touch(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-	const ItemHeader::TTime setTime, const ItemHeader::TTime curTime)
+	const ItemHeader::TTime setTime, const ItemHeader::TTime curTime, DurableWait *durableWait)
 {
 	AutoMutex autoSync(&_sync);
 	auto f = _index.find(level);
@@ -1408,9 +3212,10 @@ bool Index::touch(const std::string &level, const std::string &subLevel, const s
 		return false;
 	auto topLevel = f->second;
 	autoSync.unLock();
+	_countOperation();
 	if (topLevel->touch(subLevel, itemKey, setTime, curTime))
 	{
-		addToSync(topLevel);
+		addToSync(topLevel, durableWait);
 		return true;
 	}
 	else
@@ -1425,6 +3230,8 @@ bool Index::load(const ItemHeader::TTime curTime)
 		if (!topLevel->second->load(buf, curTime))
 			return false;
 	}
+	if (isUnifiedLog())
+		return _replayReplicationLog(curTime);
 	return true;
 }
 
@@ -1448,6 +3255,7 @@ EKeyType Index::stringToType(const std::string &type)
 		"STRING",
 		"INT32",
 		"INT64",
+		"BIN128",
 	};
 	for (int i = 0; i <= KEY_MAX_TYPE; i++) {
 		if (!strcasecmp(type.c_str(), KEY_TYPES[i])) {
@@ -1458,7 +3266,26 @@ EKeyType Index::stringToType(const std::string &type)
 	throw ConvertError(type.c_str());
 }
 
-bool Index::create(const std::string &level, const EKeyType subLevelKeyType, const EKeyType itemKeyType)
+TopLevelIndex::TFlags Index::stringToFlag(const std::string &flag)
+{
+	if (!strcasecmp(flag.c_str(), "COMPRESSED"))
+		return TopLevelIndex::FL_COMPRESSED;
+	else if (!strcasecmp(flag.c_str(), "ORDERED"))
+		return TopLevelIndex::FL_ORDERED;
+	else if (!strcasecmp(flag.c_str(), "DENSE"))
+		return TopLevelIndex::FL_DENSE;
+	else if (!strcasecmp(flag.c_str(), "FSYNC"))
+		return TopLevelIndex::FL_FSYNC;
+	else if (!strcasecmp(flag.c_str(), "DURABLE"))
+		return TopLevelIndex::FL_DURABLE;
+	else if (!strcasecmp(flag.c_str(), "MEMORY"))
+		return TopLevelIndex::FL_MEMORY;
+	log::Error::L("Cannot find level option %s\n", flag.c_str());
+	throw ConvertError(flag.c_str());
+}
+
+bool Index::create(const std::string &level, const EKeyType subLevelKeyType, const EKeyType itemKeyType, 
+	const TopLevelIndex::TFlags flags)
 {
 	if (!_checkLevelName(level)) {
 		log::Error::L("Cannot create new top level %s (it must contain only A-Za-z0-9_-. chars)\n", level.c_str());
@@ -1476,7 +3303,8 @@ bool Index::create(const std::string &level, const EKeyType subLevelKeyType, con
 		log::Error::L("Cannot create directory for a new top level %s\n", path.c_str());
 		return false;
 	}
-	TopLevelIndex *topLevelIndex = TopLevelIndex::create(level, this, path.c_str(), subLevelKeyType, itemKeyType);
+	TopLevelIndex *topLevelIndex = TopLevelIndex::create(level, this, path.c_str(), subLevelKeyType, itemKeyType, 
+		flags);
 	if (!topLevelIndex)	{
 		log::Error::L("Cannot create new TopLevelIndex %s\n", path.c_str());
 		return false;
@@ -1485,20 +3313,97 @@ bool Index::create(const std::string &level, const EKeyType subLevelKeyType, con
 	return true;
 }
 
+bool Index::tick(fl::chrono::ETime &curTime)
+{
+	clearOld(curTime.unix());
+	_maintain(curTime.unix());
+	return true;
+}
+
+void Index::_countOperation()
+{
+	static u_int32_t lastThreadSlot = 0;
+	static __thread u_int32_t threadSlot = 0; // 0 - has not been taken yet
+	if (!threadSlot)
+		threadSlot = __sync_add_and_fetch(&lastThreadSlot, 1);
+	// threads share counters only when there are more of them than counters
+	__atomic_fetch_add(&_operations[threadSlot % OPERATION_COUNTERS].operations, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t Index::_sumOperations()
+{
+	uint64_t operations = 0;
+	for (size_t i = 0; i < OPERATION_COUNTERS; i++)
+		operations += __atomic_load_n(&_operations[i].operations, __ATOMIC_RELAXED);
+	return operations;
+}
+
+void Index::_maintain(const ItemHeader::TTime curTime)
+{
+	uint64_t operations = _sumOperations();
+	double load = 0;
+	if (_lastMaintenanceTime && (curTime > _lastMaintenanceTime))
+		load = static_cast<double>(operations - _lastOperations) / (curTime - _lastMaintenanceTime);
+	_lastOperations = operations;
+	_lastMaintenanceTime = curTime;
+	bool isBusy = (load > _averageLoad * MAINTENANCE_LOAD_FACTOR);
+	_averageLoad = _averageLoad * (1 - MAINTENANCE_LOAD_WEIGHT) + load * MAINTENANCE_LOAD_WEIGHT;
+	
+	AutoMutex autoSync(&_hourlySync);
+	if (_maintenanceQueue.empty())
+		return;
+	if (isBusy && (curTime < _maintenanceEnd)) // postpone till the load goes down
+		return;
+	size_t ticksLeft = 1;
+	if (_maintenanceEnd > curTime)
+		ticksLeft += (_maintenanceEnd - curTime) / TIME_THREAD_PRECISION;
+	// levels are done by steps, so a big level is spread over ticks too
+	const size_t scale = (_maintenanceQueue.size() + ticksLeft - 1) / ticksLeft;
+	TopLevelIndex::MaintenanceBudget budget = {scale * MAINTENANCE_TICK_BYTES, scale * MAINTENANCE_TICK_ITEMS};
+	
+	Buffer buf;
+	while (budget.bytes && budget.items && !_maintenanceQueue.empty()) {
+		TTopLevelKey level = _maintenanceQueue.back();
+		
+		_sync.lock();
+		auto f = _index.find(level);
+		if (f == _index.end()) {
+			_sync.unLock();
+			_maintenanceQueue.pop_back();
+			continue;
+		}
+		auto topLevel = f->second;
+		_sync.unLock();
+		
+		if (topLevel->maintain(buf, curTime, budget))
+			_maintenanceQueue.pop_back();
+	}
+}
+
 bool Index::hour(fl::chrono::ETime &curTime)
 {
 	AutoMutex autoSync(&_hourlySync);
 	log::Info::L("Hourly routines started\n");
-	clearOld(curTime.unix());
-	pack(curTime.unix());
+	if (!_maintenanceQueue.empty())
+		log::Warning::L("%zu levels have not been packed during the last hour\n", _maintenanceQueue.size());
+	_maintenanceQueue.clear();
+	_sync.lock();
+	for (auto topLevel = _index.begin(); topLevel != _index.end(); topLevel++)
+		_maintenanceQueue.push_back(topLevel->first);
+	_sync.unLock();
+	_maintenanceEnd = curTime.unix() + MAINTENANCE_SPREAD_TIME;
+	
 	deleteOldReplicationLog(curTime.unix());
-	log::Info::L("Hourly routines ended\n");
+	ItemMemory::logStats();
+	log::Info::L("Hourly routines ended, %zu levels will be packed in %u seconds\n", _maintenanceQueue.size(), 
+		MAINTENANCE_SPREAD_TIME);
 	return true;
 }
 
-void Index::startThreads(const uint32_t syncThreadCount)
+void Index::startThreads(const uint32_t syncThreadCount, const IoRing::EBackend ioBackend)
 {
-	_timeThread = new fl::threads::TimeThread(5 * 60);
+	_timeThread = new fl::threads::TimeThread(TIME_THREAD_PRECISION);
+	_timeThread->addEveryTick(new fl::threads::TimeTask<Index>(this, &Index::tick));
 	_timeThread->addEveryHour(new fl::threads::TimeTask<Index>(this, &Index::hour));
 	if (!_timeThread->create())
 	{
@@ -1508,19 +3413,34 @@ void Index::startThreads(const uint32_t syncThreadCount)
 	
 	for (uint32_t i = 0; i < syncThreadCount; i++)
 	{
-		_syncThreads.push_back(new IndexSyncThread());
+		_syncThreads.push_back(new IndexSyncThread(ioBackend == IoRing::URING));
 	}
 	log::Info::L("%u sync threads have been started\n", _syncThreads.size());
 }
 
-void Index::addToSync(TTopLevelIndexPtr &topLevel)
+void Index::addToSync(TTopLevelIndexPtr &topLevel, DurableWait *durableWait)
 {
 	if (_syncThreads.empty())
 		return;
+	if (topLevel->isMemoryOnly() && !isReplicating()) // nothing to write
+		return;
 	
-	static int num = 0;
-	num++;
-	_syncThreads[num % _syncThreads.size()]->add(topLevel);
+	TopLevelIndex::TSyncNumber syncNumber = 0;
+	if (topLevel->isDurable()) // it is taken before marking, so the sync with this number will get the change
+		syncNumber = topLevel->nextSyncNumber();
+	if (topLevel->markDirty())
+		_syncThreads[topLevel->syncAffinity() % _syncThreads.size()]->add(topLevel);
+	if (!topLevel->isDurable())
+		return;
+	bool written = true; // the answer is sent when the change is on the disk
+	if (durableWait) {
+		durableWait->isParked = topLevel->parkDurable(syncNumber, *durableWait, written);
+		if (durableWait->isParked)
+			return;
+	} else
+		written = topLevel->waitDurable(syncNumber);
+	if (!written)
+		throw DurableError("Can't write a change to the disk");
 }
 
 bool Index::startReplicationListenter(fl::network::Socket *listen)
@@ -1558,7 +3478,7 @@ bool Index::startReplicationLog(const TServerID serverID, const u_int32_t replic
 const std::string Index::REPLICATION_FILE_PREFIX = "nomos_bin_";
 
 Index::ReplicationLog::ReplicationLog(const TReplicationLogNumber number, const char *fileName)
-	: _number(number), _version(CURRENT_VERSION), _fileName(fileName), _fileSize(0)
+	: _number(number), _version(CURRENT_VERSION), _fileName(fileName), _fileSize(0), _needSync(false), _syncFailed(false)
 {
 }
 
@@ -1629,15 +3549,54 @@ const bool Index::ReplicationLog::canFit(const uint32_t size)
 		return true;
 }
 
-void Index::ReplicationLog::save(Buffer &buffer)
+void Index::ReplicationLog::save(const struct iovec *iov, const int count, const size_t size)
 {
 	AutoReadWriteLockWrite autoWriteLock(&_sync);
 	
-	if (_writeFd.write(buffer.begin(), buffer.writtenSize()) != (ssize_t)buffer.writtenSize()) {
+	if (writev(_writeFd.descr(), iov, count) != (ssize_t)size) {
 		log::Error::L("Can't write data to replication log %s\n", _fileName.c_str());
 		throw std::exception();
 	}
-	_fileSize += buffer.writtenSize();
+	_fileSize += size;
+	_needSync = true;
+}
+
+bool Index::ReplicationLog::sync()
+{
+	AutoMutex autoSync(&_fsyncSync); // a concurrent fdatasync could have started before the last write
+	if (_needSync) {
+		_needSync = false;
+		if (fdatasync(_writeFd.descr())) {
+			log::Error::L("Can't fdatasync replication log %s (%d)\n", _fileName.c_str(), errno);
+			_syncFailed = true;
+		}
+	}
+	return !_syncFailed; // waiters of the failed call find no work left, but their writes are not on the disk
+}
+
+void Index::ReplicationLog::truncate(const uint32_t size)
+{
+	AutoReadWriteLockWrite autoWriteLock(&_sync);
+	if (ftruncate(_writeFd.descr(), size)) {
+		log::Error::L("Can't truncate replication log %s to %u (%d)\n", _fileName.c_str(), size, errno);
+		throw std::exception();
+	}
+	_fileSize = _writeFd.seek(0, SEEK_END);
+}
+
+void Index::ReplicationLog::_getPacketHeader(Buffer &buffer, TopLevelIndex::ReplicationPacketHeader &rph)
+{
+	if (_version >= FLAGS_VERSION) {
+		rph = *(TopLevelIndex::ReplicationPacketHeader*)buffer.mapBuffer(sizeof(TopLevelIndex::ReplicationPacketHeader));
+		return;
+	}
+	PacketHeaderV1 &header = *(PacketHeaderV1*)buffer.mapBuffer(sizeof(PacketHeaderV1));
+	rph.serverID = header.serverID;
+	rph.md.version = header.version; // records of the packet are parsed by it
+	rph.md.subLevelKeyType = header.subLevelKeyType;
+	rph.md.itemKeyType = header.itemKeyType;
+	rph.md.flags = 0;
+	rph.packetSize = header.packetSize;
 }
 
 bool Index::ReplicationLog::read(const TServerID serverID, Buffer &data, Buffer &buffer, uint32_t &seek)
@@ -1645,6 +3604,11 @@ bool Index::ReplicationLog::read(const TServerID serverID, Buffer &data, Buffer
 	if (seek == 0)
 		seek += (sizeof(_version) + sizeof(_number));
 	buffer.clear();
+	if (_version > CURRENT_VERSION) { // written by a newer server, its packets can't be parsed
+		log::Warning::L("Skip binary log %s of version %u\n", _fileName.c_str(), _version);
+		seek = _fileSize;
+		return true;
+	}
 	
 	AutoReadWriteLockRead autoReadLock(&_sync);
 	ssize_t leftRead = _fileSize - seek;
@@ -1662,15 +3626,15 @@ bool Index::ReplicationLog::read(const TServerID serverID, Buffer &data, Buffer
 			while (buffer.readPos() < buffer.writtenSize())
 			{
 				lastOkBlock = buffer.readPos();
-				TopLevelIndex::ReplicationPacketHeader &rph = 
-					*(TopLevelIndex::ReplicationPacketHeader*)buffer.mapBuffer(sizeof(TopLevelIndex::ReplicationPacketHeader));
+				TopLevelIndex::ReplicationPacketHeader rph;
+				_getPacketHeader(buffer, rph);
 				buffer.skip(rph.packetSize); // check if the packet has read fully 
 				if (rph.serverID == serverID)
 					continue;
 				else {
-					buffer.seekReadPos(lastOkBlock);
-					auto addData = sizeof(TopLevelIndex::ReplicationPacketHeader) + rph.packetSize;
-					data.add((char*)buffer.mapBuffer(addData), addData);
+					buffer.seekReadPos(buffer.readPos() - rph.packetSize);
+					data.add(&rph, sizeof(rph)); // packets of all versions are passed with the current header
+					data.add((char*)buffer.mapBuffer(rph.packetSize), rph.packetSize);
 					if (data.writtenSize() > (BString::TSize)MAX_BUF_SIZE)
 					{
 						seek += buffer.readPos();
@@ -1756,7 +3720,7 @@ bool Index::_openReplicationFiles()
 			_replicationLogFiles.push_back(rl);
 		}
 		std::sort(_replicationLogFiles.begin(), _replicationLogFiles.end(), &_sortNumber);
-		if (!_replicationLogFiles.empty())
+		if (!_replicationLogFiles.empty() && _replicationLogFiles.back()->isCurrentVersion())
 			_currentReplicationLog = _replicationLogFiles.back();
 		log::Info::L("Found %u bin logs at %s\n", _replicationLogFiles.size(), _replicationLogPath.c_str());
 		return true;
@@ -1774,7 +3738,21 @@ bool Index::deleteOldReplicationLog(const time_t curTime)
 		return false;
 	time_t minSaveTime = curTime -  _replicationLogKeepTime;
 	
+	// binlogs which are not checkpointed yet are kept, levels are checkpointed every hour
+	TReplicationLogNumber minCheckpointNumber = UINT32_MAX;
+	TTopLevelKey oldestLevel;
+	if (isUnifiedLog()) {
+		AutoMutex autoIndexSync(&_sync);
+		for (auto topLevel = _index.begin(); topLevel != _index.end(); topLevel++) {
+			if (!topLevel->second->isMemoryOnly() && (topLevel->second->checkpointNumber() < minCheckpointNumber)) {
+				minCheckpointNumber = topLevel->second->checkpointNumber();
+				oldestLevel = topLevel->first;
+			}
+		}
+	}
+	
 	decltype(_replicationLogFiles) saveReplicationLogFiles;
+	size_t heldCount = 0;
 	AutoMutex autoSync(&_replicationSync);
 	for (auto repl = _replicationLogFiles.begin(); repl != _replicationLogFiles.end(); repl++) {
 		if ((*repl)->number() == _currentReplicationLog->number()) // don't touch last binlog
@@ -1786,6 +3764,9 @@ bool Index::deleteOldReplicationLog(const time_t curTime)
 		if (lstat((*repl)->fileName().c_str(), &fStat) == 0) { // file exists otherwise skip it
 			if (fStat.st_mtim.tv_sec > minSaveTime) {
 				saveReplicationLogFiles.push_back(*repl);
+			} else if ((*repl)->number() >= minCheckpointNumber) {
+				saveReplicationLogFiles.push_back(*repl);
+				heldCount++;
 			} else {
 				if (unlink((*repl)->fileName().c_str()) != 0) {
 					log::Error::L("Can't remove binlog %s file\n", (*repl)->fileName().c_str());
@@ -1795,22 +3776,55 @@ bool Index::deleteOldReplicationLog(const time_t curTime)
 		} 
 	}
 	std::swap(_replicationLogFiles, saveReplicationLogFiles);
+	if (heldCount)
+		log::Warning::L("%zu old binlogs are kept till level %s is checkpointed\n", heldCount, oldestLevel.c_str());
 	return true;
 }
 
 void Index::addToReplicationLog(Buffer &buffer)
+{
+	struct iovec iov = {buffer.begin(), buffer.writtenSize()};
+	addToReplicationLog(&iov, 1, buffer.writtenSize());
+}
+
+void Index::addToReplicationLog(const struct iovec *iov, const int count, const size_t size)
 {
 	if (!isReplicating())
 		return;
 	AutoMutex autoSync(&_replicationSync);
-	if (!_currentReplicationLog->canFit(buffer.writtenSize())) {
+	if (!_currentReplicationLog->canFit(size)) {
 		_currentReplicationLog.reset();
 		if (!_openCurrentReplicationLog())
 			throw std::exception();
 	}
 	auto rl = _currentReplicationLog;
 	autoSync.unLock();
-	rl->save(buffer);
+	rl->save(iov, count, size);
+}
+
+TReplicationLogNumber Index::replicationLogNumber()
+{
+	AutoMutex autoSync(&_replicationSync);
+	if (!_currentReplicationLog.get())
+		return 0;
+	return _currentReplicationLog->number();
+}
+
+bool Index::syncReplicationLog()
+{
+	TReplicationLogVector needSync;
+	AutoMutex autoSync(&_replicationSync);
+	for (auto repl = _replicationLogFiles.begin(); repl != _replicationLogFiles.end(); repl++) {
+		if ((*repl)->needSync()) // the previous binlog can still have data of a write started before its rotation
+			needSync.push_back(*repl);
+	}
+	autoSync.unLock();
+	bool result = true;
+	for (auto repl = needSync.begin(); repl != needSync.end(); repl++) {
+		if (!(*repl)->sync())
+			result = false;
+	}
+	return result;
 }
 
 bool Index::getFromReplicationLog(const TServerID serverID, Buffer &data, Buffer &buffer, 
@@ -1867,13 +3881,18 @@ bool Index::addFromAnotherServer(const TServerID serverID, Buffer &data, const I
 				continue;
 			}
 			Buffer::TSize curReadPos = data.readPos();
+			const TopLevelIndex::TVersion version = rph.md.version;
+			if (version > TopLevelIndex::CURRENT_VERSION) {
+				log::Error::L("Server %u has sent a packet of unknown version %u\n", serverID, version);
+				return false;
+			}
 			data.get(topLevelName);
 			AutoMutex autoSync(&_sync);
 			
 			auto f = _index.find(topLevelName);
 			if (f == _index.end()) {
 				autoSync.unLock();
-				if (!create(topLevelName, rph.md.subLevelKeyType, rph.md.itemKeyType))
+				if (!create(topLevelName, rph.md.subLevelKeyType, rph.md.itemKeyType, rph.md.flags))
 					return false;
 				autoSync.lock(&_sync);
 				f = _index.find(topLevelName);
@@ -1888,7 +3907,7 @@ bool Index::addFromAnotherServer(const TServerID serverID, Buffer &data, const I
 			autoSync.unLock();
 			
 			Buffer::TSize endPacketPos = curReadPos + rph.packetSize;
-			if (!topLevel->addFromAnotherServer(serverID, data, endPacketPos, curTime, buffer))
+			if (!topLevel->addFromAnotherServer(serverID, data, endPacketPos, version, curTime, buffer))
 				return false;
 		}
 		return true;
@@ -1901,6 +3920,87 @@ bool Index::addFromAnotherServer(const TServerID serverID, Buffer &data, const I
 	return false;
 }
 
+bool Index::_replayReplicationLog(const ItemHeader::TTime curTime)
+{
+	Buffer data;
+	Buffer buffer;
+	for (auto repl = _replicationLogFiles.begin(); repl != _replicationLogFiles.end(); repl++) {
+		uint32_t seek = 0;
+		while ((*repl)->haveData(seek)) {
+			data.clear();
+			bool isRead = (*repl)->read(0, data, buffer, seek); // server ID 0 is never used, all packets are read
+			Buffer::TSize brokenPacketPos = data.writtenSize();
+			if (!_replayPackets((*repl)->number(), data, curTime, brokenPacketPos))
+				return false;
+			if (brokenPacketPos < data.writtenSize()) { // the read packets follow each other in the log up to seek
+				seek -= data.writtenSize() - brokenPacketPos;
+				isRead = false;
+			}
+			if (!isRead) {
+				log::Warning::L("Binary log %s is broken at %u, the rest of it is skipped\n", (*repl)->fileName().c_str(), 
+					seek);
+				if (*repl == _currentReplicationLog) // new packets are appended after the last complete one
+					(*repl)->truncate(seek);
+				break;
+			}
+		}
+	}
+	log::Info::L("%zu bin logs have been replayed to %s\n", _replicationLogFiles.size(), _path.c_str());
+	return true;
+}
+
+// a packet with a broken record stops the replaying, its position is returned in brokenPacketPos
+bool Index::_replayPackets(const TReplicationLogNumber number, Buffer &data, const ItemHeader::TTime curTime, 
+	Buffer::TSize &brokenPacketPos)
+{
+	Buffer::TSize packetPos = 0;
+	try
+	{
+		std::string topLevelName;
+		while (data.readPos() < data.writtenSize())
+		{
+			packetPos = data.readPos();
+			TopLevelIndex::ReplicationPacketHeader &rph = 
+				*(TopLevelIndex::ReplicationPacketHeader*)data.mapBuffer(sizeof(TopLevelIndex::ReplicationPacketHeader));
+			Buffer::TSize curReadPos = data.readPos();
+			const TopLevelIndex::TVersion version = rph.md.version;
+			data.get(topLevelName);
+			Buffer::TSize endPacketPos = curReadPos + rph.packetSize;
+			
+			AutoMutex autoSync(&_sync);
+			auto f = _index.find(topLevelName);
+			if (f == _index.end()) {
+				autoSync.unLock();
+				if (!create(topLevelName, rph.md.subLevelKeyType, rph.md.itemKeyType, rph.md.flags))
+					return false;
+				autoSync.lock(&_sync);
+				f = _index.find(topLevelName);
+			} else if (f->second->md() != rph.md) {
+				log::Fatal::L("Level's meta data mismatch %s/%s\n", _path.c_str(), topLevelName.c_str());
+				return false;
+			}
+			auto topLevel = f->second;
+			autoSync.unLock();
+			
+			if (topLevel->isMemoryOnly() || (number < topLevel->checkpointNumber())) { // the level's files have it
+				data.seekReadPos(endPacketPos);
+				continue;
+			}
+			if (!topLevel->replayLog(data, endPacketPos, version, curTime)) {
+				brokenPacketPos = packetPos;
+				return true;
+			}
+		}
+		return true;
+	}
+	catch (Buffer::Error &er)
+	{
+		log::Error::L("Catch Buffer exception while replaying bin log %u\n", number);
+		brokenPacketPos = packetPos;
+		return true;
+	}
+}
+
 void Index::exitFlush()
 {
 	log::Error::L("Index %s flushing (%u)\n", _path.c_str(), _serverID);
@@ -26,6 +26,10 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <sys/uio.h>
 
 #include "mutex.hpp"
 #include "item.hpp"
@@ -36,6 +40,7 @@
 #include "types.hpp"
 #include "time_thread.hpp"
 #include "read_write_lock.hpp"
+#include "io_ring.hpp"
 #include "socket.hpp"
 
 
@@ -58,6 +63,21 @@ namespace fl {
 			}
 		};
 		
+		// acknowledges the changes of DURABLE levels instead of the thread which has made them, it is called by 
+		// the sync thread when the change is on the disk, so the thread is not blocked till the sync
+		class DurableWaiter
+		{
+		public:
+			virtual ~DurableWaiter() {}
+			virtual void durable(const uint64_t waitID, const bool written) = 0;
+		};
+		struct DurableWait
+		{
+			DurableWaiter *waiter;
+			uint64_t waitID;
+			bool isParked; // the waiter will be called, it is not set if there was nothing to wait for
+		};
+		
 		namespace EIndexCMDType
 		{
 			enum EIndexCMDType : u_int8_t
@@ -66,24 +86,38 @@ namespace fl {
 				PUT,
 				TOUCH,
 				REMOVE,
+				REMOVE_SUBLEVEL, // removes all items of a sublevel which are older than its tag
 			};
 		};
 		class TopLevelIndex
 		{
 		public:
 			typedef uint8_t TVersion;
-			static const TVersion CURRENT_VERSION = 1;
+			static const TVersion CURRENT_VERSION = 3;
+			static const TVersion FLAGS_VERSION = 2; // the first version which has flags in MetaData
+			// the first version with varint records, whose times are deltas against the base time of the file or 
+			// packet, and with CRC32C after every record
+			static const TVersion RECORDS_VERSION = 3;
 			static const std::string DATA_FILE_NAME;
 			static const std::string HEADER_FILE_NAME;
+			static const std::string CHECKPOINT_FILE_NAME;
+			typedef TLevelFlags TFlags;
+			static const TFlags FL_COMPRESSED = 0x1;
+			static const TFlags FL_ORDERED = 0x2; // items of sublevels are also kept sorted by keys for range queries
+			static const TFlags FL_DENSE = 0x4; // INT32 item keys address the sublevel index directly
+			static const TFlags FL_FSYNC = 0x8; // written data is fdatasync'ed not more often than Index::fsyncPeriod()
+			static const TFlags FL_DURABLE = 0x10; // changes are acknowledged after they have been fdatasync'ed
+			static const TFlags FL_MEMORY = 0x20; // items are not written to disk, but still replicated
 			struct MetaData
 			{
 				bool operator !=(const MetaData &md) const
 				{
-					return (md.subLevelKeyType != subLevelKeyType) || (md.itemKeyType != itemKeyType);
+					return (md.subLevelKeyType != subLevelKeyType) || (md.itemKeyType != itemKeyType) || (md.flags != flags);
 				}
 				uint8_t version;
 				EKeyType subLevelKeyType;
 				EKeyType itemKeyType;
+				TFlags flags;
 			} __attribute__((packed));
 			
 			struct ReplicationPacketHeader
@@ -97,50 +131,199 @@ namespace fl {
 			
 			static TopLevelIndex *createFromDirectory(const std::string &level, class Index *index, const std::string &path);
 			static TopLevelIndex *create(const std::string &level, Index *index, const std::string &path, 
-				const EKeyType subLevelKeyType, const EKeyType itemKeyType);
+				const EKeyType subLevelKeyType, const EKeyType itemKeyType, const TFlags flags);
 			virtual bool load(Buffer &buf, const ItemHeader::TTime curTime) = 0;
 			virtual TItemSharedPtr find(const std::string &subLevel, const std::string &key, 
-				const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime, TTopLevelIndexPtr &selfPointer) = 0;
+				const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime, TTopLevelIndexPtr &selfPointer, 
+				DurableWait *durableWait) = 0;
 			virtual void put(const std::string &subLevel, const std::string &key, TItemSharedPtr &item, 
 				bool checkBeforeReplace) = 0;
 			virtual bool remove(const std::string &subLevel, const std::string &itemKey) = 0;
-			virtual bool removeSubLevel(const std::string &subLevel) = 0;
+			virtual bool removeSubLevel(const std::string &subLevel, const ItemHeader::TTime curTime) = 0;
 			virtual bool touch(const std::string &subLevel, const std::string &itemKey, 
 				const ItemHeader::TTime setTime, const ItemHeader::TTime curTime) = 0;
 			virtual void clearOld(const ItemHeader::TTime curTime) = 0;
 			virtual bool sync(Buffer &buf, const ItemHeader::TTime curTime, bool force) = 0;
 			virtual bool pack(Buffer &buf, const ItemHeader::TTime curTime) = 0;
+			virtual void evictCold(Buffer &buf, const ItemHeader::TTime curTime) = 0;
+			// a step of the hourly maintenance, it packs the level and then evicts its cold items while the budget 
+			// lasts; the next step resumes where this one has stopped, returns true when the level is finished
+			struct MaintenanceBudget
+			{
+				size_t bytes; // of the files to pack
+				size_t items; // to check for the eviction
+			};
+			virtual bool maintain(Buffer &buf, const ItemHeader::TTime curTime, MaintenanceBudget &budget) = 0;
+			typedef std::vector<std::pair<std::string, TItemSharedPtr>> TItemRangeVector;
+			virtual bool findRange(const std::string &subLevel, const std::string &fromKey, const std::string &toKey, 
+				const size_t limit, const ItemHeader::TTime curTime, TItemRangeVector &items) = 0;
 			
 			const MetaData &md() const
 			{
 				return _md;
 			}
+			const bool isPacked() const
+			{
+				return _md.flags & FL_COMPRESSED;
+			}
+			const bool isDense() const
+			{
+				return _md.flags & FL_DENSE;
+			}
+			const bool isOrdered() const
+			{
+				return _md.flags & FL_ORDERED;
+			}
+			const bool isDurable() const
+			{
+				return _md.flags & FL_DURABLE;
+			}
+			const bool isMemoryOnly() const
+			{
+				return _md.flags & FL_MEMORY;
+			}
+			// fdatasync of data written to a FL_FSYNC level, returns false while it is postponed till the period end
+			virtual bool flush() = 0;
+			const bool needFsync() const
+			{
+				return _needFsync;
+			}
+			// group commit: every change queued before nextSyncNumber() is written by the sync with this number, 
+			// all waiters of the sync are woken by its single fdatasync; the number is taken under the packets' lock, 
+			// which the sync holds while it swaps out the packets and increases the number
+			typedef uint64_t TSyncNumber;
+			virtual TSyncNumber nextSyncNumber() = 0;
+			// returns false if the sync has failed to write or fdatasync the changes
+			bool waitDurable(const TSyncNumber syncNumber);
+			// returns false if the sync has already finished and sets written, otherwise the waiter will be called
+			bool parkDurable(const TSyncNumber syncNumber, const DurableWait &wait, bool &written);
+			// the packet's records are in the format of its version
 			virtual bool addFromAnotherServer(const TServerID serverID, Buffer &data, const Buffer::TSize endPacketPos, 
-				const ItemHeader::TTime curTime, Buffer &buffer) = 0;
+				const TVersion version, const ItemHeader::TTime curTime, Buffer &buffer) = 0;
+			// applies a packet of the own replication log on startup, nothing is written again
+			virtual bool replayLog(Buffer &data, const Buffer::TSize endPacketPos, const TVersion version, 
+				const ItemHeader::TTime curTime) = 0;
+			// the unified log mode: replication logs starting from this number are not included in the level's files
+			const TReplicationLogNumber checkpointNumber() const
+			{
+				return _checkpointNumber;
+			}
+			// a dirty level is queued for syncing only once, it returns false if the level is already queued
+			bool markDirty()
+			{
+				return __sync_bool_compare_and_swap(&_dirty, 0, 1);
+			}
+			void resetDirty()
+			{
+				__sync_lock_release(&_dirty);
+			}
+			const uint32_t syncAffinity() const
+			{
+				return _syncAffinity;
+			}
 		protected:
 			std::string _level;
 			class Index *_index;
 			std::string _path;
 			MetaData _md;
+			volatile uint32_t _dirty;
+			uint32_t _syncAffinity; // the level is always synced by the same sync thread
+			bool _needFsync;
+			uint64_t _lastFsyncTime;
+			std::mutex _durableSync;
+			std::condition_variable _durableCond;
+			TSyncNumber _syncNumber; // is guarded by the packets' lock of the level
+			TSyncNumber _durableNumber;
+			TSyncNumber _failedNumber; // of the last failed sync, fdatasync errors can drop the pages of earlier ones
+			struct ParkedWait
+			{
+				TSyncNumber syncNumber;
+				DurableWait wait;
+			};
+			typedef std::vector<ParkedWait> TParkedWaitVector;
+			TParkedWaitVector _parkedWaits; // is guarded by _durableSync
+			TReplicationLogNumber _checkpointNumber;
+			ItemHeader::TTime _baseTime; // of all files and packets written by this instance
+			bool _readCheckpoint();
+			void _saveCheckpoint(const TReplicationLogNumber checkpointNumber);
+			void _setDurable(const TSyncNumber syncNumber, const bool written);
+			const bool _isFsynced() const
+			{
+				return _md.flags & (FL_FSYNC | FL_DURABLE);
+			}
+			bool _fsync(File &file);
+			static uint64_t _monotonicTime(); // in milliseconds
 			
 			static void _formMetaFileName(const std::string &path, BString &metaFileName);
+			static size_t _metaDataSize(const TVersion version);
+			static bool _readMetaData(File &fd, MetaData &md);
+			static void _getMetaData(Buffer &buf, MetaData &md);
+			static bool _readBaseTime(File &fd, const TVersion version, ItemHeader::TTime &baseTime);
+			static ItemHeader::TTime _getBaseTime(Buffer &buf, const TVersion version);
+			static void _addVarInt(Buffer &buf, uint64_t value);
+			static uint64_t _getVarInt(Buffer &buf);
+			void _packItem(TItemSharedPtr &item);
 			static bool _createDataFile(const std::string &path, const u_int32_t curTime, const u_int32_t openNumber, 
-				const MetaData &md, File &dataFile, BString &fileName, const char *prefix = NULL);
+				const MetaData &md, const ItemHeader::TTime baseTime, File &dataFile, BString &fileName, 
+				const char *prefix = NULL);
 			static bool _createHeaderFile(const std::string &path, const u_int32_t curTime, const u_int32_t openNumber, 
-				const MetaData &md, File &dataFile);
+				const MetaData &md, const ItemHeader::TTime baseTime, File &dataFile);
 			static TopLevelIndex *_create(const std::string &path, MetaData &md);
 			typedef std::vector<std::string> TPathVector;
-			static bool _unlink(const TPathVector &fileList);
+			typedef std::vector<struct iovec> TIoVector;
+			bool _unlink(const TPathVector &fileList); // forgets the files' locations
 			static bool _loadFileList(const std::string &path, TPathVector &headersFileList, TPathVector &dataFileList);
 			struct HeaderCMDData
 			{
 				ItemHeader::TTime liveTo;
 				ItemHeader::UTag tag;
 			};
-			void _syncToFile(const Buffer::TSize startSavePos, const Buffer::TSize curPos, Buffer &buf, 
-				Buffer &writeBuffer, File &packedFile, TPathVector &createdFiles, const u_int32_t curTime);
-			void _syncToFile(const Buffer::TDataPtr data, const Buffer::TSize needToWrite, 
-				File &packedFile, TPathVector &createdFiles, const u_int32_t curTime);
+			
+			// read descriptors of the data files which items' locations point to, a file is forgotten when it is unlinked 
+			// and the items which have been written to it are not moved to the cold tier till they are packed again
+			typedef uint32_t TFileNumber;
+			struct LocationFile
+			{
+				TFilePtr file;
+				ino_t inode;
+			};
+			typedef std::map<TFileNumber, LocationFile> TLocationFileMap;
+			TLocationFileMap _locationFiles;
+			TFileNumber _lastLocationFile;
+			Mutex _locationSync;
+			const bool _isTrackingLocations() const;
+			TFileNumber _addLocationFile(const TFilePtr &file); // returns 0 if the file can't be tracked
+			TFileNumber _addLocationFile(const char *path, TFilePtr &file); // opens the file for reading
+			void _forgetLocationFile(const char *path);
+			void _getLocationFiles(TLocationFileMap &files);
+			static Item::TLocation _location(const TFileNumber fileNumber, const off_t offset)
+			{
+				return fileNumber ? ((static_cast<Item::TLocation>(fileNumber) << 32) | offset) : 0;
+			}
+			static TFileNumber _locationFileNumber(const Item::TLocation location)
+			{
+				return location >> 32;
+			}
+			static off_t _locationOffset(const Item::TLocation location)
+			{
+				return location & 0xFFFFFFFF; // data files are not bigger than MAX_FILE_SIZE
+			}
+			
+			// temporary data files written by packing and checkpoints, a new one is started every MAX_FILE_SIZE
+			struct PackedFile
+			{
+				PackedFile()
+					: number(0)
+				{
+				}
+				File file;
+				TFilePtr readFile; // cold items of the file read their data by it
+				TFileNumber number; // 0 - locations of the file's items are not tracked
+				TPathVector createdFiles;
+			};
+			// returns the offset of the data in packedFile.file
+			off_t _syncToFile(const Buffer::TDataPtr data, const Buffer::TSize needToWrite, PackedFile &packedFile, 
+				const u_int32_t curTime);
 			void _renameTempToWork(TPathVector &fileList, const u_int32_t curTime);
 			
 			static const ItemHeader::TTime REMOVED_LIVE_TO = 1;
@@ -150,25 +333,90 @@ namespace fl {
 		class Index
 		{
 		public:
-			Index(const std::string &path);
+			Index(const std::string &path, const size_t shardsCount = 1);
 			~Index();
-			void setAutoCreate(const bool ison, const EKeyType defaultSublevelType, const EKeyType defaultItemKeyType);
-			void startThreads(const uint32_t syncThreadCount);
+			void setAutoCreate(const bool ison, const EKeyType defaultSublevelType, const EKeyType defaultItemKeyType, 
+				const TopLevelIndex::TFlags defaultFlags = 0);
+			void setCompressionThreshold(const ItemHeader::TSize compressionThreshold)
+			{
+				_compressionThreshold = compressionThreshold;
+			}
+			const ItemHeader::TSize compressionThreshold() const
+			{
+				return _compressionThreshold;
+			}
+			void setColdTier(const ItemHeader::TTime coldTime, const bool promoteCold)
+			{
+				_coldTime = coldTime;
+				_promoteCold = promoteCold;
+			}
+			const ItemHeader::TTime coldTime() const
+			{
+				return _coldTime;
+			}
+			const bool isPromoteCold() const
+			{
+				return _promoteCold;
+			}
+			const size_t shardsCount() const
+			{
+				return _shardsCount;
+			}
+			void setFsyncPeriod(const uint32_t fsyncPeriod)
+			{
+				_fsyncPeriod = fsyncPeriod;
+			}
+			const uint32_t fsyncPeriod() const
+			{
+				return _fsyncPeriod;
+			}
+			// all changes are written only to the replication log, hourly checkpoints write the changed items to levels' 
+			// files, which are merged once a checkpoint period
+			void setUnifiedLog(const bool ison);
+			const bool isUnifiedLog() const
+			{
+				return _status & ST_UNIFIED_LOG;
+			}
+			// hourly packing writes snapshots of levels' live items instead of merging their data files
+			void setCheckpointPack(const bool ison);
+			const bool isCheckpointPack() const
+			{
+				return _status & ST_CHECKPOINT_PACK;
+			}
+			void setCheckpointPeriod(const uint32_t checkpointPeriod)
+			{
+				_checkpointPeriod = checkpointPeriod;
+			}
+			const uint32_t checkpointPeriod() const
+			{
+				return _checkpointPeriod;
+			}
+			void startThreads(const uint32_t syncThreadCount, const IoRing::EBackend ioBackend = IoRing::BLOCKING);
+			bool tick(fl::chrono::ETime &curTime);
 			bool hour(fl::chrono::ETime &curTime);
 			
-			bool create(const std::string &level, const EKeyType subLevelKeyType, const EKeyType itemKeyType);
+			bool create(const std::string &level, const EKeyType subLevelKeyType, const EKeyType itemKeyType, 
+				const TopLevelIndex::TFlags flags = 0);
 			bool load(const ItemHeader::TTime curTime);
 			
 			static const bool CHECK_EXISTS = true;
 			static const bool NOT_CHECK_EXISTS = false;
+			// changes of DURABLE levels wait for their sync if durableWait is not set, otherwise they are parked there
 			bool put(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-				TItemSharedPtr &item, bool checkBeforeReplace = NOT_CHECK_EXISTS);
+				TItemSharedPtr &item, bool checkBeforeReplace = NOT_CHECK_EXISTS, DurableWait *durableWait = NULL);
 			TItemSharedPtr find(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-				const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime = 0);
+				const ItemHeader::TTime curTime, const ItemHeader::TTime lifeTime = 0, bool *isPacked = NULL, 
+				DurableWait *durableWait = NULL);
 			bool touch(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
-				const ItemHeader::TTime setTime, const ItemHeader::TTime curTime);
-			bool remove(const std::string &level, const std::string &subLevel, const std::string &itemKey);
-			bool removeSubLevel(const std::string &level, const std::string &subLevel);
+				const ItemHeader::TTime setTime, const ItemHeader::TTime curTime, DurableWait *durableWait = NULL);
+			bool remove(const std::string &level, const std::string &subLevel, const std::string &itemKey, 
+				DurableWait *durableWait = NULL);
+			bool removeSubLevel(const std::string &level, const std::string &subLevel, const ItemHeader::TTime curTime, 
+				DurableWait *durableWait = NULL);
+			// returns items of an ordered level which keys are in [fromKey, toKey], empty keys mean no bounds
+			bool findRange(const std::string &level, const std::string &subLevel, const std::string &fromKey, 
+				const std::string &toKey, const size_t limit, const ItemHeader::TTime curTime, 
+				TopLevelIndex::TItemRangeVector &items, bool *isPacked = NULL);
 			
 			
 			void clearOld(const ItemHeader::TTime curTime);
@@ -180,8 +428,10 @@ namespace fl {
 			}
 			bool sync(const ItemHeader::TTime curTime);
 			bool pack(const ItemHeader::TTime curTime);
+			void evictCold(const ItemHeader::TTime curTime);
 			
 			static EKeyType stringToType(const std::string &type);
+			static TopLevelIndex::TFlags stringToFlag(const std::string &flag);
 			class ConvertError : public fl::exceptions::Error 
 			{
 			public:
@@ -192,7 +442,19 @@ namespace fl {
 				BString _buf;
 			};
 			
-			void addToSync(TTopLevelIndexPtr &topLevel);
+			// a change of a DURABLE level has been made in memory, but it could not be written to the disk
+			class DurableError : public fl::exceptions::Error
+			{
+			public:
+				DurableError(const char *what)
+					: Error(what)
+				{
+				}
+				virtual ~DurableError() throw() {};
+			};
+			// waits for the sync of DURABLE levels or parks the change in durableWait, throws DurableError if the sync 
+			// has already failed
+			void addToSync(TTopLevelIndexPtr &topLevel, DurableWait *durableWait = NULL);
 			
 			const TServerID serverID() const
 			{
@@ -204,6 +466,9 @@ namespace fl {
 			bool startReplication(TServerList &masters);
 			
 			void addToReplicationLog(Buffer &buffer);
+			void addToReplicationLog(const struct iovec *iov, const int count, const size_t size);
+			TReplicationLogNumber replicationLogNumber();
+			bool syncReplicationLog(); // fdatasync of all written replication logs, false on an error
 			bool isReplicating()
 			{
 				return _replicationLogKeepTime > 0;
@@ -236,7 +501,7 @@ namespace fl {
 			class ReplicationLog
 			{
 			public:
-				static const uint8_t CURRENT_VERSION = 1;
+				static const uint8_t CURRENT_VERSION = 2;
 				
 				ReplicationLog(const TReplicationLogNumber number, const char *fileName);
 				bool openForRead();
@@ -245,6 +510,10 @@ namespace fl {
 				{
 					return _number;
 				}
+				const bool isCurrentVersion() const
+				{
+					return _version == CURRENT_VERSION;
+				}
 				const std::string &fileName() const
 				{
 					return _fileName;
@@ -262,9 +531,25 @@ namespace fl {
 				}
 				bool read(const TServerID serverID, Buffer &data, Buffer &buffer, uint32_t &seek);
 				const bool canFit(const uint32_t size);
-				void save(Buffer &buffer);
+				void save(const struct iovec *iov, const int count, const size_t size);
+				const bool needSync() const
+				{
+					return _needSync;
+				}
+				bool sync();
+				void truncate(const uint32_t size);
 				
 			private:
+				static const uint8_t FLAGS_VERSION = 2; // the first version whose packets have flags in MetaData
+				struct PacketHeaderV1
+				{
+					TServerID serverID;
+					uint8_t version;
+					EKeyType subLevelKeyType;
+					EKeyType itemKeyType;
+					uint32_t packetSize;
+				} __attribute__((packed));
+				void _getPacketHeader(Buffer &buffer, TopLevelIndex::ReplicationPacketHeader &rph);
 				bool _checkHeader(File &fd);
 				TReplicationLogNumber _number;
 				u_int8_t _version;
@@ -273,6 +558,9 @@ namespace fl {
 				uint32_t _fileSize;
 				File _writeFd;
 				fl::threads::ReadWriteLock _sync;
+				volatile bool _needSync;
+				bool _syncFailed; // pages of a failed fdatasync can be dropped, later calls can't write them
+				Mutex _fsyncSync;
 			};
 			typedef std::shared_ptr<ReplicationLog>  TReplicationLogPtr;
 			TReplicationLogPtr _currentReplicationLog;
@@ -282,21 +570,50 @@ namespace fl {
 			TReplicationLogVector _replicationLogFiles;
 			bool _openReplicationFiles();
 			bool _openCurrentReplicationLog();
+			bool _replayReplicationLog(const ItemHeader::TTime curTime);
+			bool _replayPackets(const TReplicationLogNumber number, Buffer &data, const ItemHeader::TTime curTime, 
+				Buffer::TSize &brokenPacketPos);
 			Mutex _replicationSync;
 			
 			
 			typedef uint8_t TStatus;
 			TStatus _status;
 			static const TStatus ST_AUTO_CREATE = 0x1;
+			static const TStatus ST_UNIFIED_LOG = 0x2;
+			static const TStatus ST_CHECKPOINT_PACK = 0x4;
 			EKeyType _subLevelKeyType;
 			EKeyType _itemKeyType;
+			TopLevelIndex::TFlags _flags;
+			ItemHeader::TSize _compressionThreshold;
+			ItemHeader::TTime _coldTime;
+			bool _promoteCold;
+			// every level splits its sublevels between this number of independently locked shards, it is lock 
+			// striping only, all threads can work with all shards
+			size_t _shardsCount;
+			uint32_t _fsyncPeriod; // milliseconds between fdatasync calls of FL_FSYNC levels
+			uint32_t _checkpointPeriod; // hours between full rewrites of levels' files
 			
 			typedef std::string TTopLevelKey;
 			typedef unordered_map<TTopLevelKey, TTopLevelIndexPtr> TTopLevelIndex;
 			TTopLevelIndex _index;
 			Mutex _sync;
 			
+			void _maintain(const ItemHeader::TTime curTime);
+			typedef std::vector<TTopLevelKey> TTopLevelKeyVector;
+			TTopLevelKeyVector _maintenanceQueue; // levels waiting for the hourly pack, guarded by _hourlySync
+			ItemHeader::TTime _maintenanceEnd;
+			// requests are counted by threads in their own cache lines and summed by the time thread
+			static const size_t OPERATION_COUNTERS = 64;
+			struct OperationCounter;
+			std::unique_ptr<OperationCounter[]> _operations;
+			void _countOperation();
+			uint64_t _sumOperations();
+			uint64_t _lastOperations;
+			ItemHeader::TTime _lastMaintenanceTime;
+			double _averageLoad;
+			
 			fl::threads::TimeThread *_timeThread;
+			static const uint32_t TIME_THREAD_PRECISION = 10;
 			
 			typedef std::vector<class IndexSyncThread*> TSyncThreadVector;
 			TSyncThreadVector _syncThreads;
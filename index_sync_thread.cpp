@@ -8,13 +8,18 @@
 // Description: Index's data to disk synchronization thread class
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <unistd.h>
+#include <algorithm>
+
 #include "index_sync_thread.hpp"
 #include "index.hpp"
+#include "io_ring.hpp"
 #include "nomos_log.hpp"
 
 using namespace fl::nomos;
 
-IndexSyncThread::IndexSyncThread()
+IndexSyncThread::IndexSyncThread(const bool useIoRing)
+	: _useIoRing(useIoRing)
 {
 	static const uint32_t SYNC_THREAD_STACK_SIZE = 100000;
 	setStackSize(SYNC_THREAD_STACK_SIZE);
@@ -37,6 +42,14 @@ void IndexSyncThread::run()
 {
 	fl::chrono::Time curTime;
 	Buffer buf(MAX_BUF_SIZE + 1);
+	IoRing ioRing;
+	if (_useIoRing) {
+		static const uint32_t IO_RING_ENTRIES = 64;
+		if (ioRing.init(IO_RING_ENTRIES))
+			IoRing::setThreadRing(&ioRing);
+		else
+			log::Warning::L("io_uring is not available, the sync thread uses blocking writes\n");
+	}
 	while (true)
 	{
 		TTopLevelVector workItems;
@@ -45,17 +58,51 @@ void IndexSyncThread::run()
 		_sync.unLock();
 		if (workItems.empty())
 		{
-			_cond.waitSignal();
+			if (_needFsyncLevels.empty()) {
+				_cond.waitSignal();
+				continue;
+			}
+			static const uint32_t FSYNC_CHECK_DELAY = 1000; // microseconds
+			usleep(FSYNC_CHECK_DELAY);
+			_flush();
 			continue;
 		}
 		curTime.update();
+		bool synced = false;
 		for (auto level = workItems.begin(); level != workItems.end(); level++) {
-			if (!(*level)->sync(buf, curTime.unix(), false))	{
+			(*level)->resetDirty(); // changes made during the syncing will queue the level again
+			if ((*level)->sync(buf, curTime.unix(), false)) {
+				synced = true;
+				if ((*level)->needFsync())
+					_addNeedFsync(*level);
+			}
+			else if ((*level)->markDirty()) { // the level is locked by packing or evicting, retry later
 				_sync.lock();
 				_needSyncLevels.push_back(*level);
 				_sync.unLock();
 			}
 		}
+		_flush();
+		if (!synced) {
+			static const uint32_t RETRY_SYNC_DELAY = 10000; // microseconds
+			usleep(RETRY_SYNC_DELAY);
+		}
+	}
+}
+
+void IndexSyncThread::_addNeedFsync(TTopLevelIndexPtr &topLevel)
+{
+	if (std::find(_needFsyncLevels.begin(), _needFsyncLevels.end(), topLevel) == _needFsyncLevels.end())
+		_needFsyncLevels.push_back(topLevel);
+}
+
+void IndexSyncThread::_flush()
+{
+	for (auto level = _needFsyncLevels.begin(); level != _needFsyncLevels.end(); ) {
+		if ((*level)->flush())
+			level = _needFsyncLevels.erase(level);
+		else
+			level++;
 	}
 }
 
@@ -25,15 +25,19 @@ namespace fl {
 		class IndexSyncThread : public fl::threads::Thread
 		{
 		public:
-			IndexSyncThread();
+			IndexSyncThread(const bool useIoRing);
 			virtual ~IndexSyncThread() {}
 			void add(TTopLevelIndexPtr &topLevel);
 		private:
 			virtual void run();
+			bool _useIoRing; // files' writes of the thread's levels are batched in its io_uring
 			fl::threads::CondMutex _cond;
 			Mutex _sync;
 			typedef std::vector<TTopLevelIndexPtr> TTopLevelVector;
 			TTopLevelVector _needSyncLevels;
+			TTopLevelVector _needFsyncLevels; // FL_FSYNC levels which fdatasync is postponed, used only by the thread
+			void _addNeedFsync(TTopLevelIndexPtr &topLevel);
+			void _flush();
 		};
 	};
 };
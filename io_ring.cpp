@@ -0,0 +1,287 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: io_uring based writing of levels' files
+///////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <strings.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include "io_ring.hpp"
+#include "nomos_log.hpp"
+
+using namespace fl::nomos;
+
+__thread IoRing *IoRing::_threadRing = NULL;
+uint64_t IoRing::_completedWrites = 0;
+
+bool IoRing::stringToBackend(const std::string &str, EBackend &backend)
+{
+	if (!strcasecmp(str.c_str(), "blocking"))
+		backend = BLOCKING;
+	else if (!strcasecmp(str.c_str(), "uring"))
+		backend = URING;
+	else
+		return false;
+	return true;
+}
+
+IoRing::IoRing()
+	: _arenaChunk(0), _arenaUsed(0), _unsubmittedBytes(0), _fd(-1), _sqRing(MAP_FAILED), _sqRingSize(0), _cqRing(MAP_FAILED),
+	_cqRingSize(0), _sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), _sqesSize(0), _entries(0), _sqTail(NULL),
+	_sqMask(0), _sqArray(NULL), _sqLocalTail(0), _cqHead(NULL), _cqTail(NULL), _cqMask(0), _cqes(NULL), _unsubmitted(0), _inFlight(0), 
+	_failed(false)
+{
+}
+
+IoRing::~IoRing()
+{
+	_close();
+}
+
+bool IoRing::init(const uint32_t entries)
+{
+	struct io_uring_params params;
+	bzero(&params, sizeof(params));
+	_fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (_fd < 0) {
+		log::Warning::L("Can't create io_uring (%d)\n", errno);
+		_fd = -1;
+		return false;
+	}
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) { // both rings are in one mapping
+		if (_cqRingSize > _sqRingSize)
+			_sqRingSize = _cqRingSize;
+		_cqRingSize = 0;
+	}
+	_sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	if (_sqRing == MAP_FAILED) {
+		log::Error::L("Can't map io_uring submission queue (%d)\n", errno);
+		_close();
+		return false;
+	}
+	if (_cqRingSize) {
+		_cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+		if (_cqRing == MAP_FAILED) {
+			log::Error::L("Can't map io_uring completion queue (%d)\n", errno);
+			_close();
+			return false;
+		}
+	}
+	_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	_sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+	if (_sqes == MAP_FAILED) {
+		log::Error::L("Can't map io_uring entries (%d)\n", errno);
+		_close();
+		return false;
+	}
+	char *sq = static_cast<char*>(_sqRing);
+	char *cq = static_cast<char*>(_cqRingSize ? _cqRing : _sqRing);
+	_sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+	_sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+	_sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+	_sqLocalTail = *_sqTail;
+	_cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+	_cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+	_entries = params.sq_entries;
+	return true;
+}
+
+void IoRing::_close()
+{
+	if (_sqes != MAP_FAILED)
+		munmap(_sqes, _sqesSize);
+	_sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+	if (_cqRing != MAP_FAILED)
+		munmap(_cqRing, _cqRingSize);
+	_cqRing = MAP_FAILED;
+	if (_sqRing != MAP_FAILED)
+		munmap(_sqRing, _sqRingSize);
+	_sqRing = MAP_FAILED;
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+	_unsubmitted = 0;
+	_inFlight = 0;
+	if (_threadRing == this) // the thread continues with blocking writes
+		_threadRing = NULL;
+}
+
+char *IoRing::_alloc(const size_t size)
+{
+	const size_t alignedSize = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	for (; _arenaChunk < _arena.size(); _arenaChunk++) {
+		ArenaChunk &chunk = _arena[_arenaChunk];
+		if ((_arenaUsed + alignedSize) <= chunk.size) {
+			char *data = chunk.data.get() + _arenaUsed;
+			_arenaUsed += alignedSize;
+			return data;
+		}
+		_arenaUsed = 0;
+	}
+	ArenaChunk chunk;
+	chunk.size = (alignedSize > ARENA_CHUNK_SIZE) ? alignedSize : ARENA_CHUNK_SIZE;
+	chunk.data.reset(new char[chunk.size]);
+	_arena.push_back(std::move(chunk));
+	_arenaUsed = alignedSize;
+	return _arena.back().data.get();
+}
+
+void IoRing::_resetArena()
+{
+	_arenaChunk = 0;
+	_arenaUsed = 0;
+	_unsubmittedBytes = 0;
+}
+
+void *IoRing::copy(const void *data, const size_t size)
+{
+	char *copy = _alloc(size);
+	memcpy(copy, data, size);
+	return copy;
+}
+
+bool IoRing::write(const int fd, const off_t offset, const void *data, const size_t size)
+{
+	struct iovec iov = {copy(data, size), size};
+	return writeRef(fd, offset, &iov, 1);
+}
+
+bool IoRing::writeRef(const int fd, const off_t offset, const struct iovec *iov, const int count)
+{
+	if (_fd < 0)
+		return false;
+	if (((_unsubmitted + _inFlight) >= _entries) && !_wait(_entries - 1))
+		return false;
+	struct iovec *vec = reinterpret_cast<struct iovec*>(_alloc(sizeof(struct iovec) * count));
+	size_t size = 0;
+	for (int i = 0; i < count; i++) {
+		vec[i] = iov[i];
+		size += iov[i].iov_len;
+	}
+	_queue(IORING_OP_WRITEV, fd, offset, vec, count, size);
+	_unsubmittedBytes += size;
+	if (_unsubmittedBytes < SUBMIT_BYTES)
+		return true;
+	_unsubmittedBytes = 0;
+	return _wait(_entries);
+}
+
+void IoRing::fsync(const int fd)
+{
+	if (std::find(_fsyncFds.begin(), _fsyncFds.end(), fd) == _fsyncFds.end())
+		_fsyncFds.push_back(fd);
+}
+
+void IoRing::_queue(const uint8_t opcode, const int fd, const off_t offset, const struct iovec *iov, 
+	const uint32_t count, const uint64_t size)
+{
+	const uint32_t index = _sqLocalTail & _sqMask;
+	struct io_uring_sqe &sqe = _sqes[index];
+	bzero(&sqe, sizeof(sqe));
+	sqe.opcode = opcode;
+	sqe.fd = fd;
+	if (opcode == IORING_OP_FSYNC) {
+		sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+	} else {
+		sqe.off = offset;
+		sqe.addr = reinterpret_cast<uint64_t>(iov);
+		sqe.len = count;
+	}
+	sqe.user_data = size; // the expected result
+	_sqArray[index] = index;
+	_sqLocalTail++;
+	_unsubmitted++;
+}
+
+bool IoRing::submit()
+{
+	if (_fd < 0)
+		return false;
+	bool res = _wait(0);
+	if (res && !_fsyncFds.empty()) { // all writes have completed, the files are flushed in parallel
+		for (auto fd = _fsyncFds.begin(); res && (fd != _fsyncFds.end()); fd++) {
+			if (((_unsubmitted + _inFlight) >= _entries) && !_wait(_entries - 1))
+				res = false;
+			else
+				_queue(IORING_OP_FSYNC, *fd, 0, NULL, 0, 0);
+		}
+		if (!_wait(0))
+			res = false;
+	}
+	if (_failed)
+		res = false;
+	_failed = false;
+	_fsyncFds.clear();
+	_resetArena();
+	return res;
+}
+
+void IoRing::cancel()
+{
+	if (_fd >= 0) // the sent entries point to the arena and to the caller's memory
+		_wait(0);
+	_failed = false;
+	_fsyncFds.clear();
+	_resetArena();
+}
+
+// sends the queued entries to the kernel and reaps the completions till no more than maxInFlight are left
+bool IoRing::_wait(const uint32_t maxInFlight)
+{
+	__atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+	while (_unsubmitted || (_inFlight > maxInFlight)) {
+		const uint32_t pending = _unsubmitted + _inFlight;
+		const uint32_t minComplete = (pending > maxInFlight) ? pending - maxInFlight : 0;
+		int submitted = syscall(__NR_io_uring_enter, _fd, _unsubmitted, minComplete, 
+			minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (submitted < 0) {
+			if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+				log::Fatal::L("Can't submit to io_uring (%d)\n", errno);
+				_close();
+				return false;
+			}
+			submitted = 0;
+		}
+		_unsubmitted -= submitted;
+		_inFlight += submitted;
+		_reap();
+	}
+	return true;
+}
+
+void IoRing::_reap()
+{
+	uint32_t head = *_cqHead;
+	const uint32_t tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		const struct io_uring_cqe &cqe = _cqes[head & _cqMask];
+		if (cqe.res != static_cast<int64_t>(cqe.user_data)) {
+			if (cqe.res < 0)
+				log::Error::L("io_uring request has failed (%d)\n", -cqe.res);
+			else
+				log::Error::L("io_uring has written %d bytes of %llu\n", cqe.res,
+					static_cast<unsigned long long>(cqe.user_data));
+			_failed = true;
+		} else if (cqe.user_data) { // fdatasync entries expect 0
+			__atomic_add_fetch(&_completedWrites, 1, __ATOMIC_RELAXED);
+		}
+		_inFlight--;
+	}
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef __FL_NOMOS_IO_RING_HPP
+#define	__FL_NOMOS_IO_RING_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: io_uring based writing of levels' files
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace fl {
+	namespace nomos {
+
+		// Every write is an entry with an explicit file offset, the entries are sent to the kernel while the next ones
+		// are prepared, so all writes of a sync are in flight at the same time. write() copies the data, writeRef() 
+		// keeps pointers to the caller's memory, which has to stay unchanged till submit() or cancel() returns. 
+		// submit() waits for the writes and then runs fdatasync of the requested files in parallel. A ring is used only 
+		// by its own thread, liburing is not required
+		class IoRing
+		{
+		public:
+			enum EBackend : uint8_t
+			{
+				BLOCKING = 0,
+				URING,
+			};
+			static bool stringToBackend(const std::string &str, EBackend &backend);
+
+			IoRing();
+			~IoRing();
+			bool init(const uint32_t entries); // returns false if the kernel does not support io_uring
+			bool write(const int fd, const off_t offset, const void *data, const size_t size);
+			bool writeRef(const int fd, const off_t offset, const struct iovec *iov, const int count);
+			void *copy(const void *data, const size_t size); // the copy is kept till submit() or cancel() returns
+			void fsync(const int fd);
+			bool submit(); // returns false if any of the writes or fdatasync calls has failed
+			void cancel(); // waits for the queued writes and drops their results
+			
+			// successful writes of all rings
+			static uint64_t completedWrites()
+			{
+				return __atomic_load_n(&_completedWrites, __ATOMIC_RELAXED);
+			}
+
+			static IoRing *threadRing()
+			{
+				return _threadRing;
+			}
+			static void setThreadRing(IoRing *ring)
+			{
+				_threadRing = ring;
+			}
+			IoRing(const IoRing &) = delete;
+		private:
+			// keeps the copies and the iovecs of the queued writes, the chunks are never moved and are reused 
+			// after submit()
+			struct ArenaChunk
+			{
+				std::unique_ptr<char[]> data;
+				size_t size;
+			};
+			typedef std::vector<ArenaChunk> TArenaChunkVector;
+			TArenaChunkVector _arena;
+			size_t _arenaChunk;
+			size_t _arenaUsed;
+			static const size_t ARENA_CHUNK_SIZE = 1024 * 1024;
+			static const size_t ARENA_ALIGN = 16;
+			char *_alloc(const size_t size);
+			void _resetArena();
+			
+			std::vector<int> _fsyncFds;
+			size_t _unsubmittedBytes;
+			static const size_t SUBMIT_BYTES = 256 * 1024; // queued writes are sent without waiting after this size
+			void _queue(const uint8_t opcode, const int fd, const off_t offset, const struct iovec *iov, 
+				const uint32_t count, const uint64_t size);
+			bool _wait(const uint32_t maxInFlight);
+			void _reap();
+			void _close();
+
+			int _fd;
+			void *_sqRing;
+			size_t _sqRingSize;
+			void *_cqRing;
+			size_t _cqRingSize;
+			struct io_uring_sqe *_sqes;
+			size_t _sqesSize;
+			uint32_t _entries;
+			uint32_t *_sqTail;
+			uint32_t _sqMask;
+			uint32_t *_sqArray;
+			uint32_t _sqLocalTail;
+			uint32_t *_cqHead;
+			uint32_t *_cqTail;
+			uint32_t _cqMask;
+			struct io_uring_cqe *_cqes;
+			uint32_t _unsubmitted; // queued, but not sent to the kernel
+			uint32_t _inFlight; // sent to the kernel, but not completed
+			bool _failed; // a write has failed since the last submit
+			static uint64_t _completedWrites;
+			static __thread IoRing *_threadRing;
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_IO_RING_HPP
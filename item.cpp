@@ -12,58 +12,232 @@
 #include <cstdlib>
 
 #include "item.hpp"
+#include "item_memory.hpp"
 #include "nomos_log.hpp"
+#include "file.hpp"
 
 using namespace fl::nomos;
 
 Item::Item()
-	: _data(NULL)
+	: _data(NULL), _accessTime(0), _status(0), _fingerprint(0), _location(0)
 {
 	bzero(&_header, sizeof(_header));
 }
 
 Item::Item(const char *data, const ItemHeader &header)
-	: _header(header), _data(malloc(_header.size))
+	: _header(header), _accessTime(0), _status(0), _fingerprint(0), _location(0)
 {
-	if (!_data)
-	{
-		log::Fatal::L("Can't allocate data for item\n");
-		throw std::bad_alloc();
-	}
-	memcpy(_data, data, _header.size);
+	_allocData();
+	memcpy(this->data(), data, _header.size);
 }
 
 Item::Item(const char *data, const ItemHeader::TSize size, const ItemHeader::TTime liveTo, const ItemHeader::TTime curTime)
-	: _data(malloc(size))
+	: _accessTime(curTime), _status(0), _fingerprint(0), _location(0)
 {
-	if (!_data)
-	{
-		log::Fatal::L("Can't allocate data for item\n");
-		throw std::bad_alloc();
-	}
-	memcpy(_data, data, size);
 	bzero(&_header, sizeof(_header));
 	_header.size = size;
 	_header.liveTo = liveTo;
 	_header.setTag(curTime);
+	_allocData();
+	memcpy(this->data(), data, size);
 }
 	
 Item::~Item()
 {
-	free(_data);
+	_freeData();
+}
+
+void Item::_allocData()
+{
+	if (_header.size <= INLINE_DATA_SIZE) {
+		_status |= ST_INLINE;
+		return;
+	}
+	_data = ItemMemory::alloc(_header.size);
+	if (!_data)
+	{
+		log::Fatal::L("Can't allocate data for item\n");
+		throw std::bad_alloc();
+	}
+}
+
+void Item::_freeData()
+{
+	if (isCold())
+		delete static_cast<ColdLocation*>(_data);
+	else if (!isInline())
+		ItemMemory::free(_data);
+	_status &= ~(ST_COLD | ST_INLINE);
+	_data = NULL;
 }
 
+Item *Item::createCold(const ItemHeader &header, const TFilePtr &file, const off_t offset)
+{
+	Item *item = new Item();
+	item->_header = header;
+	item->_data = new ColdLocation({file, offset});
+	item->_status |= ST_COLD;
+	return item;
+}
+
+bool Item::read(void *to) const
+{
+	if (!isCold()) {
+		memcpy(to, _dataPtr(), _header.size);
+		return true;
+	}
+	ColdLocation *location = static_cast<ColdLocation*>(_data);
+	if (location->file->pread(to, _header.size, location->offset) != (ssize_t)_header.size) {
+		log::Error::L("Can't read cold item data (%u/%lld)\n", _header.size, (long long)location->offset);
+		return false;
+	}
+	return true;
+}
+
+Item *Item::load() const
+{
+	Item *item = new Item();
+	item->_header = _header;
+	item->_allocData();
+	if (!read(item->data())) {
+		delete item;
+		return NULL;
+	}
+	item->_accessTime = _accessTime;
+	item->_location = location(); // can be moved back without writing it again
+	return item;
+}
+
+void Item::attachData(TMemPtr data, const ItemHeader &header)
+{
+	_freeData();
+	_location = 0;
+	_fingerprint = 0;
+	_header = header;
+	if (_header.size <= INLINE_DATA_SIZE) { // small data is moved into the item to release the allocation
+		memcpy(_inlineData, data, _header.size);
+		ItemMemory::free(data);
+		_status |= ST_INLINE;
+	}
+	else
+		_data = data;
+}
+
+static u_int64_t maxObservedTag = 0; // the greatest of observed tags, it is written only by observeTag
+
 void ItemHeader::setTag(const TTime curTime)
 {
-	static decltype(timeTag._opNumber) opNumber;
-	timeTag._time = curTime;
-	timeTag._opNumber = __sync_add_and_fetch(&opNumber, 1);
+	static u_int32_t threadsCount = 0;
+	static __thread u_int64_t threadID = 0;
+	static __thread u_int64_t lastTag = 0; // the greatest tag issued by the thread
+	if (!threadID)
+		threadID = (__sync_add_and_fetch(&threadsCount, 1) % ((1 << TAG_THREAD_BITS) - 1)) + 1;
+	
+	UTag clockTag;
+	clockTag._time = curTime;
+	clockTag._opNumber = 0;
+	u_int64_t last = lastTag;
+	const u_int64_t observed = __atomic_load_n(&maxObservedTag, __ATOMIC_RELAXED); // the line is rarely written
+	if (observed > last)
+		last = observed;
+	u_int64_t tag = clockTag.tag;
+	if (last >= tag) // the clock is behind, advance the logical part
+		tag = ((last >> TAG_THREAD_BITS) + 1) << TAG_THREAD_BITS;
+	tag |= threadID;
+	lastTag = tag;
+	timeTag.tag = tag;
+}
+
+void ItemHeader::observeTag(const UTag &tag)
+{
+	u_int64_t observed = maxObservedTag;
+	while (tag.tag > observed) {
+		if (__sync_bool_compare_and_swap(&maxObservedTag, observed, tag.tag))
+			return;
+		observed = maxObservedTag;
+	}
+}
+
+static inline uint64_t rotl64(const uint64_t value, const int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// xxHash64: four independent lanes are processed per 32 bytes, which compilers vectorize well
+Item::TFingerprint Item::calcFingerprint(const void *data, const ItemHeader::TSize size)
+{
+	static const uint64_t PRIME1 = 11400714785074694791ULL;
+	static const uint64_t PRIME2 = 14029467366897019727ULL;
+	static const uint64_t PRIME3 = 1609587929392839161ULL;
+	static const uint64_t PRIME4 = 9650029242287828579ULL;
+	static const uint64_t PRIME5 = 2870177450012600261ULL;
+	
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+	const uint8_t *end = p + size;
+	uint64_t hash;
+	if (size >= 32) {
+		uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+		const uint8_t *limit = end - 32;
+		do {
+			for (int i = 0; i < 4; i++, p += 8)
+				lanes[i] = rotl64(lanes[i] + read64(p) * PRIME2, 31) * PRIME1;
+		} while (p <= limit);
+		hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+		for (int i = 0; i < 4; i++)
+			hash = (hash ^ (rotl64(lanes[i] * PRIME2, 31) * PRIME1)) * PRIME1 + PRIME4;
+	}	else {
+		hash = PRIME5;
+	}
+	hash += size;
+	for (; (p + 8) <= end; p += 8)
+		hash = rotl64(hash ^ (rotl64(read64(p) * PRIME2, 31) * PRIME1), 27) * PRIME1 + PRIME4;
+	if ((p + 4) <= end) {
+		hash = rotl64(hash ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		hash = rotl64(hash ^ (*p * PRIME5), 11) * PRIME1;
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+// is calculated by the first comparison, which is made under the lock of the item's shard like all of them
+void Item::_setFingerprint() const
+{
+	_fingerprint = calcFingerprint(_dataPtr(), _header.size);
+	if (!_fingerprint) // 0 is reserved for cold items
+		_fingerprint = 1;
 }
 
 const bool Item::equal(Item *item) const
 {
-	if (_header.size != item->_header.size)
+	if ((_header.size != item->_header.size) || isCold() || item->isCold() || (fingerprint() != item->fingerprint()))
+		return false;
+	return !memcmp(_dataPtr(), item->_dataPtr(), _header.size); // different data can have the same fingerprint
+}
+
+const bool Item::equal(const void *data, const ItemHeader::TSize size) const
+{
+	if ((_header.size != size) || isCold() || (fingerprint() != calcFingerprint(data, size)))
 		return false;
-	return (memcmp(_data, item->_data, _header.size) == 0);
+	return !memcmp(_dataPtr(), data, size);
 }
 
@@ -14,9 +14,16 @@
 
 #include <cstdint>
 #include <memory>
+#include <cstring>
+#include <new>
+#include <sys/types.h>
 
 namespace fl {
+	namespace fs {
+		class File;
+	};
 	namespace nomos {
+		typedef std::shared_ptr<fl::fs::File> TFilePtr;
 		
 		struct ItemHeader
 		{
@@ -34,7 +41,12 @@ namespace fl {
 				u_int64_t tag;
 			};
 			UTag timeTag;
+			// hybrid logical clock: tags are greater than the thread's previous tags and all observed ones, 
+			// low bits of _opNumber keep a thread number to make tags of different threads unique. 
+			// Changes of one item made by different threads are ordered under the level's lock
 			void setTag(const TTime curTime);
+			static void observeTag(const UTag &tag);
+			static const u_int32_t TAG_THREAD_BITS = 8;
 		};
 		
 		class Item
@@ -47,10 +59,44 @@ namespace fl {
 			
 			Item(const Item &item) = delete;
 			Item(Item &&item)
-				: _header(item._header), _data(item._data)
+				: _header(item._header), _accessTime(item._accessTime), _status(item._status), 
+				_fingerprint(item._fingerprint), _location(item.location())
 			{
+				memcpy(_inlineData, item._inlineData, sizeof(_inlineData));
 				item._data = NULL;
 				item._header.size = 0;
+				item._status = 0;
+			}
+			// cold items keep only header and position of their data in a data file
+			static Item *createCold(const ItemHeader &header, const TFilePtr &file, const off_t offset);
+			const bool isCold() const
+			{
+				return _status & ST_COLD;
+			}
+			const bool isInline() const
+			{
+				return _status & ST_INLINE;
+			}
+			bool read(void *to) const;
+			Item *load() const;
+			// where the data is in a level's data file: its number in the high half and the offset in the low one, 
+			// 0 - it has not been written yet. Items which have it are moved to the cold tier without reading the file
+			typedef uint64_t TLocation;
+			const TLocation location() const
+			{
+				return __atomic_load_n(&_location, __ATOMIC_RELAXED);
+			}
+			void setLocation(const TLocation location) // is set by the sync thread after the data has been written
+			{
+				__atomic_store_n(&_location, location, __ATOMIC_RELAXED);
+			}
+			const ItemHeader::TTime accessTime() const
+			{
+				return _accessTime;
+			}
+			void setAccessTime(const ItemHeader::TTime accessTime)
+			{
+				_accessTime = accessTime;
 			}
 			const bool isValid(const ItemHeader::TTime curTime)
 			{
@@ -77,22 +123,224 @@ namespace fl {
 			typedef void *TMemPtr;
 			TMemPtr data()
 			{
-				return _data;
+				if (isCold())
+					return NULL;
+				return isInline() ? _inlineData : _data;
 			}
 			const ItemHeader::TSize size() const
 			{
 				return _header.size;
 			}
+			typedef uint64_t TFingerprint;
+			const TFingerprint fingerprint() const // hash of the data, is calculated when it is compared first
+			{
+				if (!_fingerprint && !isCold())
+					_setFingerprint();
+				return _fingerprint;
+			}
+			static TFingerprint calcFingerprint(const void *data, const ItemHeader::TSize size);
 			const bool equal(Item *item) const;
+			const bool equal(const void *data, const ItemHeader::TSize size) const;
 			void setHeader(const ItemHeader &header)
 			{
 				_header = header;
 			}
+			void attachData(TMemPtr data, const ItemHeader &header); // takes ownership of data from ItemMemory::alloc
+			static const ItemHeader::TSize INLINE_DATA_SIZE = 16;
 		private:
+			struct ColdLocation
+			{
+				TFilePtr file;
+				off_t offset;
+			};
 			ItemHeader _header;
-			TMemPtr _data;
+			union
+			{
+				TMemPtr _data; // ColdLocation for cold items
+				char _inlineData[INLINE_DATA_SIZE]; // small data (flags, counters) is kept in the item without allocations
+			};
+			ItemHeader::TTime _accessTime;
+			typedef uint8_t TStatus;
+			TStatus _status;
+			static const TStatus ST_COLD = 0x1;
+			static const TStatus ST_INLINE = 0x2;
+			void _allocData();
+			void _freeData();
+			const void *_dataPtr() const
+			{
+				return isInline() ? _inlineData : _data;
+			}
+			mutable TFingerprint _fingerprint; // 0 - is not calculated yet or a cold item, cold items are never equal
+			void _setFingerprint() const;
+			TLocation _location;
 		};
 		typedef std::shared_ptr<Item> TItemSharedPtr;
+		
+		// a value of the level index: small hot items keep their header and data in the slot itself, without 
+		// a separate Item and its shared pointer, bigger and cold ones are kept as shared items
+		class ItemSlot
+		{
+		public:
+			ItemSlot()
+				: _isInline(false)
+			{
+				new (&_item) TItemSharedPtr();
+			}
+			ItemSlot(const TItemSharedPtr &item)
+				: _isInline(false)
+			{
+				new (&_item) TItemSharedPtr();
+				*this = item;
+			}
+			ItemSlot(const ItemSlot &slot)
+				: _isInline(false)
+			{
+				new (&_item) TItemSharedPtr();
+				*this = slot;
+			}
+			~ItemSlot()
+			{
+				if (!_isInline)
+					_item.~TItemSharedPtr();
+			}
+			ItemSlot &operator=(const ItemSlot &slot)
+			{
+				if (slot._isInline) {
+					_setInline();
+					_inline = slot._inline;
+				} else {
+					_setShared();
+					_item = slot._item;
+				}
+				return *this;
+			}
+			ItemSlot &operator=(const TItemSharedPtr &item)
+			{
+				if (item && !item->isCold() && (item->size() <= Item::INLINE_DATA_SIZE)) {
+					set(static_cast<const char*>(item->data()), item->header());
+				} else {
+					_setShared();
+					_item = item;
+				}
+				return *this;
+			}
+			void set(const char *data, const ItemHeader &header)
+			{
+				if (header.size > Item::INLINE_DATA_SIZE) {
+					*this = std::make_shared<Item>(data, header);
+					return;
+				}
+				_setInline();
+				_inline.header = header;
+				memcpy(_inline.data, data, header.size);
+			}
+			void reset(Item *item)
+			{
+				_setShared();
+				_item.reset(item);
+			}
+			const bool empty() const
+			{
+				return !_isInline && !_item;
+			}
+			const bool isInline() const
+			{
+				return _isInline;
+			}
+			const bool isCold() const
+			{
+				return !_isInline && _item->isCold();
+			}
+			Item *get() const // NULL for inline items
+			{
+				return _isInline ? NULL : _item.get();
+			}
+			TItemSharedPtr item() const // inline items are copied to a new one
+			{
+				if (_isInline)
+					return std::make_shared<Item>(_inline.data, _inline.header);
+				return _item;
+			}
+			bool operator==(const TItemSharedPtr &item) const
+			{
+				return !_isInline && (_item == item);
+			}
+			const ItemHeader &header() const
+			{
+				return _isInline ? _inline.header : _item->header();
+			}
+			void setHeader(const ItemHeader &header)
+			{
+				if (_isInline)
+					_inline.header = header;
+				else
+					_item->setHeader(header);
+			}
+			const bool isValid(const ItemHeader::TTime curTime) const
+			{
+				const ItemHeader::TTime liveTo = header().liveTo;
+				return !liveTo || (liveTo > curTime);
+			}
+			void setDeleted()
+			{
+				if (_isInline)
+					_inline.header.liveTo = 1;
+				else
+					_item->setDeleted();
+			}
+			void setLiveTo(const ItemHeader::TTime setTime, const ItemHeader::TTime curTime)
+			{
+				if (_isInline) {
+					_inline.header.liveTo = setTime;
+					_inline.header.setTag(curTime);
+				} else
+					_item->setLiveTo(setTime, curTime);
+			}
+			void setAccessTime(const ItemHeader::TTime accessTime) // inline items are not moved to the cold tier
+			{
+				if (!_isInline)
+					_item->setAccessTime(accessTime);
+			}
+			const bool equal(Item *item) const
+			{
+				if (!_isInline)
+					return _item->equal(item);
+				return (_inline.header.size == item->size()) && !item->isCold() 
+					&& !memcmp(_inline.data, item->data(), _inline.header.size);
+			}
+			const bool equal(const void *data, const ItemHeader::TSize size) const
+			{
+				if (!_isInline)
+					return _item->equal(data, size);
+				return (_inline.header.size == size) && !memcmp(_inline.data, data, size);
+			}
+		private:
+			void _setInline()
+			{
+				if (!_isInline) {
+					_item.~TItemSharedPtr();
+					_isInline = true;
+				}
+			}
+			void _setShared()
+			{
+				if (_isInline) {
+					new (&_item) TItemSharedPtr();
+					_isInline = false;
+				}
+			}
+			struct InlineItem
+			{
+				ItemHeader header;
+				char data[Item::INLINE_DATA_SIZE];
+			};
+			union
+			{
+				TItemSharedPtr _item;
+				InlineItem _inline;
+			};
+			bool _isInline;
+		};
 	};
 };
 
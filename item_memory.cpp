@@ -0,0 +1,248 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Memory allocator of items' data
+///////////////////////////////////////////////////////////////////////////////
+
+#include <sys/mman.h>
+#include <strings.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "item_memory.hpp"
+#include "nomos_log.hpp"
+
+using namespace fl::nomos;
+
+ItemMemory::EHugePages ItemMemory::_mode = ItemMemory::OFF;
+bool ItemMemory::_isHugeTLB = false;
+size_t ItemMemory::_classSizes[ItemMemory::MAX_CLASSES];
+uint32_t ItemMemory::_classesCount = 0;
+ItemMemory::Pool ItemMemory::_pool;
+size_t ItemMemory::_reserved = 0;
+size_t ItemMemory::_hugeTLBReserved = 0;
+size_t ItemMemory::_used = 0;
+
+bool ItemMemory::stringToMode(const std::string &str, EHugePages &mode)
+{
+	if (!strcasecmp(str.c_str(), "off"))
+		mode = OFF;
+	else if (!strcasecmp(str.c_str(), "transparent"))
+		mode = TRANSPARENT;
+	else if (!strcasecmp(str.c_str(), "hugetlb"))
+		mode = HUGETLB;
+	else
+		return false;
+	return true;
+}
+
+void ItemMemory::init(const EHugePages mode)
+{
+	_mode = mode;
+	if (mode == OFF)
+		return;
+	_isHugeTLB = (mode == HUGETLB);
+	// 16 bytes steps up to 128 bytes, then four classes for every power of two
+	_classesCount = 0;
+	size_t size = MIN_CLASS_SIZE;
+	while (size <= MAX_CLASS_SIZE) {
+		_classSizes[_classesCount++] = size;
+		if (size < 128)
+			size += MIN_CLASS_SIZE;
+		else
+			size += size / 4;
+		size = (size + MIN_CLASS_SIZE - 1) & ~(MIN_CLASS_SIZE - 1);
+	}
+	if (_classSizes[_classesCount - 1] < MAX_CLASS_SIZE)
+		_classSizes[_classesCount++] = MAX_CLASS_SIZE;
+	for (uint32_t classID = 0; classID < _classesCount; classID++)
+		_pool.classes[classID].freeList = NULL;
+}
+
+uint32_t ItemMemory::_findClass(const size_t size)
+{
+	if (size > MAX_CLASS_SIZE)
+		return MALLOC_CLASS;
+	uint32_t first = 0;
+	uint32_t last = _classesCount - 1;
+	while (first < last) {
+		uint32_t middle = (first + last) / 2;
+		if (_classSizes[middle] < size)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+void *ItemMemory::alloc(const size_t size)
+{
+	if (_mode == OFF)
+		return malloc(size);
+	
+	const size_t blockSize = size + sizeof(BlockHeader);
+	uint32_t classID = _findClass(blockSize);
+	BlockHeader *header;
+	if (classID == MALLOC_CLASS) {
+		header = static_cast<BlockHeader*>(malloc(blockSize));
+		if (!header)
+			return NULL;
+	} else {
+		SizeClass &sizeClass = _pool.classes[classID];
+		AutoMutex autoSync(&sizeClass.sync);
+		if (!sizeClass.freeList && !_refill(_pool, classID))
+			return NULL;
+		FreeBlock *block = sizeClass.freeList;
+		sizeClass.freeList = block->next;
+		autoSync.unLock();
+		header = reinterpret_cast<BlockHeader*>(block);
+		__sync_add_and_fetch(&_used, _classSizes[classID]);
+	}
+	header->sizeClass = classID;
+	return header + 1;
+}
+
+void ItemMemory::free(void *data)
+{
+	if (!data)
+		return;
+	if (_mode == OFF) {
+		::free(data);
+		return;
+	}
+	BlockHeader *header = static_cast<BlockHeader*>(data) - 1;
+	if (header->sizeClass == MALLOC_CLASS) {
+		::free(header);
+		return;
+	}
+	SizeClass &sizeClass = _pool.classes[header->sizeClass];
+	__sync_sub_and_fetch(&_used, _classSizes[header->sizeClass]);
+	FreeBlock *block = reinterpret_cast<FreeBlock*>(header);
+	AutoMutex autoSync(&sizeClass.sync);
+	block->next = sizeClass.freeList;
+	sizeClass.freeList = block;
+}
+
+void *ItemMemory::shrink(void *data, const size_t size, const size_t newSize)
+{
+	if (_mode == OFF) {
+		void *shrinked = realloc(data, newSize);
+		return shrinked ? shrinked : data;
+	}
+	BlockHeader *header = static_cast<BlockHeader*>(data) - 1;
+	if (header->sizeClass == _findClass(newSize + sizeof(BlockHeader)))
+		return data;
+	void *shrinked = alloc(newSize);
+	if (!shrinked)
+		return data;
+	memcpy(shrinked, data, newSize);
+	free(data);
+	return shrinked;
+}
+
+bool ItemMemory::_refill(Pool &pool, const uint32_t classID)
+{
+	char *slab = _allocSlab(pool);
+	if (!slab)
+		return false;
+	SizeClass &sizeClass = pool.classes[classID];
+	const size_t size = _classSizes[classID];
+	for (size_t pos = 0; (pos + size) <= SLAB_SIZE; pos += size) {
+		FreeBlock *block = reinterpret_cast<FreeBlock*>(slab + pos);
+		block->next = sizeClass.freeList;
+		sizeClass.freeList = block;
+	}
+	return true;
+}
+
+char *ItemMemory::_allocSlab(Pool &pool)
+{
+	AutoMutex autoSync(&pool.chunkSync);
+	if (pool.chunkLeft < SLAB_SIZE) {
+		pool.chunk = _mapChunk();
+		if (!pool.chunk) {
+			pool.chunkLeft = 0;
+			return NULL;
+		}
+		pool.chunkLeft = CHUNK_SIZE;
+		__sync_add_and_fetch(&_reserved, CHUNK_SIZE);
+	}
+	char *slab = pool.chunk;
+	pool.chunk += SLAB_SIZE;
+	pool.chunkLeft -= SLAB_SIZE;
+	return slab;
+}
+
+char *ItemMemory::_mapChunk()
+{
+	if (__atomic_load_n(&_isHugeTLB, __ATOMIC_RELAXED)) {
+		void *chunk = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (chunk != MAP_FAILED) {
+			__sync_add_and_fetch(&_hugeTLBReserved, CHUNK_SIZE);
+			return static_cast<char*>(chunk);
+		}
+		// other threads can fail at the same time, the warning is logged once
+		if (__atomic_exchange_n(&_isHugeTLB, false, __ATOMIC_RELAXED))
+			log::Warning::L("Can't allocate a hugetlbfs page (%d), transparent huge pages are used\n", errno);
+	}
+	// map twice more to cut a chunk aligned to the huge page size
+	char *region = static_cast<char*>(mmap(NULL, CHUNK_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 
+		-1, 0));
+	if (region == MAP_FAILED) {
+		log::Fatal::L("Can't map %zu bytes for items (%d)\n", CHUNK_SIZE * 2, errno);
+		return NULL;
+	}
+	char *chunk = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(region) + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1));
+	if (chunk > region)
+		munmap(region, chunk - region);
+	if ((region + CHUNK_SIZE * 2) > (chunk + CHUNK_SIZE))
+		munmap(chunk + CHUNK_SIZE, (region + CHUNK_SIZE * 2) - (chunk + CHUNK_SIZE));
+	if (madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE))
+		log::Warning::L("Transparent huge pages are not available (%d)\n", errno);
+	return chunk;
+}
+
+size_t ItemMemory::_transparentHugePages()
+{
+	FILE *f = fopen("/proc/self/smaps_rollup", "r");
+	if (!f)
+		return 0;
+	char line[256];
+	size_t size = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "AnonHugePages:", sizeof("AnonHugePages:") - 1)) {
+			size = strtoull(line + sizeof("AnonHugePages:") - 1, NULL, 10) * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return size;
+}
+
+void ItemMemory::stats(Stats &st)
+{
+	st.reserved = __atomic_load_n(&_reserved, __ATOMIC_RELAXED);
+	st.hugePages = __atomic_load_n(&_hugeTLBReserved, __ATOMIC_RELAXED);
+	st.used = __atomic_load_n(&_used, __ATOMIC_RELAXED);
+	if (st.hugePages < st.reserved) { // other chunks could be collapsed to transparent huge pages
+		st.hugePages += _transparentHugePages();
+		if (st.hugePages > st.reserved)
+			st.hugePages = st.reserved;
+	}
+}
+
+void ItemMemory::logStats()
+{
+	if (_mode == OFF)
+		return;
+	Stats st;
+	stats(st);
+	log::Info::L("Items memory: %zu bytes reserved, %zu used, %zu (%.1f%%) on huge pages\n", st.reserved, st.used, 
+		st.hugePages, st.reserved ? (100.0 * st.hugePages / st.reserved) : 0.0);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#ifndef __FL_NOMOS_ITEM_MEMORY_HPP
+#define	__FL_NOMOS_ITEM_MEMORY_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Memory allocator of items' data
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "mutex.hpp"
+
+namespace fl {
+	namespace nomos {
+		using fl::threads::Mutex;
+		using fl::threads::AutoMutex;
+		
+		// Without huge pages items' data is allocated by malloc. Otherwise small blocks are cut from 2Mb chunks backed 
+		// by transparent or hugetlbfs huge pages, every size class keeps a list of free blocks. Chunks are never 
+		// returned to the system, blocks bigger than MAX_CLASS_SIZE are still allocated by malloc
+		class ItemMemory
+		{
+		public:
+			enum EHugePages : uint8_t
+			{
+				OFF = 0,
+				TRANSPARENT,
+				HUGETLB,
+			};
+			static bool stringToMode(const std::string &str, EHugePages &mode);
+			static void init(const EHugePages mode); // has to be called before any item is created
+			static void *alloc(const size_t size);
+			static void free(void *data);
+			static void *shrink(void *data, const size_t size, const size_t newSize);
+			
+			struct Stats
+			{
+				size_t reserved; // bytes of chunks
+				size_t used; // bytes of allocated blocks
+				size_t hugePages; // bytes of chunks backed by huge pages
+			};
+			static void stats(Stats &st);
+			static void logStats();
+		private:
+			static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+			static const size_t SLAB_SIZE = 256 * 1024;
+			static const size_t MIN_CLASS_SIZE = 16;
+			static const size_t MAX_CLASS_SIZE = 64 * 1024;
+			static const uint32_t MAX_CLASSES = 64;
+			static const uint32_t MALLOC_CLASS = UINT32_MAX;
+			
+			struct BlockHeader
+			{
+				uint32_t sizeClass;
+				uint32_t padding; // keeps the data 8 bytes aligned
+			};
+			struct FreeBlock
+			{
+				FreeBlock *next;
+			};
+			struct SizeClass
+			{
+				Mutex sync;
+				FreeBlock *freeList;
+			};
+			struct Pool
+			{
+				Pool()
+					: chunk(NULL), chunkLeft(0)
+				{
+				}
+				SizeClass classes[MAX_CLASSES];
+				Mutex chunkSync;
+				char *chunk; // the current chunk, slabs are cut from it
+				size_t chunkLeft;
+			};
+			static EHugePages _mode; // is set by init only
+			static bool _isHugeTLB; // is dropped when hugetlbfs pages are over, is read and written atomically
+			static size_t _classSizes[MAX_CLASSES];
+			static uint32_t _classesCount;
+			static Pool _pool;
+			static size_t _reserved;
+			static size_t _hugeTLBReserved;
+			static size_t _used;
+			
+			static uint32_t _findClass(const size_t size);
+			static bool _refill(Pool &pool, const uint32_t classID);
+			static char *_allocSlab(Pool &pool);
+			static char *_mapChunk();
+			static size_t _transparentHugePages();
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_ITEM_MEMORY_HPP
@@ -0,0 +1,98 @@
+#pragma once
+#ifndef __FL_NOMOS_KEY_PARSER_HPP
+#define	__FL_NOMOS_KEY_PARSER_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: Conversion of request strings to level keys
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <string>
+
+#include "util.hpp"
+
+namespace fl {
+	namespace nomos {
+
+		// returns the value of a hex digit or -1
+		inline int8_t hexDigit(const uint8_t ch)
+		{
+			static const int8_t HEX_DIGITS[256] = {
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+				-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			};
+			return HEX_DIGITS[ch];
+		}
+
+		// Keys come from requests as hex numbers or strings. String keys are passed by reference, so lookups
+		// do not copy them
+		template <typename TKey>
+		struct KeyParser
+		{
+			typedef TKey TResult;
+			static TKey parse(const std::string &str)
+			{
+				return fl::utils::convertStdStringTo<TKey>(str.c_str(), NULL, 16);
+			}
+		};
+
+		template <>
+		struct KeyParser<std::string>
+		{
+			typedef const std::string &TResult;
+			static const std::string &parse(const std::string &str)
+			{
+				return str;
+			}
+		};
+
+		// parses integer keys like strtoul(str, NULL, 16) but without locale, errno and sign handling
+		template <typename TInt>
+		struct HexKeyParser
+		{
+			typedef TInt TResult;
+			static TInt parse(const std::string &str)
+			{
+				const char *c = str.c_str();
+				if ((c[0] == '0') && ((c[1] == 'x') || (c[1] == 'X')))
+					c += 2;
+				TInt value = 0;
+				for (int8_t digit; (digit = hexDigit(*c)) >= 0; c++)
+					value = (value << 4) | digit;
+				return value;
+			}
+		};
+
+		template <>
+		struct KeyParser<uint32_t> : public HexKeyParser<uint32_t>
+		{
+		};
+
+		template <>
+		struct KeyParser<uint64_t> : public HexKeyParser<uint64_t>
+		{
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_KEY_PARSER_HPP
@@ -19,6 +19,8 @@
 #include "time.hpp"
 #include "accept_thread.hpp"
 #include "nomos_event.hpp"
+#include "numa.hpp"
+#include "item_memory.hpp"
 
 
 using fl::network::Socket;
@@ -58,6 +60,9 @@ int main(int argc, char *argv[])
 		if (!config->initNetwork())
 			return -1;
 		config->setProcessUserAndGroup();
+		if (!Numa::init(config->numaPolicy()))
+			return -1;
+		ItemMemory::init(config->hugePages());
 
 		NomosEventFactory *factory = new NomosEventFactory(config.get());
 		NomosThreadSpecificDataFactory *dataFactory = new NomosThreadSpecificDataFactory(config.get());
@@ -65,16 +70,25 @@ int main(int argc, char *argv[])
 			EPOLL_WORKER_STACK_SIZE));
 		AcceptThread cmdThread(workerGroup.get(), &config->listenSocket(), factory);
 		
-		index.reset(new Index(config->dataPath()));
+		index.reset(new Index(config->dataPath(), config->levelShards()));
+		index->setColdTier(config->coldItemTime(), config->isPromoteColdItems());
+		index->setFsyncPeriod(config->fsyncPeriod());
+		index->setUnifiedLog(config->isUnifiedLog());
+		index->setCheckpointPack(config->isCheckpointPack());
+		index->setCheckpointPeriod(config->checkpointPeriod());
+		if (config->replicationLogKeepTime() > 0) { // the unified log mode replays bin logs while loading
+			if (!index->startReplicationLog(config->serverID(), config->replicationLogKeepTime(), 
+					config->replicationLogPath()))
+				return -1;
+		}
 		Time curTime;
 		if (!index->load(curTime.unix()))
 			return -1;
-		index->setAutoCreate(config->isAutoCreate(), config->defaultSublevelKeyType(), config->defaultItemKeyType());
-		index->startThreads(config->syncThreadsCount());
+		index->setAutoCreate(config->isAutoCreate(), config->defaultSublevelKeyType(), config->defaultItemKeyType(), 
+			config->defaultLevelFlags());
+		index->setCompressionThreshold(config->compressionThreshold());
+		index->startThreads(config->syncThreadsCount(), config->ioBackend());
 		if (config->replicationLogKeepTime() > 0) {
-			if (!index->startReplicationLog(config->serverID(), config->replicationLogKeepTime(), 
-					config->replicationLogPath()))
-				return -1;
 			if (config->replicationPort() > 0) {
 				if (!index->startReplicationListenter(&config->replicationSocket()))
 					return -1;
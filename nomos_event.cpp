@@ -8,9 +8,12 @@
 // Description: Nomos event system classes
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <limits>
+#include <sys/eventfd.h>
 #include "nomos_event.hpp"
 #include "nomos_log.hpp"
 #include "index.hpp"
+#include "compression.hpp"
 
 using namespace fl::nomos;
 
@@ -40,6 +43,9 @@ void NomosEvent::exitFlush()
 NomosEvent::NomosEvent(const TEventDescriptor descr, const time_t timeOutTime)
 	: WorkEvent(descr, timeOutTime), _networkBuffer(NULL), _curState(ST_WAIT_QUERY), _querySize(0), _dataQuery(NULL)
 {
+	_durable.waiter = NULL;
+	_durable.waitID = 0;
+	_durable.isParked = false;
 	setWaitRead();
 }
 
@@ -62,6 +68,10 @@ NomosEvent::~NomosEvent()
 
 void NomosEvent::_endWork()
 {
+	if (_durable.isParked) { // a late wake of the level's sync is ignored
+		_threadData()->durableWake->unpark(_durable.waitID);
+		_durable.isParked = false;
+	}
 	_curState = ST_FINISHED;
 	if (_descr != 0) {
 		close(_descr);
@@ -69,7 +79,7 @@ void NomosEvent::_endWork()
 	}
 	if (_networkBuffer)
 	{
-		auto threadSpecData = static_cast<NomosThreadSpecificData*>(_thread->threadSpecificData());
+		auto threadSpecData = _threadData();
 		threadSpecData->bufferPool.free(_networkBuffer);
 		_networkBuffer = NULL;
 	}
@@ -102,11 +112,20 @@ bool NomosEvent::_parseCreateQuery(NetworkBuffer::TDataPtr &query)
 	try
 	{
 		auto subLevelTypeID = Index::stringToType(subLevelType);
+		bool haveOptions = (strchr(query, ',') != NULL);
 		std::string itemType;
-		if (!_readString(itemType, query, 0))
+		if (!_readString(itemType, query, haveOptions ? ',' : 0))
 			return false;
 		auto itemTypeID = Index::stringToType(itemType);
-		if (_index->create(level, subLevelTypeID, itemTypeID)) {
+		TopLevelIndex::TFlags flags = 0;
+		std::string option;
+		while (haveOptions) {
+			haveOptions = (strchr(query, ',') != NULL);
+			if (!_readString(option, query, haveOptions ? ',' : 0))
+				return false;
+			flags |= Index::stringToFlag(option);
+		}
+		if (_index->create(level, subLevelTypeID, itemTypeID, flags)) {
 			_formOkAnswer(0);
 			return true;
 		} else {
@@ -151,9 +170,10 @@ bool NomosEvent::_parsePutQuery(NetworkBuffer::TDataPtr &query)
 
 bool NomosEvent::_formPutAnswer()
 {
-	TItemSharedPtr item(new Item(_networkBuffer->c_str() + _querySize, _dataQuery->itemSize, 
-		EPollWorkerGroup::curTime.unix() + _dataQuery->lifeTime, EPollWorkerGroup::curTime.unix()));
-	auto res = _index->put(_dataQuery->level, _dataQuery->subLevel, _dataQuery->itemKey, item, _cmd == CMD_UPDATE);
+	TItemSharedPtr item = std::make_shared<Item>(_networkBuffer->c_str() + _querySize, _dataQuery->itemSize, 
+		EPollWorkerGroup::curTime.unix() + _dataQuery->lifeTime, EPollWorkerGroup::curTime.unix());
+	auto res = _index->put(_dataQuery->level, _dataQuery->subLevel, _dataQuery->itemKey, item, _cmd == CMD_UPDATE, 
+		_durableWait());
 	if (res) {
 		_formOkAnswer(0);
 		return true;
@@ -167,31 +187,72 @@ bool NomosEvent::_formPutAnswer()
 
 bool NomosEvent::_parseGetQuery(NetworkBuffer::TDataPtr &query)
 {
-	std::string level;
+	auto threadSpecData = _threadData();
+	std::string &level = threadSpecData->level;
 	if (!_readString(level, query, ','))
 		return false;
-	std::string subLevel;
+	std::string &subLevel = threadSpecData->subLevel;
 	if (!_readString(subLevel, query, ','))
 		return false;
-	std::string itemKey;
+	std::string &itemKey = threadSpecData->itemKey;
 	if (!_readString(itemKey, query, ','))
 		return false;
-	time_t lifeTime = strtoul(query, NULL, 10);
+	char *endQ;
+	time_t lifeTime = strtoul(query, &endQ, 10);
+	bool acceptPacked = (*endQ == ',') && (*(endQ + 1) == GET_OPTION_PACKED);
 	
-	auto item = _index->find(level, subLevel, itemKey, EPollWorkerGroup::curTime.unix(), lifeTime);
+	bool isPacked = false;
+	auto item = _index->find(level, subLevel, itemKey, EPollWorkerGroup::curTime.unix(), lifeTime, &isPacked, 
+		_durableWait());
 	if (item.get() == NULL) {
 		_curState = ER_NOT_FOUND;
 		return false;
 	}
+	else if (isPacked && !acceptPacked)
+	{
+		return _formUnpackedAnswer(item);
+	}
 	else
 	{
-		_formOkAnswer(item->size());
+		if (isPacked)
+			_formPackedAnswer(item->size());
+		else
+			_formOkAnswer(item->size());
 		_networkBuffer->add(static_cast<NetworkBuffer::TDataPtr>(item->data()), item->size());
 		return true;
 	}
 }
 
-bool NomosEvent::_parseTouchQuery(NetworkBuffer::TDataPtr &query)
+bool NomosEvent::_formUnpackedAnswer(TItemSharedPtr &item)
+{
+	ItemHeader::TSize unpackedSize;
+	if (!Compression::unpackedSize(item->data(), item->size(), unpackedSize)) {
+		log::Error::L("Bad packed item frame (%u)\n", item->size());
+		_curState = ER_UNKNOWN;
+		return false;
+	}
+	_formOkAnswer(unpackedSize);
+	if (!unpackedSize)
+		return true;
+	if (!Compression::unpack(item->data(), item->size(), _networkBuffer->reserveBuffer(unpackedSize), unpackedSize)) {
+		log::Error::L("Can't unpack item (%u/%u)\n", item->size(), unpackedSize);
+		_curState = ER_UNKNOWN;
+		return false;
+	}
+	return true;
+}
+
+inline bool _readOptionalString(std::string &str, NetworkBuffer::TDataPtr &query, const char ch)
+{
+	char *pEnd = strchr(query, ch);
+	if (!pEnd)
+		return false;
+	str.assign(query, pEnd - query);
+	query = pEnd + 1;
+	return true;
+}
+
+bool NomosEvent::_parseGetRangeQuery(NetworkBuffer::TDataPtr &query)
 {
 	std::string level;
 	if (!_readString(level, query, ','))
@@ -199,12 +260,74 @@ bool NomosEvent::_parseTouchQuery(NetworkBuffer::TDataPtr &query)
 	std::string subLevel;
 	if (!_readString(subLevel, query, ','))
 		return false;
-	std::string itemKey;
+	std::string fromKey;
+	if (!_readOptionalString(fromKey, query, ','))
+		return false;
+	std::string toKey;
+	if (!_readOptionalString(toKey, query, ','))
+		return false;
+	char *endQ;
+	size_t limit = strtoul(query, &endQ, 10);
+	if (!limit || (limit > MAX_RANGE_LIMIT))
+		limit = MAX_RANGE_LIMIT;
+	
+	TopLevelIndex::TItemRangeVector items;
+	bool isPacked = false;
+	if (!_index->findRange(level, subLevel, fromKey, toKey, limit, EPollWorkerGroup::curTime.unix(), items, &isPacked)) {
+		_curState = ER_NOT_FOUND;
+		return false;
+	}
+	return _formRangeAnswer(items, isPacked);
+}
+
+bool NomosEvent::_formRangeAnswer(TopLevelIndex::TItemRangeVector &items, const bool isPacked)
+{
+	static const uint32_t ITEM_HEADER_SIZE = 10; // ,XXXXXXXX\n after a key
+	uint32_t answerSize = 0;
+	for (auto item = items.begin(); item != items.end(); item++) {
+		ItemHeader::TSize size = item->second->size();
+		if (isPacked && !Compression::unpackedSize(item->second->data(), item->second->size(), size)) {
+			log::Error::L("Bad packed item frame (%u)\n", item->second->size());
+			_curState = ER_UNKNOWN;
+			return false;
+		}
+		answerSize += item->first.size() + ITEM_HEADER_SIZE + size;
+	}
+	_formOkAnswer(answerSize);
+	for (auto item = items.begin(); item != items.end(); item++) {
+		ItemHeader::TSize size = item->second->size();
+		if (isPacked)	{
+			Compression::unpackedSize(item->second->data(), item->second->size(), size);
+			_networkBuffer->sprintfAdd("%s,%08x\n", item->first.c_str(), size);
+			if (size && !Compression::unpack(item->second->data(), item->second->size(), 
+				_networkBuffer->reserveBuffer(size), size)) {
+				log::Error::L("Can't unpack item (%u/%u)\n", item->second->size(), size);
+				_curState = ER_UNKNOWN;
+				return false;
+			}
+		} else {
+			_networkBuffer->sprintfAdd("%s,%08x\n", item->first.c_str(), size);
+			_networkBuffer->add(static_cast<NetworkBuffer::TDataPtr>(item->second->data()), size);
+		}
+	}
+	return true;
+}
+
+bool NomosEvent::_parseTouchQuery(NetworkBuffer::TDataPtr &query)
+{
+	auto threadSpecData = _threadData();
+	std::string &level = threadSpecData->level;
+	if (!_readString(level, query, ','))
+		return false;
+	std::string &subLevel = threadSpecData->subLevel;
+	if (!_readString(subLevel, query, ','))
+		return false;
+	std::string &itemKey = threadSpecData->itemKey;
 	if (!_readString(itemKey, query, ','))
 		return false;
 	time_t lifeTime = strtoul(query, NULL, 10);
 
-	if (_index->touch(level, subLevel, itemKey, lifeTime, EPollWorkerGroup::curTime.unix())) {
+	if (_index->touch(level, subLevel, itemKey, lifeTime, EPollWorkerGroup::curTime.unix(), _durableWait())) {
 		_formOkAnswer(0);
 		return true;
 	} else {
@@ -215,18 +338,19 @@ bool NomosEvent::_parseTouchQuery(NetworkBuffer::TDataPtr &query)
 
 bool NomosEvent::_parseRemoveQuery(NetworkBuffer::TDataPtr &query)
 {
-	std::string level;
+	auto threadSpecData = _threadData();
+	std::string &level = threadSpecData->level;
 	if (!_readString(level, query, ','))
 		return false;
-	std::string subLevel;
+	std::string &subLevel = threadSpecData->subLevel;
 	if (!_readString(subLevel, query, ','))
 		return false;
 	
-	std::string itemKey;
+	std::string &itemKey = threadSpecData->itemKey;
 	if (!_readString(itemKey, query, 0))
 		return false;
 
-	if (_index->remove(level, subLevel, itemKey)) {
+	if (_index->remove(level, subLevel, itemKey, _durableWait())) {
 		_formOkAnswer(0);
 		return true;
 	} else {
@@ -245,7 +369,7 @@ bool NomosEvent::_parseRemoveSubLevelQuery(NetworkBuffer::TDataPtr &query)
 		return false;
 	
 
-	if (_index->removeSubLevel(level, subLevel)) {
+	if (_index->removeSubLevel(level, subLevel, EPollWorkerGroup::curTime.unix(), _durableWait())) {
 		_formOkAnswer(0);
 		return true;
 	} else {
@@ -272,30 +396,40 @@ bool NomosEvent::_parseQuery()
 	if (*query != ',')
 		return false;
 	query++;
-	switch (_cmd)
+	try
 	{
-	case CMD_GET:
-		return _parseGetQuery(query);
-	case CMD_PUT:
-	case CMD_UPDATE:
-		return _parsePutQuery(query);
-	case CMD_TOUCH:
-		return _parseTouchQuery(query);
-	case CMD_REMOVE:
-		return _parseRemoveQuery(query);
-	case CMD_REMOVE_SUBLEVEL:
-		return _parseRemoveSubLevelQuery(query);
-	case CMD_CREATE:
-		return _parseCreateQuery(query);
-	default:
-		return false;
-	};
+		switch (_cmd)
+		{
+		case CMD_GET:
+			return _parseGetQuery(query);
+		case CMD_PUT:
+		case CMD_UPDATE:
+			return _parsePutQuery(query);
+		case CMD_TOUCH:
+			return _parseTouchQuery(query);
+		case CMD_REMOVE:
+			return _parseRemoveQuery(query);
+		case CMD_REMOVE_SUBLEVEL:
+			return _parseRemoveSubLevelQuery(query);
+		case CMD_CREATE:
+			return _parseCreateQuery(query);
+		case CMD_GET_RANGE:
+			return _parseGetRangeQuery(query);
+		default:
+			return false;
+		};
+	}
+	catch (Index::DurableError &er)
+	{
+		_curState = ER_NOT_DURABLE;
+		return false;
+	}
 }
 
 bool NomosEvent::_readQuery()
 {
 	if (!_networkBuffer) {
-		auto threadSpecData = static_cast<NomosThreadSpecificData*>(_thread->threadSpecificData());
+		auto threadSpecData = _threadData();
 		_networkBuffer = threadSpecData->bufferPool.get();
 	}
 	auto lastChecked = _networkBuffer->size();
@@ -334,9 +468,17 @@ bool NomosEvent::_readQueryData()
 	else if (res == NetworkBuffer::IN_PROGRESS)
 		return true;
 	uint32_t readBodyLen = _networkBuffer->size() - _querySize;
-	if (readBodyLen >= _dataQuery->itemSize)
+	if (readBodyLen < _dataQuery->itemSize)
+		return true;
+	try
+	{
 		return _formPutAnswer();
-	return true;
+	}
+	catch (Index::DurableError &er)
+	{
+		_curState = ER_NOT_DURABLE;
+		return false;
+	}
 }
 
 inline void NomosEvent::_formOkAnswer(const uint32_t size)
@@ -346,10 +488,17 @@ inline void NomosEvent::_formOkAnswer(const uint32_t size)
 	_networkBuffer->sprintfSet("OK%+08x\n", size);
 }
 
-NomosEvent::ECallResult NomosEvent::_sendError()
+inline void NomosEvent::_formPackedAnswer(const uint32_t size)
+{
+	_curState = ST_SEND;
+	_networkBuffer->clear();
+	_networkBuffer->sprintfSet("OZ%+08x\n", size);
+}
+
+void NomosEvent::_formError()
 {
 	int erorrNum = _curState;
-	if (erorrNum > ER_UNKNOWN)
+	if (erorrNum > ER_NOT_DURABLE)
 		erorrNum = ER_UNKNOWN;
 	_networkBuffer->clear();
 	if (erorrNum <= ER_CRITICAL)	{
@@ -359,6 +508,11 @@ NomosEvent::ECallResult NomosEvent::_sendError()
 		_networkBuffer->sprintfSet("ERR%+07x\n", erorrNum);
 		_curState = ST_SEND;
 	}
+}
+
+NomosEvent::ECallResult NomosEvent::_sendError()
+{
+	_formError();
 	return _sendAnswer();
 }
 
@@ -400,8 +554,14 @@ const NomosEvent::ECallResult NomosEvent::call(const TEvents events)
 			if (!_readQueryData())
 				return _sendError();
 		}
-		if (_curState == ST_SEND)
+		if (_curState == ST_SEND) {
+			if (_durable.isParked) { // the input is not read till the answer is sent
+				_threadData()->durableWake->park(_durable.waitID, this);
+				_curState = ST_WAIT_DURABLE;
+				return SKIP;
+			}
 			return _sendAnswer();
+		}
 		else
 			return SKIP;
 	}
@@ -416,8 +576,106 @@ const NomosEvent::ECallResult NomosEvent::call(const TEvents events)
 	return SKIP;
 }
 
+NomosThreadSpecificData *NomosEvent::_threadData()
+{
+	return static_cast<NomosThreadSpecificData*>(_thread->threadSpecificData());
+}
+
+DurableWait *NomosEvent::_durableWait()
+{
+	auto threadSpecData = _threadData();
+	if (!threadSpecData->durableWake) {
+		const int descr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (descr < 0) {
+			log::Error::L("Can't create an eventfd (%d), changes of DURABLE levels block the worker\n", errno);
+			return NULL;
+		}
+		DurableWakeEvent *durableWake = new DurableWakeEvent(descr);
+		if (!_thread->add(durableWake)) {
+			log::Error::L("Can't add a wake event, changes of DURABLE levels block the worker\n");
+			delete durableWake;
+			return NULL;
+		}
+		threadSpecData->durableWake = durableWake;
+	}
+	_durable.waiter = threadSpecData->durableWake;
+	_durable.waitID = threadSpecData->durableWake->nextWaitID();
+	_durable.isParked = false;
+	return &_durable;
+}
+
+// is called by the wake event of the thread, the answer is sent when the socket is ready for it
+void NomosEvent::durableFinished(const bool written)
+{
+	_durable.isParked = false;
+	if (written) {
+		_curState = ST_SEND;
+	} else {
+		_curState = ER_NOT_DURABLE;
+		_formError();
+	}
+	setWaitSend();
+	if (!_thread->ctrl(this))
+		_endWork();
+}
+
+DurableWakeEvent::DurableWakeEvent(const TEventDescriptor descr)
+	: WorkEvent(descr, std::numeric_limits<time_t>::max()), _lastWaitID(0) // is never timed out
+{
+	setWaitRead();
+}
+
+DurableWakeEvent::~DurableWakeEvent()
+{
+	if (_descr != 0) {
+		close(_descr);
+		_descr = 0;
+	}
+}
+
+const DurableWakeEvent::ECallResult DurableWakeEvent::call(const TEvents events)
+{
+	uint64_t count;
+	if ((read(_descr, &count, sizeof(count)) < 0) && (errno != EAGAIN))
+		log::Error::L("Can't read the wake eventfd (%d)\n", errno);
+	TWrittenVector written;
+	_sync.lock();
+	std::swap(written, _written);
+	_sync.unLock();
+	for (auto wait = written.begin(); wait != written.end(); wait++) {
+		auto parkedEvent = _parkedEvents.find(wait->first);
+		if (parkedEvent == _parkedEvents.end()) // the event has been finished
+			continue;
+		NomosEvent *event = parkedEvent->second;
+		_parkedEvents.erase(parkedEvent);
+		event->durableFinished(wait->second);
+	}
+	return SKIP;
+}
+
+void DurableWakeEvent::durable(const uint64_t waitID, const bool written)
+{
+	AutoMutex autoSync(&_sync);
+	_written.push_back(TWrittenVector::value_type(waitID, written));
+	if (_written.size() > 1) // the thread has not taken the previous wakes yet
+		return;
+	const uint64_t count = 1;
+	if (write(_descr, &count, sizeof(count)) < 0)
+		log::Error::L("Can't write the wake eventfd (%d)\n", errno);
+}
+
+void DurableWakeEvent::park(const uint64_t waitID, NomosEvent *event)
+{
+	_parkedEvents[waitID] = event;
+}
+
+void DurableWakeEvent::unpark(const uint64_t waitID)
+{
+	_parkedEvents.erase(waitID);
+}
+
 NomosThreadSpecificData::NomosThreadSpecificData(Config *config)
-	: bufferPool(config->bufferSize(), config->maxFreeBuffers())
+	: bufferPool(config->bufferSize(), config->maxFreeBuffers()), durableWake(NULL)
 {
 	
 }
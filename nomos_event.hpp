@@ -15,6 +15,8 @@
 #include "event_thread.hpp"
 #include "config.hpp"
 #include "network_buffer.hpp"
+#include "item.hpp"
+#include "index.hpp"
 
 namespace fl {
 	namespace nomos {
@@ -31,8 +33,10 @@ namespace fl {
 				ER_NOT_FOUND,
 				ER_NOT_READY,
 				ER_UNKNOWN,
+				ER_NOT_DURABLE, // a change of a DURABLE level has been made in memory, but it has not been flushed
 				ST_WAIT_QUERY,
 				ST_WAIT_DATA,
+				ST_WAIT_DURABLE, // the answer is formed, it is sent after the sync of the DURABLE level
 				ST_SEND,
 				ST_SEND_AND_CLOSE,
 				ST_FINISHED
@@ -46,7 +50,9 @@ namespace fl {
 				CMD_REMOVE = 'R',
 				CMD_REMOVE_SUBLEVEL = 'S',
 				CMD_CREATE = 'C',
+				CMD_GET_RANGE = 'N', // items of ordered levels in a key range
 			};
+			static const char GET_OPTION_PACKED = 'Z'; // client can unpack items of compressed levels itself
 
 			NomosEvent(const TEventDescriptor descr, const time_t timeOutTime);
 			virtual ~NomosEvent();
@@ -54,6 +60,7 @@ namespace fl {
 			static void setInited(class Index *index);
 			static void setConfig(Config *config);
 			static void exitFlush();
+			void durableFinished(const bool written);
 		private:
 			static Config *_config;
 			static class Index *_index;
@@ -70,11 +77,18 @@ namespace fl {
 			bool _parseTouchQuery(NetworkBuffer::TDataPtr &query);
 			bool _parseRemoveQuery(NetworkBuffer::TDataPtr &query);
 			bool _parseRemoveSubLevelQuery(NetworkBuffer::TDataPtr &query);
+			bool _parseGetRangeQuery(NetworkBuffer::TDataPtr &query);
 			
 			bool _formPutAnswer();
+			bool _formUnpackedAnswer(TItemSharedPtr &item);
+			bool _formRangeAnswer(TopLevelIndex::TItemRangeVector &items, const bool isPacked);
 			
 			void _formOkAnswer(const uint32_t size);
+			void _formPackedAnswer(const uint32_t size);
+			class NomosThreadSpecificData *_threadData();
+			DurableWait *_durableWait();
 			
+			void _formError();
 			ECallResult _sendError();
 			ECallResult _sendAnswer();
 			static bool _inited;
@@ -91,6 +105,31 @@ namespace fl {
 				uint32_t itemSize;
 			};
 			DataQuery *_dataQuery;
+			DurableWait _durable;
+		};
+		
+		// wakes the events of the worker thread which wait for the sync of DURABLE levels, the sync threads signal 
+		// it by the eventfd, so the answers are sent from the worker's loop and the worker is never blocked
+		class DurableWakeEvent : public WorkEvent, public DurableWaiter
+		{
+		public:
+			DurableWakeEvent(const TEventDescriptor descr);
+			virtual ~DurableWakeEvent();
+			virtual const ECallResult call(const TEvents events);
+			virtual void durable(const uint64_t waitID, const bool written);
+			const uint64_t nextWaitID()
+			{
+				return ++_lastWaitID;
+			}
+			void park(const uint64_t waitID, NomosEvent *event);
+			void unpark(const uint64_t waitID);
+		private:
+			uint64_t _lastWaitID; // the IDs are not reused, so late wakes of finished events are ignored
+			typedef unordered_map<uint64_t, NomosEvent*> TParkedEventMap;
+			TParkedEventMap _parkedEvents; // is used only by the worker thread
+			Mutex _sync;
+			typedef std::vector<std::pair<uint64_t, bool>> TWrittenVector;
+			TWrittenVector _written; // is filled by the sync threads
 		};
 		
 		
@@ -100,6 +139,11 @@ namespace fl {
 			NomosThreadSpecificData(Config *config);
 			virtual ~NomosThreadSpecificData() {}
 			NetworkBufferPool bufferPool;
+			// keys of get/touch/remove queries are read to these strings, so their memory is reused by next queries
+			std::string level;
+			std::string subLevel;
+			std::string itemKey;
+			DurableWakeEvent *durableWake; // is added to the thread by its first event, the thread owns it
 		};
 		
 		class NomosThreadSpecificDataFactory : public ThreadSpecificDataFactory
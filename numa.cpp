@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: NUMA memory placement
+///////////////////////////////////////////////////////////////////////////////
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <strings.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "numa.hpp"
+#include "nomos_log.hpp"
+
+using namespace fl::nomos;
+
+// memory policy mode of set_mempolicy(2), libnuma is not required for it
+static const int NOMOS_MPOL_INTERLEAVE = 3;
+
+Numa::TNodeVector Numa::_nodes;
+Numa::EPolicy Numa::_policy = Numa::OFF;
+
+bool Numa::stringToPolicy(const std::string &str, EPolicy &policy)
+{
+	if (!strcasecmp(str.c_str(), "off"))
+		policy = OFF;
+	else if (!strcasecmp(str.c_str(), "interleave"))
+		policy = INTERLEAVE;
+	else
+		return false;
+	return true;
+}
+
+bool Numa::init(const EPolicy policy)
+{
+	if (policy == OFF)
+		return true;
+	if (!_readNodes())
+		return false;
+	if (_nodes.size() < 2) {
+		log::Info::L("Only one NUMA node has been found, memory placement is not changed\n");
+		return true;
+	}
+	uint64_t nodeMask = 0;
+	for (auto node = _nodes.begin(); node != _nodes.end(); node++)
+		nodeMask |= (1ULL << node->id);
+	// the main thread loads the index and threads created by it inherit the policy
+	if (!_setPolicy(NOMOS_MPOL_INTERLEAVE, nodeMask))
+		return false;
+	_policy = policy;
+	log::Info::L("Memory is interleaved between %zu NUMA nodes\n", _nodes.size());
+	return true;
+}
+
+bool Numa::_setPolicy(const int mode, const uint64_t nodeMask)
+{
+	unsigned long mask = nodeMask;
+	if (syscall(SYS_set_mempolicy, mode, nodeMask ? &mask : NULL, nodeMask ? MAX_NODES + 1 : 0)) {
+		log::Error::L("Can't set memory policy %d (%d)\n", mode, errno);
+		return false;
+	}
+	return true;
+}
+
+bool Numa::_readNodes()
+{
+	char path[64];
+	char list[1024];
+	for (uint32_t id = 0; id < MAX_NODES; id++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+		bool isRead = fgets(list, sizeof(list), f) != NULL;
+		fclose(f);
+		Node node;
+		node.id = id;
+		if (!isRead || !_parseCpuList(list, node.cpus)) {
+			log::Error::L("Can't parse %s\n", path);
+			return false;
+		}
+		if (CPU_COUNT(&node.cpus)) // memory only nodes are slower tiers, items are not spread to them
+			_nodes.push_back(node);
+	}
+	return true;
+}
+
+bool Numa::_parseCpuList(const char *list, cpu_set_t &cpus)
+{
+	CPU_ZERO(&cpus);
+	const char *c = list;
+	while (*c && (*c != '\n')) {
+		char *end;
+		unsigned long first = strtoul(c, &end, 10);
+		if (end == c)
+			return false;
+		unsigned long last = first;
+		if (*end == '-') {
+			c = end + 1;
+			last = strtoul(c, &end, 10);
+			if ((end == c) || (last < first))
+				return false;
+		}
+		for (unsigned long cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+			CPU_SET(cpu, &cpus);
+		c = end;
+		if (*c == ',')
+			c++;
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef __FL_NOMOS_NUMA_HPP
+#define	__FL_NOMOS_NUMA_HPP
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014 Final Level
+// Author: Denys Misko <gdraal@gmail.com>
+// Distributed under BSD (3-Clause) License (See
+// accompanying file LICENSE)
+//
+// Description: NUMA memory placement
+///////////////////////////////////////////////////////////////////////////////
+
+#include <sched.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fl {
+	namespace nomos {
+		
+		// INTERLEAVE spreads all memory of the process evenly between nodes. Any worker can read any item, so 
+		// accesses do not become local, but the memory bandwidth of all nodes is used and the latency is the same 
+		// for every worker instead of the loaded index being on the node of the main thread
+		class Numa
+		{
+		public:
+			enum EPolicy : uint8_t
+			{
+				OFF = 0,
+				INTERLEAVE,
+			};
+			static bool stringToPolicy(const std::string &str, EPolicy &policy);
+			static bool init(const EPolicy policy);
+			static size_t nodesCount()
+			{
+				return _nodes.size();
+			}
+			static EPolicy policy()
+			{
+				return _policy;
+			}
+		private:
+			struct Node
+			{
+				uint32_t id;
+				cpu_set_t cpus;
+			};
+			typedef std::vector<Node> TNodeVector;
+			static TNodeVector _nodes;
+			static EPolicy _policy;
+			
+			static const uint32_t MAX_NODES = 64;
+			static bool _readNodes();
+			static bool _parseCpuList(const char *list, cpu_set_t &cpus);
+			static bool _setPolicy(const int mode, const uint64_t nodeMask);
+		};
+	};
+};
+
+#endif	// __FL_NOMOS_NUMA_HPP
@@ -12,9 +12,18 @@
 #include <boost/test/output_test_stream.hpp> 
 
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#include <thread>
+
 #include "test_path.hpp"
+#include "dir.hpp"
 
 #include "index.hpp"
+#include "config.hpp"
+#include "compression.hpp"
 #include "time.hpp"
 
 
@@ -66,6 +75,45 @@ BOOST_AUTO_TEST_CASE( ClearOld )
 	);
 }
 
+BOOST_AUTO_TEST_CASE( ClearOldTouched )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		TItemSharedPtr item(new Item());
+		item->setLiveTo(curTime.unix() + 1, curTime.unix());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey", item));
+		BOOST_CHECK(index.touch("testLevel", "1", "testKey", 100, curTime.unix()));
+		index.clearOld(curTime.unix() + 1);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey", curTime.unix()).get() == item.get());
+		index.clearOld(curTime.unix() + 100);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey", curTime.unix()).get() == NULL);
+	);
+}
+
+BOOST_AUTO_TEST_CASE( ClearOldTouchedInBucket )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const ItemHeader::TTime bucketStart = curTime.unix() - curTime.unix() % 8;
+	
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		TItemSharedPtr item(new Item());
+		item->setLiveTo(bucketStart + 1, bucketStart);
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey", item));
+		BOOST_CHECK(index.touch("testLevel", "1", "testKey", 5, bucketStart)); // keeps the expiry bucket
+		index.clearOld(bucketStart + 2);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey", bucketStart).get() == item.get());
+		index.clearOld(bucketStart + 6);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey", bucketStart).get() == NULL);
+	);
+}
+
 BOOST_AUTO_TEST_CASE( AddFindTouchIndex )
 {
 	TestPath testPath("nomos_index");
@@ -133,9 +181,30 @@ BOOST_AUTO_TEST_CASE( testRemoveSublevelIndex )
 		BOOST_CHECK(index.put("testLevel", "2", "testKey", item2));
 		BOOST_CHECK(index.find("testLevel", "2", "testKey", curTime.unix()).get() != NULL);
 		
-		BOOST_CHECK(index.removeSubLevel("testLevel", "1"));
+		BOOST_CHECK(index.removeSubLevel("testLevel", "1", curTime.unix()));
 		BOOST_CHECK(index.find("testLevel", "1", "testKey", curTime.unix()).get() == NULL);
 		BOOST_CHECK(index.find("testLevel", "2", "testKey", curTime.unix()).get() != NULL);
+		
+		TItemSharedPtr item3(new Item());
+		BOOST_CHECK(index.put("testLevel", "1", "testKey2", item3));
+		BOOST_CHECK(index.sync(curTime.unix()));
+	} catch (...) {
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		BOOST_CHECK(index.find("testLevel", "1", "testKey", curTime.unix()).get() == NULL);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey2", curTime.unix()).get() != NULL);
+		BOOST_CHECK(index.find("testLevel", "2", "testKey", curTime.unix()).get() != NULL);
+		
+		BOOST_CHECK(index.pack(curTime.unix()));
+		Index indexPacked(testPath.path());
+		BOOST_CHECK(indexPacked.load(curTime.unix()));
+		BOOST_CHECK(indexPacked.find("testLevel", "1", "testKey", curTime.unix()).get() == NULL);
+		BOOST_CHECK(indexPacked.find("testLevel", "1", "testKey2", curTime.unix()).get() != NULL);
 	} catch (...) {
 		BOOST_CHECK_NO_THROW(throw);
 	}
@@ -221,6 +290,65 @@ BOOST_AUTO_TEST_CASE( testIndexSyncPutWithCheck )
 	);
 }
 
+BOOST_AUTO_TEST_CASE( testIndexSameSecondWriters )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const size_t PUTS_COUNT = 1000;
+	std::string lastData;
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		auto writer = [&index, &curTime](const std::string &data, bool &isIncreasing, u_int64_t &threadBits) { 
+			u_int64_t lastTag = 0;
+			for (size_t i = 0; i < PUTS_COUNT; i++) { // all items get tags of the same second
+				TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+				const u_int64_t tag = item->header().timeTag.tag;
+				if (tag <= lastTag)
+					isIncreasing = false;
+				lastTag = tag;
+				threadBits = tag & ((1 << ItemHeader::TAG_THREAD_BITS) - 1);
+				index.put("testLevel", "1", "testKey", item);
+			}
+		};
+		bool isFirstIncreasing = true;
+		bool isSecondIncreasing = true;
+		u_int64_t firstBits = 0;
+		u_int64_t secondBits = 0;
+		std::thread first(writer, "first", std::ref(isFirstIncreasing), std::ref(firstBits));
+		std::thread second(writer, "second", std::ref(isSecondIncreasing), std::ref(secondBits));
+		first.join();
+		second.join();
+		BOOST_CHECK(isFirstIncreasing && isSecondIncreasing); // tags are ordered only inside a thread
+		BOOST_CHECK(firstBits != secondBits);
+		
+		ItemHeader::UTag observedTag;
+		observedTag._time = curTime.unix();
+		observedTag._opNumber = 0xFFFF00; // a tag of another server
+		ItemHeader::observeTag(observedTag);
+		Item afterObserved("after", 5, 0, curTime.unix());
+		BOOST_CHECK(afterObserved.header().timeTag.tag > observedTag.tag);
+		
+		auto findItem = index.find("testLevel", "1", "testKey", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		lastData.assign((char*)findItem->data(), findItem->size());
+		BOOST_CHECK(index.sync(curTime.unix()));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		auto findItem = index.find("testLevel", "1", "testKey", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		std::string getData((char*)findItem->data(), findItem->size());
+		BOOST_CHECK(getData == lastData); // the shard lock orders writes of one item, the last one wins after the reload too
+	);
+}
+
 BOOST_AUTO_TEST_CASE( testIndexSyncTouch )
 {
 	TestPath testPath("nomos_index");
@@ -383,6 +511,709 @@ BOOST_AUTO_TEST_CASE( testIndexPackUnkownCMDBug )
 	);
 }	
 
+BOOST_AUTO_TEST_CASE( testIndexCompression )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	std::string testData;
+	for (int i = 0; i < 100; i++)
+		testData.append("a:2:{s:4:\"name\";s:4:\"test\";s:2:\"id\";i:1;}");
+	const char TEST_SMALL_DATA[] = "1234567";
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING, TopLevelIndex::FL_COMPRESSED));
+		
+		TItemSharedPtr item(new Item(testData.c_str(), testData.size(), 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey", item));
+		TItemSharedPtr item2(new Item(TEST_SMALL_DATA, sizeof(TEST_SMALL_DATA) - 1, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey2", item2));
+		BOOST_CHECK(index.sync(curTime.unix()));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		
+		bool isPacked = false;
+		auto findItem = index.find("testLevel", "1", "testKey", curTime.unix(), 0, &isPacked);
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(isPacked);
+		BOOST_CHECK(findItem->size() < testData.size() / 4);
+		ItemHeader::TSize unpackedSize = 0;
+		BOOST_REQUIRE(Compression::unpackedSize(findItem->data(), findItem->size(), unpackedSize));
+		BOOST_REQUIRE(unpackedSize == testData.size());
+		std::string getData(unpackedSize, 0);
+		BOOST_CHECK(Compression::unpack(findItem->data(), findItem->size(), &getData[0], unpackedSize));
+		BOOST_CHECK(getData == testData);
+		
+		findItem = index.find("testLevel", "1", "testKey2", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(findItem->size() == sizeof(TEST_SMALL_DATA)); // method byte + data
+		BOOST_REQUIRE(Compression::unpackedSize(findItem->data(), findItem->size(), unpackedSize));
+		getData.resize(unpackedSize);
+		BOOST_CHECK(Compression::unpack(findItem->data(), findItem->size(), &getData[0], unpackedSize));
+		BOOST_CHECK(getData == TEST_SMALL_DATA);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( testIndexOrderedRange )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_INT32, TopLevelIndex::FL_ORDERED));
+		const char *keys[] = {"30", "a", "1", "20", "b"};
+		for (auto key : keys) {
+			TItemSharedPtr item(new Item(key, strlen(key), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", key, item));
+		}
+		BOOST_CHECK(index.remove("testLevel", "1", "20"));
+		
+		TopLevelIndex::TItemRangeVector items;
+		BOOST_CHECK(index.findRange("testLevel", "1", "2", "30", 10, curTime.unix(), items));
+		BOOST_REQUIRE(items.size() == 3);
+		BOOST_CHECK(items[0].first == "a");
+		BOOST_CHECK(items[1].first == "b");
+		BOOST_CHECK(items[2].first == "30");
+		BOOST_CHECK(memcmp(items[2].second->data(), "30", 2) == 0);
+		
+		items.clear();
+		BOOST_CHECK(index.findRange("testLevel", "1", "", "", 2, curTime.unix(), items));
+		BOOST_REQUIRE(items.size() == 2);
+		BOOST_CHECK(items[0].first == "1");
+		BOOST_CHECK(items[1].first == "a");
+		
+		BOOST_CHECK(index.create("notOrderedLevel", KEY_INT32, KEY_INT32));
+		BOOST_CHECK(!index.findRange("notOrderedLevel", "1", "", "", 2, curTime.unix(), items));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( testIndexDense )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const char *keys[] = {"0", "255", "256", "100000", "1048576", "4294967295"}; // 1048576 starts the second table
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(!index.create("stringLevel", KEY_INT32, KEY_STRING, TopLevelIndex::FL_DENSE));
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_INT32, TopLevelIndex::FL_DENSE));
+		for (auto key : keys) {
+			TItemSharedPtr item(new Item(key, strlen(key), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", key, item));
+		}
+		BOOST_CHECK(index.remove("testLevel", "1", "256"));
+		BOOST_CHECK(index.find("testLevel", "1", "256", curTime.unix()).get() == NULL);
+		BOOST_CHECK(index.find("testLevel", "1", "257", curTime.unix()).get() == NULL);
+		BOOST_CHECK(index.sync(curTime.unix()));
+	);
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		for (auto key : keys) {
+			auto findItem = index.find("testLevel", "1", key, curTime.unix());
+			if (!strcmp(key, "256")) {
+				BOOST_CHECK(findItem.get() == NULL);
+				continue;
+			}
+			BOOST_REQUIRE(findItem.get() != NULL);
+			std::string getData((char*)findItem.get()->data(), findItem.get()->size());
+			BOOST_CHECK(getData == key);
+		}
+	);
+}
+
+size_t heapSize() // bytes allocated by malloc
+{
+#if __GLIBC_PREREQ(2, 33)
+	return mallinfo2().uordblks;
+#else
+	return mallinfo().uordblks;
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( testIndexInlineItems )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const std::string values[] = {"", "1", std::string(Item::INLINE_DATA_SIZE, 'a'), 
+		std::string(Item::INLINE_DATA_SIZE + 1, 'b'), std::string(1000, 'c')};
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_INT32));
+		BOOST_CHECK(index.create("packedLevel", KEY_INT64, KEY_INT32, TopLevelIndex::FL_COMPRESSED));
+		for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+			TItemSharedPtr item(new Item(values[i].c_str(), values[i].size(), 0, curTime.unix()));
+			BOOST_CHECK(item->isInline() == (values[i].size() <= Item::INLINE_DATA_SIZE));
+			TItemSharedPtr movedItem = std::make_shared<Item>(std::move(*item));
+			BOOST_CHECK(std::string((char*)movedItem->data(), movedItem->size()) == values[i]);
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), movedItem));
+			BOOST_CHECK(index.put("packedLevel", "1", std::to_string(i), movedItem));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+	);
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+			for (auto level : {"testLevel", "packedLevel"}) {
+				auto findItem = index.find(level, "1", std::to_string(i), curTime.unix());
+				BOOST_REQUIRE(findItem.get() != NULL);
+				std::string getData((char*)findItem.get()->data(), findItem.get()->size());
+				BOOST_CHECK(getData == values[i]);
+			}
+		}
+	);
+	
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("denseLevel", KEY_INT64, KEY_INT32, TopLevelIndex::FL_DENSE));
+		const size_t ITEMS_COUNT = 100000;
+		const std::string data("counter");
+		const size_t startSize = heapSize();
+		for (size_t i = 0; i < ITEMS_COUNT; i++) {
+			TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+			index.put("denseLevel", "1", std::to_string(i), item);
+		}
+		BOOST_CHECK(index.sync(curTime.unix())); // releases the items of the packets
+		const size_t itemSize = (heapSize() - startSize) / ITEMS_COUNT;
+		BOOST_CHECK(itemSize < (sizeof(Item) + sizeof(TItemSharedPtr))); // neither items nor their pointers are kept
+		auto findItem = index.find("denseLevel", "1", "1", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(std::string((char*)findItem->data(), findItem->size()) == data);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+// is called by the sync thread like the wake event of a worker
+class TestDurableWaiter : public DurableWaiter
+{
+public:
+	TestDurableWaiter()
+		: waitID(0), written(false)
+	{
+	}
+	virtual void durable(const uint64_t waitID, const bool written)
+	{
+		std::lock_guard<std::mutex> lock(sync);
+		this->waitID = waitID;
+		this->written = written;
+		cond.notify_all();
+	}
+	std::mutex sync;
+	std::condition_variable cond;
+	uint64_t waitID;
+	bool written;
+};
+
+BOOST_AUTO_TEST_CASE( testIndexDurable )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_INT32, Index::stringToFlag("DURABLE")));
+		BOOST_CHECK(index.create("fsyncLevel", KEY_INT64, KEY_INT32, Index::stringToFlag("FSYNC")));
+		index.setFsyncPeriod(10);
+		index.startThreads(2);
+		std::string data("durable");
+		TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "2", item));
+		BOOST_CHECK(index.put("fsyncLevel", "1", "2", item));
+		
+		TestDurableWaiter waiter; // the parked put returns at once and is acknowledged by the sync thread
+		DurableWait durableWait;
+		durableWait.waiter = &waiter;
+		durableWait.waitID = 7;
+		BOOST_CHECK(index.put("testLevel", "1", "3", item, Index::NOT_CHECK_EXISTS, &durableWait));
+		if (durableWait.isParked) { // otherwise the sync has finished before the put was parked
+			std::unique_lock<std::mutex> lock(waiter.sync);
+			while (!waiter.waitID)
+				waiter.cond.wait(lock);
+			BOOST_CHECK(waiter.waitID == 7);
+			BOOST_CHECK(waiter.written);
+		}
+		
+		Index loadIndex(testPath.path()); // put returns when the item is already written
+		BOOST_CHECK(loadIndex.load(curTime.unix()));
+		for (int i = 2; i <= 3; i++) {
+			auto findItem = loadIndex.find("testLevel", "1", std::to_string(i), curTime.unix());
+			BOOST_REQUIRE(findItem.get() != NULL);
+			std::string getData((char*)findItem.get()->data(), findItem.get()->size());
+			BOOST_CHECK(getData == data);
+		}
+	);
+}
+
+BOOST_AUTO_TEST_CASE( testIndexIoRing )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	IoRing probe;
+	const bool hasRing = probe.init(8);
+	const uint64_t ringWrites = IoRing::completedWrites();
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_INT32, Index::stringToFlag("DURABLE")));
+		index.startThreads(2, IoRing::URING); // falls back to blocking writes without io_uring
+		std::string data("uring");
+		std::string bigData(1024, 'u'); // is written from the item's memory
+		for (int i = 0; i < 100; i++) {
+			const std::string &itemData = (i % 2) ? bigData : data;
+			TItemSharedPtr item(new Item(itemData.c_str(), itemData.size(), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), item));
+		}
+		if (hasRing)
+			BOOST_CHECK(IoRing::completedWrites() > ringWrites);
+		else
+			BOOST_TEST_MESSAGE("io_uring is not available, only blocking writes are tested");
+		
+		Index loadIndex(testPath.path());
+		BOOST_CHECK(loadIndex.load(curTime.unix()));
+		for (int i = 0; i < 100; i++) {
+			TItemSharedPtr findItem = loadIndex.find("testLevel", "1", std::to_string(i), curTime.unix());
+			BOOST_REQUIRE(findItem.get() != NULL);
+			BOOST_CHECK(findItem->size() == ((i % 2) ? bigData.size() : data.size()));
+		}
+	);
+}
+
+BOOST_AUTO_TEST_CASE( testIndexMemoryOnly )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(!index.create("durableLevel", KEY_INT64, KEY_INT32, 
+			TopLevelIndex::FL_MEMORY | TopLevelIndex::FL_DURABLE));
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_INT32, Index::stringToFlag("MEMORY")));
+		std::string data("cached");
+		TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "2", item));
+		BOOST_CHECK(index.find("testLevel", "1", "2", curTime.unix()).get() != NULL);
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(index.pack(curTime.unix()));
+	);
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		BOOST_CHECK(index.size() == 1); // the level is kept, but its items are not
+		BOOST_CHECK(index.find("testLevel", "1", "2", curTime.unix()).get() == NULL);
+		TItemSharedPtr item(new Item("1", 1, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "2", item));
+	);
+}
+
+BOOST_AUTO_TEST_CASE( testIndexBin128Keys )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const char TEST_DATA[] = "1234567";
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_BIN128, KEY_BIN128, TopLevelIndex::FL_ORDERED));
+		TItemSharedPtr item(new Item(TEST_DATA, sizeof(TEST_DATA) - 1, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "123e4567-e89b-12d3-a456-426614174000", item));
+		BOOST_CHECK(index.put("testLevel", "1", "ff", item));
+
+		auto findItem = index.find("testLevel", "01", "123E4567E89B12D3A456426614174000", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		std::string getData((char*)findItem.get()->data(), findItem.get()->size());
+		BOOST_CHECK(getData == TEST_DATA);
+		BOOST_CHECK(index.find("testLevel", "1", "123e4567e89b12d3a456426614174001", curTime.unix()).get() == NULL);
+
+		TopLevelIndex::TItemRangeVector items;
+		BOOST_CHECK(index.findRange("testLevel", "1", "", "", 10, curTime.unix(), items));
+		BOOST_REQUIRE(items.size() == 2);
+		BOOST_CHECK(items[0].first == "000000000000000000000000000000ff");
+		BOOST_CHECK(items[1].first == "123e4567e89b12d3a456426614174000");
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE( testIndexShards )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const size_t SHARDS_COUNT = 4;
+	const char *subLevels[] = {"1", "2", "3", "4", "5", "6", "7", "8"};
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path(), SHARDS_COUNT);
+		BOOST_CHECK(index.shardsCount() == SHARDS_COUNT);
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		for (auto subLevel : subLevels) {
+			TItemSharedPtr item(new Item(subLevel, strlen(subLevel), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", subLevel, "key", item));
+			TItemSharedPtr expiredItem(new Item(subLevel, strlen(subLevel), curTime.unix() + 1, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", subLevel, "expired", expiredItem));
+		}
+		BOOST_CHECK(index.removeSubLevel("testLevel", "3", curTime.unix()));
+		index.clearOld(curTime.unix() + 2);
+		for (auto subLevel : subLevels) {
+			BOOST_CHECK(index.find("testLevel", subLevel, "expired", curTime.unix()).get() == NULL);
+			BOOST_CHECK((index.find("testLevel", subLevel, "key", curTime.unix()).get() == NULL) == !strcmp(subLevel, "3"));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+	);
+	BOOST_CHECK_NO_THROW(
+		Index index(testPath.path(), SHARDS_COUNT);
+		BOOST_CHECK(index.load(curTime.unix()));
+		for (auto subLevel : subLevels) {
+			auto findItem = index.find("testLevel", subLevel, "key", curTime.unix());
+			if (!strcmp(subLevel, "3")) {
+				BOOST_CHECK(findItem.get() == NULL);
+				continue;
+			}
+			BOOST_REQUIRE(findItem.get() != NULL);
+			std::string getData((char*)findItem.get()->data(), findItem.get()->size());
+			BOOST_CHECK(getData == subLevel);
+		}
+	);
+}
+
+BOOST_AUTO_TEST_CASE( testIndexColdItems )
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const char TEST_DATA[] = "1234567";
+	const char TEST_DATA2[] = "7654321";
+	const ItemHeader::TTime COLD_TIME = 600;
+	try
+	{
+		Index index(testPath.path());
+		index.setColdTier(COLD_TIME, false);
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		
+		TItemSharedPtr item(new Item(TEST_DATA, sizeof(TEST_DATA), 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey", item));
+		TItemSharedPtr item2(new Item(TEST_DATA2, sizeof(TEST_DATA2), 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "testKey2", item2));
+		BOOST_CHECK(index.sync(curTime.unix()));
+		
+		index.evictCold(curTime.unix() + COLD_TIME * 2);
+		auto findItem = index.find("testLevel", "1", "testKey", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(findItem.get() != item.get());
+		BOOST_CHECK(memcmp(findItem->data(), TEST_DATA, sizeof(TEST_DATA)) == 0);
+		
+		index.setColdTier(COLD_TIME, true);
+		findItem = index.find("testLevel", "1", "testKey2", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(memcmp(findItem->data(), TEST_DATA2, sizeof(TEST_DATA2)) == 0);
+		BOOST_CHECK(index.find("testLevel", "1", "testKey2", curTime.unix()) == findItem); // promoted
+		
+		// the packed file replaces the written one, items are moved to the cold tier from it
+		BOOST_CHECK(index.touch("testLevel", "1", "testKey2", 100, curTime.unix()));
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(index.pack(curTime.unix()));
+		index.evictCold(curTime.unix() + COLD_TIME * 2);
+		auto coldItem = index.find("testLevel", "1", "testKey2", curTime.unix());
+		BOOST_REQUIRE(coldItem.get() != NULL);
+		BOOST_CHECK(coldItem != findItem);
+		BOOST_CHECK(memcmp(coldItem->data(), TEST_DATA2, sizeof(TEST_DATA2)) == 0);
+		findItem = index.find("testLevel", "1", "testKey", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(memcmp(findItem->data(), TEST_DATA, sizeof(TEST_DATA)) == 0);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	try
+	{
+		Index index(testPath.path());
+		index.setColdTier(COLD_TIME, false);
+		BOOST_CHECK(index.load(curTime.unix()));
+		auto findItem = index.find("testLevel", "1", "testKey2", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(memcmp(findItem->data(), TEST_DATA2, sizeof(TEST_DATA2)) == 0);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE (testIndexVarIntRecords)
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const char TEST_DATA[] = "1234567";
+	const std::string LONG_KEY(300, 'k'); // needs two bytes of the length
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT64, KEY_STRING));
+		TItemSharedPtr item(new Item(TEST_DATA, sizeof(TEST_DATA) - 1, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "18446744073709551615", LONG_KEY, item));
+		TItemSharedPtr item2(new Item(TEST_DATA, sizeof(TEST_DATA) - 1, curTime.unix() + 100, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "0", "", item2));
+		TItemSharedPtr item3(new Item(TEST_DATA, sizeof(TEST_DATA) - 1, curTime.unix() + 100, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "touched", item3));
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(index.touch("testLevel", "1", "touched", 7200, curTime.unix()));
+		BOOST_CHECK(index.sync(curTime.unix()));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		auto findItem = index.find("testLevel", "18446744073709551615", LONG_KEY, curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(findItem->header().liveTo == 0);
+		BOOST_CHECK(std::string((char*)findItem->data(), findItem->size()) == TEST_DATA);
+		findItem = index.find("testLevel", "0", "", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(findItem->header().liveTo == (uint32_t)(curTime.unix() + 100));
+		findItem = index.find("testLevel", "1", "touched", curTime.unix());
+		BOOST_REQUIRE(findItem.get() != NULL);
+		BOOST_CHECK(findItem->header().liveTo == (uint32_t)(curTime.unix() + 7200));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE (testIndexBrokenTail)
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const char TEST_DATA[] = "1234567";
+	const int ITEMS_COUNT = 10;
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_INT32));
+		for (int i = 0; i < ITEMS_COUNT; i++) {
+			TItemSharedPtr item(new Item(TEST_DATA, sizeof(TEST_DATA) - 1, 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), item));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	std::string dataFileName;
+	Directory dir((std::string(testPath.path()) + "/testLevel").c_str());
+	while (dir.next()) {
+		if (!strncmp(dir.name(), TopLevelIndex::DATA_FILE_NAME.c_str(), TopLevelIndex::DATA_FILE_NAME.size()))
+			dataFileName = std::string(testPath.path()) + "/testLevel/" + dir.name();
+	}
+	BOOST_REQUIRE(!dataFileName.empty());
+	off_t fileSize = 0;
+	{
+		File fd;
+		BOOST_REQUIRE(fd.open(dataFileName.c_str(), O_RDONLY));
+		fileSize = fd.fileSize();
+	}
+	BOOST_REQUIRE(truncate(dataFileName.c_str(), fileSize - 3) == 0); // a torn write of the last record
+	
+	for (int loadNumber = 0; loadNumber < 2; loadNumber++) { // the broken tail is cut on the first load
+		try
+		{
+			Index index(testPath.path());
+			BOOST_CHECK(index.load(curTime.unix()));
+			for (int i = 0; i < ITEMS_COUNT - 1; i++)
+				BOOST_CHECK(index.find("testLevel", "1", std::to_string(i), curTime.unix()).get() != NULL);
+			BOOST_CHECK(index.find("testLevel", "1", std::to_string(ITEMS_COUNT - 1), curTime.unix()).get() == NULL);
+		}
+		catch (...)
+		{
+			BOOST_CHECK_NO_THROW(throw);
+		}
+		File fd;
+		BOOST_REQUIRE(fd.open(dataFileName.c_str(), O_RDONLY));
+		BOOST_CHECK(fd.fileSize() < (fileSize - 3));
+	}
+}
+
+BOOST_AUTO_TEST_CASE (testIndexBrokenRecord)
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const int ITEMS_COUNT = 10;
+	const int BROKEN_ITEM = 5;
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_INT32));
+		for (int i = 0; i < ITEMS_COUNT; i++) {
+			const std::string data = "data of item " + std::to_string(i);
+			TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), item));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	std::string dataFileName;
+	Directory dir((std::string(testPath.path()) + "/testLevel").c_str());
+	while (dir.next()) {
+		if (!strncmp(dir.name(), TopLevelIndex::DATA_FILE_NAME.c_str(), TopLevelIndex::DATA_FILE_NAME.size()))
+			dataFileName = std::string(testPath.path()) + "/testLevel/" + dir.name();
+	}
+	BOOST_REQUIRE(!dataFileName.empty());
+	size_t brokenSize = 0;
+	{
+		File fd;
+		BOOST_REQUIRE(fd.open(dataFileName.c_str(), O_RDWR));
+		std::string content;
+		content.resize(fd.fileSize());
+		BOOST_REQUIRE(fd.read(&content[0], content.size()) == (ssize_t)content.size());
+		const size_t dataPos = content.find("data of item " + std::to_string(BROKEN_ITEM));
+		BOOST_REQUIRE(dataPos != std::string::npos);
+		brokenSize = content.size();
+		const char damaged = 'X'; // the middle of the file is damaged, the records after it are valid
+		BOOST_REQUIRE(pwrite(fd.descr(), &damaged, 1, dataPos) == 1);
+	}
+	
+	for (int loadNumber = 0; loadNumber < 2; loadNumber++) { // the second load reads the cut file
+		try
+		{
+			Index index(testPath.path());
+			BOOST_CHECK(index.load(curTime.unix()));
+			for (int i = 0; i < ITEMS_COUNT; i++) { // sizes of a bad record can't be trusted, the rest is the tail
+				const bool isFound = index.find("testLevel", "1", std::to_string(i), curTime.unix()).get() != NULL;
+				BOOST_CHECK(isFound == (i < BROKEN_ITEM));
+			}
+		}
+		catch (...)
+		{
+			BOOST_CHECK_NO_THROW(throw);
+		}
+		File fd;
+		BOOST_REQUIRE(fd.open(dataFileName.c_str(), O_RDONLY));
+		BOOST_CHECK(static_cast<size_t>(fd.fileSize()) < brokenSize);
+	}
+}
+
+// sizes and allocated bytes of the data files of a level
+void dataFilesSize(const std::string &levelPath, off_t &size, off_t &allocated, std::string &anyFileName)
+{
+	size = 0;
+	allocated = 0;
+	Directory dir(levelPath.c_str());
+	while (dir.next()) {
+		if (strncmp(dir.name(), TopLevelIndex::DATA_FILE_NAME.c_str(), TopLevelIndex::DATA_FILE_NAME.size()))
+			continue;
+		const std::string fileName = levelPath + "/" + dir.name();
+		struct stat st;
+		BOOST_REQUIRE(stat(fileName.c_str(), &st) == 0);
+		BOOST_CHECK((st.st_blocks * 512) <= (st.st_size + st.st_blksize)); // nothing is allocated past the end
+		size += st.st_size;
+		allocated += st.st_blocks * 512;
+		anyFileName = fileName;
+	}
+}
+
+size_t varIntSize(uint64_t value)
+{
+	size_t size = 1;
+	for (; value >= 0x80; value >>= 7)
+		size++;
+	return size;
+}
+
+BOOST_AUTO_TEST_CASE (testIndexPreallocatedSegments)
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const std::string data(256 * 1024, 'p');
+	const int ITEMS_COUNT = (MAX_FILE_SIZE / data.size()) + 2; // the first data file is rotated
+	std::vector<uint32_t> opNumbers; // records differ only by the varints of the keys and the tags' operations
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_INT32));
+		BOOST_CHECK(index.create("oneItem", KEY_INT32, KEY_INT32)); // record and file header sizes
+		BOOST_CHECK(index.create("twoItems", KEY_INT32, KEY_INT32));
+		for (int i = 0; i < ITEMS_COUNT; i++) {
+			TItemSharedPtr item(new Item(data.c_str(), data.size(), 0, curTime.unix()));
+			opNumbers.push_back(item->header().timeTag._opNumber);
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), item));
+			if (i < 1)
+				BOOST_CHECK(index.put("oneItem", "1", std::to_string(i), item));
+			if (i < 2)
+				BOOST_CHECK(index.put("twoItems", "1", std::to_string(i), item));
+			BOOST_CHECK(index.sync(curTime.unix()));
+		}
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	const std::string levelPath = std::string(testPath.path()) + "/testLevel";
+	off_t oneSize, twoSize, size, allocated;
+	std::string fileName;
+	dataFilesSize(std::string(testPath.path()) + "/oneItem", oneSize, allocated, fileName);
+	dataFilesSize(std::string(testPath.path()) + "/twoItems", twoSize, allocated, fileName);
+	BOOST_REQUIRE(opNumbers.size() == static_cast<size_t>(ITEMS_COUNT));
+	const off_t baseRecordSize = twoSize - oneSize - varIntSize(opNumbers[1]) - varIntSize(1);
+	const off_t fileHeaderSize = oneSize - (baseRecordSize + varIntSize(opNumbers[0]) + varIntSize(0));
+	off_t dataSize = 2 * fileHeaderSize;
+	for (int i = 0; i < ITEMS_COUNT; i++)
+		dataSize += baseRecordSize + varIntSize(opNumbers[i]) + varIntSize(i);
+	dataFilesSize(levelPath, size, allocated, fileName);
+	BOOST_CHECK(size == dataSize);
+	
+	int fd = open(fileName.c_str(), O_WRONLY); // the space left by a crash
+	BOOST_REQUIRE(fd >= 0);
+	const bool isPreallocated = !fallocate(fd, FALLOC_FL_KEEP_SIZE, lseek(fd, 0, SEEK_END), 8 * 1024 * 1024);
+	close(fd);
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		for (int i = 0; i < ITEMS_COUNT; i++)
+			BOOST_CHECK(index.find("testLevel", "1", std::to_string(i), curTime.unix()).get() != NULL);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	off_t loadedAllocated;
+	dataFilesSize(levelPath, size, loadedAllocated, fileName);
+	BOOST_CHECK(size == dataSize);
+	if (isPreallocated)
+		BOOST_CHECK(loadedAllocated <= allocated);
+}
+
 BOOST_AUTO_TEST_CASE (testIndexReplicationLog)
 {
 	TestPath testPath("nomos_index");
@@ -417,7 +1248,26 @@ BOOST_AUTO_TEST_CASE (testIndexReplicationLog)
 		TReplicationLogNumber number = 1;
 		uint32_t seek = 0;
 		BOOST_CHECK(index.getFromReplicationLog(2, data, buffer, number, seek));
-		BOOST_CHECK(data.writtenSize() == 235); // check data sizes
+		// records' sizes depend on the tags' varints, so the packets are checked by their headers
+		Buffer packets;
+		packets.add(data.begin(), data.writtenSize());
+		std::map<std::string, size_t> levelPackets;
+		std::string levelName;
+		while (!packets.isEnded()) {
+			TopLevelIndex::ReplicationPacketHeader &rph = 
+				*(TopLevelIndex::ReplicationPacketHeader*)packets.mapBuffer(sizeof(TopLevelIndex::ReplicationPacketHeader));
+			BOOST_CHECK(rph.serverID == 1);
+			BOOST_CHECK(rph.md.version == TopLevelIndex::CURRENT_VERSION);
+			const Buffer::TSize packetStart = packets.readPos();
+			const uint32_t packetSize = rph.packetSize;
+			packets.get(levelName);
+			BOOST_REQUIRE(packetSize > (packets.readPos() - packetStart));
+			packets.skip(packetSize - (packets.readPos() - packetStart));
+			levelPackets[levelName]++;
+		}
+		BOOST_CHECK(packets.readPos() == data.writtenSize());
+		BOOST_CHECK(levelPackets.size() == 2);
+		BOOST_CHECK(levelPackets.count("testLevel") && levelPackets.count("testLevel2"));
 
 		Buffer data2;
 		BOOST_CHECK(index.getFromReplicationLog(2, data2, buffer, number, seek));
@@ -490,6 +1340,68 @@ bool addMockReplicationFile(const char *path, BString &fileName, const TReplicat
 	return true;
 }
 
+BOOST_AUTO_TEST_CASE (testIndexReplicationBigItems)
+{
+	TestPath testPath("nomos_index");
+	TestPath binLogPath("nomos_bin_log");
+	Time curTime;
+	std::string bigData(10000, 'b');
+	std::string smallData("s");
+	Buffer data;
+	try
+	{
+		Index index(testPath.path());
+		BOOST_REQUIRE(index.startReplicationLog(1, 3600, binLogPath.path()));
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_INT32));
+		for (int i = 0; i < 100; i++) { // big items are written from their own data
+			const std::string &itemData = (i % 2) ? bigData : smallData;
+			TItemSharedPtr item(new Item(itemData.c_str(), itemData.size(), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", std::to_string(i), item));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+		
+		Buffer buffer;
+		TReplicationLogNumber number = 1;
+		uint32_t seek = 0;
+		Buffer::TSize lastSize = 0;
+		do {
+			lastSize = data.writtenSize();
+			BOOST_REQUIRE(index.getFromReplicationLog(2, data, buffer, number, seek));
+		} while (data.writtenSize() > lastSize);
+		BOOST_CHECK(data.writtenSize() > 50 * 10000);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	TestPath testPath2("nomos_index");
+	TestPath binLogPath2("nomos_bin_log");
+	try
+	{
+		Index index(testPath2.path());
+		BOOST_REQUIRE(index.startReplicationLog(2, 3600, binLogPath2.path()));
+		Buffer buffer;
+		BOOST_REQUIRE(index.addFromAnotherServer(1, data, curTime.unix(), buffer));
+		
+		Index loadIndex(testPath.path());
+		BOOST_CHECK(loadIndex.load(curTime.unix()));
+		for (int i = 0; i < 100; i++) {
+			const std::string &itemData = (i % 2) ? bigData : smallData;
+			auto findItem = index.find("testLevel", "1", std::to_string(i), curTime.unix());
+			BOOST_REQUIRE(findItem.get() != NULL);
+			BOOST_CHECK(std::string((char*)findItem->data(), findItem->size()) == itemData);
+			findItem = loadIndex.find("testLevel", "1", std::to_string(i), curTime.unix());
+			BOOST_REQUIRE(findItem.get() != NULL);
+			BOOST_CHECK(std::string((char*)findItem->data(), findItem->size()) == itemData);
+		}
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
 BOOST_AUTO_TEST_CASE (testIndexReplicationLogClearing)
 {
 	TestPath testPath("nomos_index");
@@ -516,4 +1428,131 @@ BOOST_AUTO_TEST_CASE (testIndexReplicationLogClearing)
 	}
 }
 
+BOOST_AUTO_TEST_CASE (testIndexUnifiedLog)
+{
+	TestPath testPath("nomos_index");
+	TestPath binLogPath("nomos_bin_log");
+	Time curTime;
+	try
+	{
+		Index index(testPath.path());
+		index.setUnifiedLog(true);
+		BOOST_REQUIRE(index.startReplicationLog(1, 3600, binLogPath.path()));
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		TItemSharedPtr item(new Item("kept", 4, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "kept", item));
+		TItemSharedPtr item2(new Item("removed", 7, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "removed", item2));
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(index.pack(curTime.unix())); // checkpoint
+		
+		TItemSharedPtr item3(new Item("logged", 6, 0, curTime.unix()));
+		BOOST_CHECK(index.put("testLevel", "1", "logged", item3));
+		BOOST_CHECK(index.remove("testLevel", "1", "removed"));
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(index.deleteOldReplicationLog(curTime.unix() + 7200));
+		BOOST_CHECK(index.replicationLogFilesSize() == 1); // is needed to replay changes after the checkpoint
+		BOOST_CHECK(index.pack(curTime.unix())); // only the changes made after the first checkpoint
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	int dataFiles = 0;
+	int headerFiles = 0;
+	Directory dir((std::string(testPath.path()) + "/testLevel").c_str());
+	while (dir.next()) {
+		if (!strncmp(dir.name(), TopLevelIndex::DATA_FILE_NAME.c_str(), TopLevelIndex::DATA_FILE_NAME.size()))
+			dataFiles++;
+		else if (!strncmp(dir.name(), TopLevelIndex::HEADER_FILE_NAME.c_str(), 
+			TopLevelIndex::HEADER_FILE_NAME.size()))
+			headerFiles++;
+	}
+	BOOST_CHECK(dataFiles == 2); // the first checkpoint and "logged", the files are merged once a day
+	BOOST_CHECK(headerFiles == 1); // the remove
+	try
+	{
+		Index index(testPath.path());
+		index.setUnifiedLog(true);
+		BOOST_REQUIRE(index.startReplicationLog(1, 3600, binLogPath.path()));
+		BOOST_CHECK(index.load(curTime.unix()));
+		BOOST_CHECK(index.find("testLevel", "1", "kept", curTime.unix()).get() != NULL);
+		BOOST_CHECK(index.find("testLevel", "1", "logged", curTime.unix()).get() != NULL);
+		BOOST_CHECK(index.find("testLevel", "1", "removed", curTime.unix()).get() == NULL);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
+BOOST_AUTO_TEST_CASE (testIndexCheckpointSnapshot)
+{
+	TestPath testPath("nomos_index");
+	Time curTime;
+	const int ITEMS_COUNT = 20000; // the snapshot takes long enough for the changes to overlap it
+	const int CHANGES_COUNT = 1000;
+	const std::string levelPath = std::string(testPath.path()) + "/testLevel";
+	try
+	{
+		Index index(testPath.path());
+		index.setCheckpointPack(true);
+		BOOST_CHECK(index.create("testLevel", KEY_INT32, KEY_STRING));
+		for (int i = 0; i < ITEMS_COUNT; i++) {
+			const std::string key = "key" + std::to_string(i);
+			TItemSharedPtr item(new Item(key.c_str(), key.size(), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", key, item));
+		}
+		BOOST_CHECK(index.sync(curTime.unix()));
+		std::string oldDataFile;
+		Directory dir(levelPath.c_str());
+		while (dir.next()) {
+			if (!strncmp(dir.name(), TopLevelIndex::DATA_FILE_NAME.c_str(), TopLevelIndex::DATA_FILE_NAME.size()))
+				oldDataFile = levelPath + "/" + dir.name();
+		}
+		BOOST_REQUIRE(!oldDataFile.empty());
+		BOOST_CHECK(index.pack(curTime.unix())); // the snapshot period has not passed yet
+		BOOST_CHECK(access(oldDataFile.c_str(), F_OK) == 0);
+		
+		bool packResult = false;
+		const ItemHeader::TTime snapshotTime = curTime.unix() + (index.checkpointPeriod() * 3600);
+		std::thread packer([&index, &packResult, snapshotTime]() { 
+			packResult = index.pack(snapshotTime); 
+		});
+		for (int i = 0; i < CHANGES_COUNT; i++) {
+			const std::string key = "during" + std::to_string(i);
+			TItemSharedPtr item(new Item(key.c_str(), key.size(), 0, curTime.unix()));
+			BOOST_CHECK(index.put("testLevel", "1", key, item));
+			BOOST_CHECK(index.remove("testLevel", "1", "key" + std::to_string(i)));
+			if ((i % 100) == 0)
+				BOOST_CHECK(index.sync(curTime.unix()));
+		}
+		packer.join();
+		BOOST_CHECK(packResult);
+		BOOST_CHECK(index.sync(curTime.unix()));
+		BOOST_CHECK(access(oldDataFile.c_str(), F_OK) != 0); // replaced by the snapshot
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+	
+	try
+	{
+		Index index(testPath.path());
+		BOOST_CHECK(index.load(curTime.unix()));
+		for (int i = 0; i < CHANGES_COUNT; i++) { // the changes made during the snapshot survive it
+			BOOST_CHECK(index.find("testLevel", "1", "during" + std::to_string(i), curTime.unix()).get() != NULL);
+			BOOST_CHECK(index.find("testLevel", "1", "key" + std::to_string(i), curTime.unix()).get() == NULL);
+		}
+		for (int i = CHANGES_COUNT; i < ITEMS_COUNT; i++)
+			BOOST_CHECK(index.find("testLevel", "1", "key" + std::to_string(i), curTime.unix()).get() != NULL);
+	}
+	catch (...)
+	{
+		BOOST_CHECK_NO_THROW(throw);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
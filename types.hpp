@@ -25,7 +25,8 @@ namespace fl {
 			KEY_STRING,
 			KEY_INT32,
 			KEY_INT64,
-			KEY_MAX_TYPE = KEY_INT64 // should always be equal max key type
+			KEY_BIN128,
+			KEY_MAX_TYPE = KEY_BIN128 // should always be equal max key type
 		};
 		typedef uint32_t TServerID;
 		
@@ -37,6 +38,7 @@ namespace fl {
 		typedef std::vector<Server> TServerList;
 		
 		typedef uint32_t TReplicationLogNumber;
+		typedef uint8_t TLevelFlags;
 
 		typedef std::shared_ptr<class TopLevelIndex> TTopLevelIndexPtr;
 	};